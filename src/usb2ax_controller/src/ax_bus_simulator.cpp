@@ -0,0 +1,584 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include "usb2ax/dynamixel_syncread.h"
+#include "ax12ControlTableMacros.h"
+#include "axs1ControlTableMacros.h"
+
+// AX-12 bus behind a USB2AX, simulated on a pseudo-terminal, so that ax_joint_controller and
+// the benchmarks can run without hardware. Motors 1..N hold an AX-12 control table and move
+// towards their goal position at their moving speed; an optional AX-S1 sensor module answers
+// with fixed readings. PING, READ, WRITE, REG_WRITE, ACTION, RESET, SYNC_WRITE and the USB2AX
+// SYNC_READ are implemented with the status return level, the return delay time and the
+// registered instruction of each device. BULK_READ is ignored, as by the AX-12 firmware.
+//
+// Every reply is held back by the time the exchange would take on a Dynamixel bus at the given
+// baud rate (10 bits per byte, plus the return delay time of the motor), plus an optional USB
+// latency. A baud rate of 0 answers at once.
+//
+// Usage: ax_bus_simulator [link path | -] [motors] [baud rate] [sensor ID] [USB latency in us]
+// e.g.   ax_bus_simulator /tmp/ttyAX 18 1000000 100 &
+//        roslaunch usb2ax_controller controller.launch device_path:=/tmp/ttyAX
+
+
+#define AX12_TABLE_SIZE     (50)
+#define AXS1_TABLE_SIZE     (54)
+#define AX12_MODEL          (12)
+#define AXS1_MODEL          (13)
+#define USB2AX_SYNC_READ_ID (0xFD)
+
+static volatile sig_atomic_t running = 1;
+
+static void onSignal(int)
+{
+    running = 0;
+}
+
+
+static long long monotonicUsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+
+static void sleepUntilUsec(long long deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline/1000000LL;
+    ts.tv_nsec = (deadline % 1000000LL)*1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && running)
+        ;
+}
+
+
+struct Device
+{
+    int id;
+    bool isSensor;
+    std::vector<unsigned char> table;
+    std::vector<bool> writable;
+    std::vector<unsigned char> registered;  // REG_WRITE parameters waiting for ACTION
+    double position;                        // AX units, fractional while moving
+    long long lastUpdate;
+
+    int word(int address) const { return table[address] | (table[address + 1] << 8); }
+    void setWord(int address, int value)
+    {
+        table[address] = value & 0xff;
+        table[address + 1] = (value >> 8) & 0xff;
+    }
+};
+
+
+static void resetAx12(Device& d)
+{
+    d.table.assign(AX12_TABLE_SIZE, 0);
+    d.writable.assign(AX12_TABLE_SIZE, false);
+    d.setWord(AX12_MODEL_NUMBER_L, AX12_MODEL);
+    d.table[AX12_FIRMWARE_VERSION] = 24;
+    d.table[AX12_ID] = d.id;
+    d.table[AX12_BAUD_RATE] = 1;
+    d.table[AX12_RETURN_DELAY_TIME] = 250;
+    d.setWord(AX12_CW_ANGLE_LIMIT_L, 0);
+    d.setWord(AX12_CCW_ANGLE_LIMIT_L, 1023);
+    d.table[AX12_HIGH_LIMIT_TEMPERATURE] = 70;
+    d.table[AX12_LOW_LIMIT_VOLTAGE] = 60;
+    d.table[AX12_HIGH_LIMIT_VOLTAGE] = 140;
+    d.setWord(AX12_MAX_TORQUE_L, 1023);
+    d.table[AX12_STATUS_RETURN_LEVEL] = 2;
+    d.table[AX12_ALARM_LED] = 36;
+    d.table[AX12_ALARM_SHUTDOWN] = 36;
+    d.table[AX12_CW_COMPLIANCE_MARGIN] = 1;
+    d.table[AX12_CCW_COMPLIANCE_MARGIN] = 1;
+    d.table[AX12_CW_COMPLIANCE_SLOPE] = 32;
+    d.table[AX12_CCW_COMPLIANCE_SLOPE] = 32;
+    d.setWord(AX12_GOAL_POSITION_L, 512);
+    d.setWord(AX12_TORQUE_LIMIT_L, 1023);
+    d.setWord(AX12_PRESENT_POSITION_L, 512);
+    d.table[AX12_PRESENT_VOLTAGE] = 120;
+    d.table[AX12_PRESENT_TEMPERATURE] = 35;
+    d.setWord(AX12_PUNCH_L, 32);
+
+    for (int a = AX12_ID; a <= AX12_ALARM_SHUTDOWN; ++a)
+        d.writable[a] = true;
+    for (int a = AX12_TORQUE_ENABLE; a <= AX12_TORQUE_LIMIT_H; ++a)
+        d.writable[a] = true;
+    d.writable[AX12_LOCK] = true;
+    d.writable[AX12_PUNCH_L] = true;
+    d.writable[AX12_PUNCH_H] = true;
+    d.writable[10] = false;  // Reserved
+
+    d.registered.clear();
+    d.position = 512.0;
+    d.lastUpdate = monotonicUsec();
+}
+
+
+static void resetAxs1(Device& d)
+{
+    d.table.assign(AXS1_TABLE_SIZE, 0);
+    d.writable.assign(AXS1_TABLE_SIZE, false);
+    d.setWord(AXS1_MODEL_NUMBER_L, AXS1_MODEL);
+    d.table[AXS1_FIRMWARE_VERSION] = 16;
+    d.table[AXS1_ID] = d.id;
+    d.table[AXS1_BAUD_RATE] = 1;
+    d.table[AXS1_RETURN_DELAY_TIME] = 250;
+    d.table[AXS1_STATUS_RETURN_LEVEL] = 2;
+    d.table[AXS1_IR_LEFT_FIRE_DATA] = 12;
+    d.table[AXS1_IR_CENTRE_FIRE_DATA] = 40;
+    d.table[AXS1_IR_RIGHT_FIRE_DATA] = 9;
+    d.table[AXS1_LIGHT_LEFT_DATA] = 80;
+    d.table[AXS1_LIGHT_CENTRE_DATA] = 95;
+    d.table[AXS1_LIGHT_RIGHT_DATA] = 78;
+    d.table[AXS1_SOUND_DATA] = 127;
+    d.table[AXS1_IR_OBSTACLE_DETECT_COMPARE_RD] = 32;
+    d.table[AXS1_LIGHT_DETECT_COMPARE_RD] = 32;
+
+    for (int a = AXS1_ID; a <= AXS1_RETURN_DELAY_TIME; ++a)
+        d.writable[a] = true;
+    d.writable[AXS1_STATUS_RETURN_LEVEL] = true;
+    d.writable[AXS1_IR_OBSTACLE_DETECTED] = true;
+    d.writable[AXS1_LIGHT_DETECTED] = true;
+    for (int a = AXS1_SOUND_DATA_MAX_HOLD; a <= AXS1_BUZZER_RINGING_TIME; ++a)
+        d.writable[a] = true;
+    d.writable[AXS1_LOCK] = true;
+    d.writable[AXS1_REMOCON_TX_DATA_L] = true;
+    d.writable[AXS1_REMOCON_TX_DATA_H] = true;
+    d.writable[AXS1_IR_OBSTACLE_DETECT_COMPARE_RD] = true;
+    d.writable[AXS1_LIGHT_DETECT_COMPARE_RD] = true;
+
+    d.registered.clear();
+    d.lastUpdate = monotonicUsec();
+}
+
+
+// Move a motor towards its goal position since the last update
+static void updateMotion(Device& d, long long now)
+{
+    if (d.isSensor)
+        return;
+
+    double dt = (now - d.lastUpdate)*1e-6;
+    d.lastUpdate = now;
+
+    int goal = d.word(AX12_GOAL_POSITION_L);
+    int speed = d.word(AX12_MOVING_SPEED_L) & 0x3ff;
+    double error = goal - d.position;
+    if ( !d.table[AX12_TORQUE_ENABLE] || (error == 0.0) )
+    {
+        d.setWord(AX12_PRESENT_SPEED_L, 0);
+        d.table[AX12_MOVING] = 0;
+        return;
+    }
+
+    // 0.111 rpm per speed unit, 0 meaning the maximum of about 114 rpm; 0.29 deg per position unit
+    double rpm = (speed == 0) ? 114.0 : speed*0.111;
+    double step = rpm*6.0/0.29*dt;
+    if (step >= fabs(error))
+        d.position = goal;
+    else
+        d.position += (error > 0.0) ? step : -step;
+
+    d.setWord(AX12_PRESENT_POSITION_L, (int)(d.position + 0.5));
+    int presentSpeed = (d.position == goal) ? 0 : (int)(rpm/0.111);
+    if (presentSpeed > 1023)
+        presentSpeed = 1023;
+    d.setWord(AX12_PRESENT_SPEED_L, presentSpeed | ((error < 0.0) ? 0x400 : 0));
+    d.table[AX12_MOVING] = (d.position == goal) ? 0 : 1;
+}
+
+
+static int writeTable(Device& d, int address, const unsigned char* pData, int numByte)
+{
+    if ( (address < 0) || (address + numByte > (int)d.table.size()) )
+        return ERRBIT_RANGE;
+    for (int i = 0; i < numByte; ++i)
+    {
+        if (!d.writable[address + i])
+            return ERRBIT_RANGE;
+    }
+
+    updateMotion(d, monotonicUsec());
+    memcpy(&d.table[address], pData, numByte);
+    d.table[AX12_ID] = d.id;  // IDs stay fixed in the simulation
+    if ( !d.isSensor && (address <= AX12_GOAL_POSITION_H) && (address + numByte > AX12_GOAL_POSITION_L) )
+        d.table[AX12_TORQUE_ENABLE] = 1;  // As the AX-12, writing a goal position turns on the torque
+    return 0;
+}
+
+
+class Simulator
+{
+public:
+    Simulator(int fd, double baudRate, int usbLatencyUs) :
+        fd(fd), baudRate(baudRate), usbLatencyUs(usbLatencyUs),
+        numInstructions(0), numReplies(0), numChecksumErrors(0) {}
+
+    void addDevice(int id, bool isSensor)
+    {
+        Device d;
+        d.id = id;
+        d.isSensor = isSensor;
+        if (isSensor)
+            resetAxs1(d);
+        else
+            resetAx12(d);
+        devices.push_back(d);
+    }
+
+    void run()
+    {
+        unsigned char buffer[4096];
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+
+        while (running)
+        {
+            if (poll(&pfd, 1, 200) <= 0)
+                continue;
+            int n = read(fd, buffer, sizeof(buffer));
+            long long received = monotonicUsec();
+            if (n <= 0)
+                continue;
+            input.insert(input.end(), buffer, buffer + n);
+            parse(received);
+        }
+
+        fprintf(stderr, "%u instructions, %u status packets, %u checksum errors\n",
+                numInstructions, numReplies, numChecksumErrors);
+    }
+
+private:
+    int fd;
+    double baudRate;
+    int usbLatencyUs;
+    std::vector<Device> devices;
+    std::vector<unsigned char> input;
+    unsigned int numInstructions;
+    unsigned int numReplies;
+    unsigned int numChecksumErrors;
+
+    Device* findDevice(int id)
+    {
+        for (size_t i = 0; i < devices.size(); ++i)
+        {
+            if (devices[i].id == id)
+                return &devices[i];
+        }
+        return NULL;
+    }
+
+    long long busTimeUs(int numByte) const
+    {
+        return (baudRate > 0.0) ? (long long)(numByte*10.0e6/baudRate) : 0;
+    }
+
+    long long returnDelayUs(const Device& d) const
+    {
+        return (baudRate > 0.0) ? 2*d.table[AX12_RETURN_DELAY_TIME] : 0;
+    }
+
+    // Extract complete instruction packets from the input, dropping bytes up to the next header
+    void parse(long long received)
+    {
+        size_t pos = 0;
+        while (input.size() - pos >= 6)
+        {
+            if ( (input[pos] != 0xff) || (input[pos + 1] != 0xff) || (input[pos + 2] == 0xff) )
+            {
+                ++pos;
+                continue;
+            }
+            int length = input[pos + 3];
+            if (length < 2)
+            {
+                ++pos;
+                continue;
+            }
+            if (input.size() - pos < (size_t)(length + 4))
+                break;
+
+            unsigned char checksum = 0;
+            for (int i = 2; i < length + 3; ++i)
+                checksum += input[pos + i];
+            checksum = ~checksum;
+            const unsigned char* pPacket = &input[pos];
+            if (checksum == input[pos + length + 3])
+                execute(pPacket, received);
+            else
+            {
+                ++numChecksumErrors;
+                Device* d = findDevice(pPacket[2]);
+                if (d != NULL)
+                    reply(*d, ERRBIT_CHECKSUM, NULL, 0, received + busTimeUs(length + 4) + returnDelayUs(*d));
+            }
+            pos += length + 4;
+        }
+        input.erase(input.begin(), input.begin() + pos);
+    }
+
+    void sendStatus(int id, int error, const unsigned char* pData, int numByte, long long deadline)
+    {
+        unsigned char packet[MAXNUM_RXPARAM + 6];
+        packet[0] = 0xff;
+        packet[1] = 0xff;
+        packet[2] = id;
+        packet[3] = numByte + 2;
+        packet[4] = error;
+        if (numByte > 0)
+            memcpy(&packet[5], pData, numByte);
+        unsigned char checksum = 0;
+        for (int i = 2; i < numByte + 5; ++i)
+            checksum += packet[i];
+        packet[numByte + 5] = ~checksum;
+
+        // The reply leaves once the exchange would be over on a real bus
+        sleepUntilUsec(deadline + usbLatencyUs);
+        if (write(fd, packet, numByte + 6) == numByte + 6)
+            ++numReplies;
+    }
+
+    // Status packet of a device, if its status return level asks for one
+    void reply(const Device& d, int error, const unsigned char* pData, int numByte, long long deadline,
+               bool isRead = false, bool isPing = false)
+    {
+        int level = d.table[AX12_STATUS_RETURN_LEVEL];
+        if ( isPing || (level >= 2) || (isRead && (level >= 1)) )
+            sendStatus(d.id, error, pData, numByte, deadline + busTimeUs(numByte + 6));
+    }
+
+    void execute(const unsigned char* pPacket, long long received)
+    {
+        int id = pPacket[2];
+        int length = pPacket[3];
+        int instruction = pPacket[4];
+        const unsigned char* pParam = &pPacket[5];
+        int numParam = length - 2;
+        long long done = received + busTimeUs(length + 4);
+        bool broadcast = (id == BROADCAST_ID);
+        ++numInstructions;
+
+        if ( (id == USB2AX_SYNC_READ_ID) && (instruction == INST_SYNC_READ) )
+        {
+            syncRead(pParam, numParam, received);
+            return;
+        }
+
+        switch (instruction)
+        {
+        case INST_SYNC_WRITE:
+        {
+            if ( !broadcast || (numParam < 2) )
+                return;
+            int address = pParam[0];
+            int dataLength = pParam[1];
+            for (int i = 2; i + dataLength < numParam; i += dataLength + 1)
+            {
+                Device* d = findDevice(pParam[i]);
+                if (d != NULL)
+                    writeTable(*d, address, &pParam[i + 1], dataLength);
+            }
+            return;
+        }
+        case INST_ACTION:
+        {
+            for (size_t i = 0; i < devices.size(); ++i)
+            {
+                Device& d = devices[i];
+                if ( (!broadcast && (d.id != id)) || d.registered.empty() )
+                    continue;
+                writeTable(d, d.registered[0], &d.registered[1], d.registered.size() - 1);
+                d.registered.clear();
+                d.table[AX12_REGISTERED] = 0;
+                if (!broadcast)
+                    reply(d, 0, NULL, 0, done + returnDelayUs(d));
+            }
+            return;
+        }
+        default:
+            break;
+        }
+
+        // The remaining instructions act on one device, or on all of them without reply
+        for (size_t i = 0; i < devices.size(); ++i)
+        {
+            Device& d = devices[i];
+            if ( !broadcast && (d.id != id) )
+                continue;
+            long long deadline = done + returnDelayUs(d);
+
+            switch (instruction)
+            {
+            case INST_PING:
+                if (!broadcast)
+                    reply(d, 0, NULL, 0, deadline, false, true);
+                break;
+
+            case INST_READ:
+            {
+                if (broadcast || (numParam != 2))
+                    break;
+                int address = pParam[0];
+                int numByte = pParam[1];
+                updateMotion(d, monotonicUsec());
+                if (address + numByte > (int)d.table.size())
+                    reply(d, ERRBIT_RANGE, NULL, 0, deadline, true);
+                else
+                    reply(d, 0, &d.table[address], numByte, deadline, true);
+                break;
+            }
+
+            case INST_WRITE:
+            {
+                int error = (numParam >= 2) ? writeTable(d, pParam[0], &pParam[1], numParam - 1) : ERRBIT_INSTRUCTION;
+                if (!broadcast)
+                    reply(d, error, NULL, 0, deadline);
+                break;
+            }
+
+            case INST_REG_WRITE:
+            {
+                int error = 0;
+                if ( (numParam < 2) || (pParam[0] + numParam - 1 > (int)d.table.size()) )
+                    error = ERRBIT_RANGE;
+                else
+                {
+                    d.registered.assign(pParam, pParam + numParam);
+                    d.table[AX12_REGISTERED] = 1;
+                }
+                if (!broadcast)
+                    reply(d, error, NULL, 0, deadline);
+                break;
+            }
+
+            case INST_RESET:
+                if (d.isSensor)
+                    resetAxs1(d);
+                else
+                    resetAx12(d);
+                if (!broadcast)
+                    reply(d, 0, NULL, 0, deadline);
+                break;
+
+            case INST_BULK_READ:
+                // Not implemented by the AX-12 firmware: no reply
+                break;
+
+            default:
+                if (!broadcast)
+                    reply(d, ERRBIT_INSTRUCTION, NULL, 0, deadline);
+                break;
+            }
+        }
+    }
+
+    // USB2AX sync_read: the adapter reads the same window from each motor in turn and returns
+    // all the data in one status packet. If a motor does not answer, no packet is returned.
+    void syncRead(const unsigned char* pParam, int numParam, long long received)
+    {
+        if (numParam < 3)
+            return;
+        int address = pParam[0];
+        int numByte = pParam[1];
+        int numMotors = numParam - 2;
+        if (numMotors*numByte > MAXNUM_RXPARAM)
+            return;
+
+        unsigned char data[MAXNUM_RXPARAM];
+        long long deadline = received + busTimeUs(numParam + 6);
+        long long now = monotonicUsec();
+        for (int m = 0; m < numMotors; ++m)
+        {
+            Device* d = findDevice(pParam[2 + m]);
+            if ( (d == NULL) || (address + numByte > (int)d->table.size()) )
+                return;
+            updateMotion(*d, now);
+            memcpy(&data[m*numByte], &d->table[address], numByte);
+            // READ instruction and status packet on the Dynamixel side of the USB2AX
+            deadline += busTimeUs(8) + returnDelayUs(*d) + busTimeUs(numByte + 6);
+        }
+        sendStatus(USB2AX_SYNC_READ_ID, 0, data, numMotors*numByte, deadline);
+    }
+};
+
+
+int main(int argc, char **argv)
+{
+    const char* linkPath = (argc >= 2) ? argv[1] : "-";
+    int numMotors = (argc >= 3) ? atoi(argv[2]) : 18;
+    double baudRate = (argc >= 4) ? atof(argv[3]) : 1000000.0;
+    int sensorID = (argc >= 5) ? atoi(argv[4]) : 100;
+    int usbLatencyUs = (argc >= 6) ? atoi(argv[5]) : 0;
+
+    if ( (numMotors < 0) || (numMotors >= 100) || (baudRate < 0.0) )
+    {
+        fprintf(stderr, "Motors must be between 0 and 99, and the baud rate positive.\n");
+        return -1;
+    }
+
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ( (fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0) )
+    {
+        perror("posix_openpt");
+        return -1;
+    }
+    struct termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+
+    const char* ptyPath = ptsname(fd);
+    // Keep the slave side open, so that reads on the master do not fail between clients
+    int slaveFd = open(ptyPath, O_RDWR | O_NOCTTY);
+
+    bool haveLink = (strcmp(linkPath, "-") != 0);
+    if (haveLink)
+    {
+        unlink(linkPath);
+        if (symlink(ptyPath, linkPath) != 0)
+        {
+            perror("symlink");
+            return -1;
+        }
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    Simulator simulator(fd, baudRate, usbLatencyUs);
+    for (int id = 1; id <= numMotors; ++id)
+        simulator.addDevice(id, false);
+    if ( (sensorID > 0) && (sensorID < BROADCAST_ID) )
+        simulator.addDevice(sensorID, true);
+
+    printf("%d AX-12 on %s", numMotors, haveLink ? linkPath : ptyPath);
+    if (haveLink)
+        printf(" (%s)", ptyPath);
+    if ( (sensorID > 0) && (sensorID < BROADCAST_ID) )
+        printf(", AX-S1 with ID %d", sensorID);
+    if (baudRate > 0.0)
+        printf(", %.0f baud", baudRate);
+    printf("\n");
+    fflush(stdout);
+
+    simulator.run();
+
+    if (haveLink)
+        unlink(linkPath);
+    if (slaveFd >= 0)
+        close(slaveFd);
+    close(fd);
+    return 0;
+}
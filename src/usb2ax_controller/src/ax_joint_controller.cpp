@@ -1,11 +1,18 @@
 #include "ax_joint_controller.h"
+#include "control_loop.h"
 #include <string>
 #include <sstream>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <errno.h>
+#include <time.h>
 #include "usb2ax/dynamixel_syncread.h"
+#include "usb2ax/dxl_hal.h"
 #include "ax12ControlTableMacros.h"
 #include "axs1ControlTableMacros.h"
 
-#define NUM_OF_MOTORS 18
 #define FLOAT_PRECISION_THRESH 0.00001
 
 // IDs 1-99 are assumed used for motors
@@ -52,16 +59,317 @@ int main(int argc, char **argv)
     // Setup ROS
     ros::init(argc, argv, "ax_joint_controller");
     ros::NodeHandle n;
-    ros::Rate loop_rate(50);  // Hz
+    ros::NodeHandle pn("~");
     ROS_INFO("Controller node initialised.");
     ROS_INFO("Namespace: %s", n.getNamespace().c_str());
 
+    // USB2AX receive mode: "poll" sleeps on the port until the reply arrives,
+    // "spin" is the original busy-wait on non-blocking reads
+    std::string rxMode;
+    pn.param<std::string>("rx_mode", rxMode, "poll");
+    if (rxMode == "spin")
+        jointController.setRxMode(DXL_HAL_RX_SPIN);
+    else
+        jointController.setRxMode(DXL_HAL_RX_POLL);
+    ROS_INFO("USB2AX receive mode: %s", (jointController.getRxMode() == DXL_HAL_RX_SPIN) ? "spin" : "poll");
+
+    // Pipelined reads: the sync_read for the next cycle is sent right after write() and collected at the
+    // start of the next cycle, so the bus transfer overlaps the controller update and ROS spinning
+    bool pipelinedRead;
+    pn.param("pipelined_read", pipelinedRead, true);
+    jointController.setPipelinedReadEnabled(pipelinedRead);
+
+    // The AX-12 firmware does not implement BULK_READ (MX series only), so by default
+    // ReceiveBulkFromAX is served with one sync_read per distinct address window
+    bool bulkReadNative;
+    pn.param("bulk_read_native", bulkReadNative, false);
+    jointController.setBulkReadNative(bulkReadNative);
+
+    // Telemetry: the slow registers are read in the slack of the cycles, a few motors at a time, at most
+    // ~telemetry_bytes_per_cycle data bytes per cycle (at least one motor). All motors are swept
+    // ~goal_telemetry_rate times per second for ax_goal_joint_states and ~thermal_telemetry_rate times
+    // for ax_motor_telemetry; with ~moving_telemetry the moving flags are read with the state every
+    // cycle for ax_motor_moving. A topic without subscribers is not read at all.
+    int telemetryBytesPerCycle;
+    double goalTelemetryRate, thermalTelemetryRate;
+    bool movingTelemetry;
+    pn.param("telemetry_bytes_per_cycle", telemetryBytesPerCycle, 12);
+    pn.param("goal_telemetry_rate", goalTelemetryRate, 1.0);
+    pn.param("thermal_telemetry_rate", thermalTelemetryRate, 0.5);
+    pn.param("moving_telemetry", movingTelemetry, true);
+    jointController.setTelemetry(telemetryBytesPerCycle, goalTelemetryRate, thermalTelemetryRate, movingTelemetry);
+
+    // Period of the bus latency histograms on ax_bus_latency, 0 to disable
+    double latencyPublicationPeriod;
+    pn.param("latency_publication_period", latencyPublicationPeriod, 1.0);
+    jointController.setLatencyPublicationPeriod(latencyPublicationPeriod);
+
+    // Staged writes: write() preloads the goal positions with REG_WRITE and starts all joints
+    // with one broadcast ACTION per bus, instead of applying each sync_write as it arrives.
+    // StageSyncToAX without trigger is refused then: the next cycle would fire its pose.
+    bool stagedWrite;
+    pn.param("staged_write", stagedWrite, false);
+    jointController.setStagedWriteEnabled(stagedWrite);
+
+    // Status return level written to all motors at startup: 1 makes the motors answer only reads,
+    // so that a write costs only its TX bytes; -1 keeps the level stored in each motor.
+    // Unacknowledged writes can be read back every ~write_verify_period writes (0 never).
+    int statusReturnLevel, writeVerifyPeriod;
+    pn.param("status_return_level", statusReturnLevel, -1);
+    pn.param("write_verify_period", writeVerifyPeriod, 0);
+    if ( (statusReturnLevel != -1) && (statusReturnLevel != DXL_STATUS_RETURN_READ) &&
+         (statusReturnLevel != DXL_STATUS_RETURN_ALL) )
+    {
+        ROS_ERROR("~status_return_level must be -1, 1 or 2, quitting.");
+        return -1;
+    }
+    jointController.setStatusReturnLevel(statusReturnLevel);
+    jointController.setWriteVerifyPeriod(writeVerifyPeriod);
+
+    // Fault isolation: a motor whose state read fails ~fault_threshold times in a row is left out
+    // of the state sync_read, and pinged again after ~probe_backoff_min s, doubling up to
+    // ~probe_backoff_max s, until it answers
+    int faultThreshold;
+    double probeBackoffMin, probeBackoffMax;
+    pn.param("fault_threshold", faultThreshold, 3);
+    pn.param("probe_backoff_min", probeBackoffMin, 0.1);
+    pn.param("probe_backoff_max", probeBackoffMax, 5.0);
+    jointController.setFaultHandling(faultThreshold, probeBackoffMin, probeBackoffMax);
+
+    // Bus arbitration: the control loop's reads and writes come first, then service requests, then
+    // telemetry and probes. Once write() is done, the rest of the cycle less ~control_reserve_ms is
+    // slack; a service request is granted if ~service_slot_ms fits in it, and refused after waiting
+    // ~service_max_wait s.
+    double serviceSlotMs, serviceMaxWait, controlReserveMs;
+    pn.param("service_slot_ms", serviceSlotMs, 2.0);
+    pn.param("service_max_wait", serviceMaxWait, 0.5);
+    pn.param("control_reserve_ms", controlReserveMs, 5.0);
+    jointController.setArbitration(serviceSlotMs, serviceMaxWait, controlReserveMs);
+
+    // Control loop rate. The loop runs in its own thread, and ~callback_threads threads serve the
+    // services, topics and actions. In realtime mode the loop thread is SCHED_FIFO at
+    // ~realtime_priority, with memory locked and, if ~cpu_affinity >= 0, pinned to that CPU.
+    // Needs an rtprio limit for the user (limits.conf).
+    // Cycle statistics are published on ax_loop_statistics every ~loop_statistics_period s.
+    ControlLoop controlLoop(jointController);
+    double loopRate, loopStatisticsPeriod;
+    bool realtime;
+    int realtimePriority, cpuAffinity, callbackThreads;
+    pn.param("loop_rate", loopRate, 50.0);
+    pn.param("realtime", realtime, false);
+    pn.param("realtime_priority", realtimePriority, 80);
+    pn.param("cpu_affinity", cpuAffinity, -1);
+    pn.param("callback_threads", callbackThreads, 2);
+    pn.param("loop_statistics_period", loopStatisticsPeriod, 1.0);
+    if (loopRate <= 0.0)
+    {
+        ROS_ERROR("~loop_rate must be positive, quitting.");
+        return -1;
+    }
+    controlLoop.setRate(loopRate);
+    controlLoop.setRealtime(realtime, realtimePriority, cpuAffinity);
+    controlLoop.setCallbackThreads(callbackThreads);
+    controlLoop.setStatisticsPeriod(loopStatisticsPeriod);
+    ROS_INFO("Control loop: %g Hz%s.", loopRate, realtime ? ", realtime" : "");
+
+    // Goal writes: only the joints whose command moved by more than ~goal_deadband AX units (0.29 deg)
+    // since it was last sent, and all of them every ~goal_keepalive_period s. The goal_* fields of
+    // ax_bus_latency count the values and TX bytes sent and saved.
+    bool deltaWrite;
+    int goalDeadband;
+    double goalKeepAlivePeriod;
+    pn.param("delta_write", deltaWrite, true);
+    pn.param("goal_deadband", goalDeadband, 0);
+    pn.param("goal_keepalive_period", goalKeepAlivePeriod, 1.0);
+    jointController.setDeltaWrite(deltaWrite, goalDeadband, goalKeepAlivePeriod);
+
+    // Shadow of the control table of each motor: ReceiveFromAX serves the EEPROM fields from it once
+    // they are known, and the RAM fields while they were read or written less than ~shadow_max_age
+    // s ago. The age of the value is in the response.
+    bool shadowCache;
+    double shadowMaxAge;
+    pn.param("shadow_cache", shadowCache, true);
+    pn.param("shadow_max_age", shadowMaxAge, 0.1);
+    jointController.setShadowCache(shadowCache, shadowMaxAge);
+
+    // Serial device to open instead of /dev/ttyACM<device index>, e.g. the pty of ax_bus_simulator
+    std::string devicePath;
+    pn.param<std::string>("device_path", devicePath, "");
+    jointController.setDevicePath(devicePath);
+
+    // Motor discovery at startup: IDs ~scan_first_id to ~scan_last_id are pinged with a receive
+    // window of ~scan_timeout_ms, or the calibrated status timeout (253 is the USB2AX itself)
+    int scanFirstID, scanLastID;
+    double scanTimeoutMs;
+    pn.param("scan_first_id", scanFirstID, 0);
+    pn.param("scan_last_id", scanLastID, 252);
+    pn.param("scan_timeout_ms", scanTimeoutMs, 2.0);
+    jointController.setDiscoveryRange(scanFirstID, scanLastID, scanTimeoutMs);
+
+    // Receive timeouts. By default every receive window gets 34 ms of slack, the USB2AX workaround.
+    // With ~calibrate_timing the round trips of each bus are measured at startup and timeouts are
+    // fitted to them; the result is stored in ~bus_timing, which is used as is on the next start:
+    // bus_timing: [{status: [base ms, ms per byte, ms per motor], read: [...], sync_read: [...]}, ...]
+    // The CalibrateBusTiming service is refused once the control loop runs.
+    bool calibrateTiming;
+    pn.param("calibrate_timing", calibrateTiming, false);
+    int timingSamples;
+    double timingSafetyFactor, timingMarginMs;
+    pn.param("timing_samples", timingSamples, 50);
+    pn.param("timing_safety_factor", timingSafetyFactor, 1.5);
+    pn.param("timing_margin_ms", timingMarginMs, 1.0);
+    jointController.setTimingCalibration(timingSamples, timingSafetyFactor, timingMarginMs);
+    XmlRpc::XmlRpcValue busTimingList;
+    if ( !calibrateTiming && pn.getParam("bus_timing", busTimingList) &&
+         (busTimingList.getType() == XmlRpc::XmlRpcValue::TypeArray) )
+    {
+        const char* classNames[DXL_NUM_TIMING] = {"status", "read", "sync_read"};
+        for (int i = 0; i < busTimingList.size(); ++i)
+        {
+            for (int c = 0; c < DXL_NUM_TIMING; ++c)
+            {
+                if ( (busTimingList[i].getType() != XmlRpc::XmlRpcValue::TypeStruct) ||
+                     !busTimingList[i].hasMember(classNames[c]) )
+                    continue;
+                XmlRpc::XmlRpcValue& values = busTimingList[i][classNames[c]];
+                bool valid = (values.getType() == XmlRpc::XmlRpcValue::TypeArray) && (values.size() == 3);
+                double ms[3];
+                for (int k = 0; valid && (k < 3); ++k)
+                {
+                    // A hand-edited 0 is an int
+                    if (values[k].getType() == XmlRpc::XmlRpcValue::TypeInt)
+                        ms[k] = static_cast<int>(values[k]);
+                    else if (values[k].getType() == XmlRpc::XmlRpcValue::TypeDouble)
+                        ms[k] = static_cast<double>(values[k]);
+                    else
+                        valid = false;
+                }
+                if (!valid)
+                {
+                    ROS_ERROR("Invalid %s entry in ~bus_timing entry %d, quitting.", classNames[c], i);
+                    return -1;
+                }
+                DxlTiming timing;
+                timing.calibrated = 1;
+                timing.baseMs = ms[0];
+                timing.perByteMs = ms[1];
+                timing.perMotorMs = ms[2];
+                jointController.setBusTiming(i, c, timing);
+            }
+        }
+    }
+
+    // Joint table: the motor ID of each joint, whether the motor turns the other way (sign -1), and the
+    // joint angle in rad at the centre position of the motor (offset), e.g.
+    // joints: [{name: right_shoulder_swing_joint, id: 1, sign: 1, offset: 0.0},
+    //          {name: left_shoulder_swing_joint, id: 2, sign: -1}, ...]
+    // Joint states are published in this order. If not set, the 18 joints of the Bioloid humanoid.
+    XmlRpc::XmlRpcValue jointList;
+    if (pn.getParam("joints", jointList))
+    {
+        if ( (jointList.getType() != XmlRpc::XmlRpcValue::TypeArray) || (jointList.size() == 0) )
+        {
+            ROS_ERROR("~joints must be a list of joints, quitting.");
+            return -1;
+        }
+        std::vector<JointInfo> joints;
+        std::vector<bool> usedIDs(BROADCAST_ID, false);
+        for (int i = 0; i < jointList.size(); ++i)
+        {
+            if ( (jointList[i].getType() != XmlRpc::XmlRpcValue::TypeStruct) ||
+                 !jointList[i].hasMember("name") || !jointList[i].hasMember("id") )
+            {
+                ROS_ERROR("Invalid entry %d in ~joints parameter, quitting.", i);
+                return -1;
+            }
+            JointInfo joint;
+            joint.name = static_cast<std::string>(jointList[i]["name"]);
+            joint.dxlID = static_cast<int>(jointList[i]["id"]);
+            joint.sign = jointList[i].hasMember("sign") ? static_cast<int>(jointList[i]["sign"]) : 1;
+            joint.offset = 0.0;
+            if (jointList[i].hasMember("offset"))
+            {
+                XmlRpc::XmlRpcValue& offset = jointList[i]["offset"];
+                joint.offset = (offset.getType() == XmlRpc::XmlRpcValue::TypeInt) ?
+                    static_cast<int>(offset) : static_cast<double>(offset);
+            }
+            // 253 is the USB2AX itself
+            if ( (joint.dxlID < 0) || (joint.dxlID >= BROADCAST_ID - 1) || usedIDs[joint.dxlID] )
+            {
+                ROS_ERROR("Invalid or repeated ID %d in ~joints entry %d, quitting.", joint.dxlID, i);
+                return -1;
+            }
+            if ( (joint.sign != 1) && (joint.sign != -1) )
+            {
+                ROS_ERROR("Sign of ~joints entry %d must be 1 or -1, quitting.", i);
+                return -1;
+            }
+            usedIDs[joint.dxlID] = true;
+            joints.push_back(joint);
+        }
+        jointController.setJoints(joints);
+    }
+    ROS_INFO("%d joints.", (int)jointController.getJoints().size());
+
+    // Optional joint-to-bus mapping, one USB2AX per entry, e.g.
+    // buses: [{device_index: 0, ids: [7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18]},
+    //         {device_index: 1, ids: [1, 2, 3, 4, 5, 6]}]
+    // An entry may add "protocol: 2" for X series servos, which are then driven with
+    // Dynamixel Protocol 2.0 while still being addressed with the AX-12 control table,
+    // and "device_path: /dev/pts/3" to open a given tty instead of the device index.
+    // If not set, all motors are on the USB2AX given by the device index argument.
+    XmlRpc::XmlRpcValue busList;
+    if ( pn.getParam("buses", busList) && (busList.getType() == XmlRpc::XmlRpcValue::TypeArray) )
+    {
+        for (int i = 0; i < busList.size(); ++i)
+        {
+            if ( (busList[i].getType() != XmlRpc::XmlRpcValue::TypeStruct) ||
+                 !busList[i].hasMember("device_index") || !busList[i].hasMember("ids") ||
+                 (busList[i]["ids"].getType() != XmlRpc::XmlRpcValue::TypeArray) )
+            {
+                ROS_ERROR("Invalid entry %d in ~buses parameter, quitting.", i);
+                return -1;
+            }
+            std::vector<int> ids;
+            for (int j = 0; j < busList[i]["ids"].size(); ++j)
+                ids.push_back(static_cast<int>(busList[i]["ids"][j]));
+            int protocol = DXL_PROTOCOL_1;
+            if (busList[i].hasMember("protocol"))
+                protocol = static_cast<int>(busList[i]["protocol"]);
+            if ( (protocol != DXL_PROTOCOL_1) && (protocol != DXL_PROTOCOL_2) )
+            {
+                ROS_ERROR("Invalid protocol %d in ~buses entry %d, quitting.", protocol, i);
+                return -1;
+            }
+            std::string busDevicePath;
+            if (busList[i].hasMember("device_path"))
+                busDevicePath = static_cast<std::string>(busList[i]["device_path"]);
+            jointController.addBus(static_cast<int>(busList[i]["device_index"]), ids, protocol, busDevicePath);
+        }
+    }
+
     // Joint state publisher
     jointController.jointStatePub = n.advertise<sensor_msgs::JointState>("ax_joint_states", 1000);
 
     // Goal joint state publisher
     jointController.goalJointStatePub = n.advertise<sensor_msgs::JointState>("ax_goal_joint_states", 1000);
 
+    // Motor voltage and temperature publisher
+    jointController.motorTelemetryPub = n.advertise<usb2ax_controller::MotorTelemetry>("ax_motor_telemetry", 1000);
+
+    // Moving flags publisher
+    jointController.motorMovingPub = n.advertise<usb2ax_controller::MotorMoving>("ax_motor_moving", 10);
+
+    // Bus round-trip time publisher, per instruction and outcome, and per motor
+    jointController.busLatencyPub = n.advertise<usb2ax_controller::BusLatency>("ax_bus_latency", 10);
+    jointController.motorHealthPub = n.advertise<usb2ax_controller::MotorHealth>("ax_motor_health", 10);
+    controlLoop.statisticsPub = n.advertise<usb2ax_controller::LoopStatistics>("ax_loop_statistics", 10);
+
+    // Streamed goals, for clients that command joints at a high rate: the latest command of each
+    // joint goes out with the next write(), so publishing never waits for the bus
+    ros::Subscriber jointCommandSub = n.subscribe("ax_joint_commands", 100,
+        &JointController::jointCommandCallback, &jointController, ros::TransportHints().tcpNoDelay());
+
     // Services
     ros::ServiceServer receiveFromAXService = n.advertiseService("ReceiveFromAX",
         &JointController::receiveFromAX, &jointController);
@@ -72,6 +380,12 @@ int main(int argc, char **argv)
         &JointController::receiveSyncFromAX, &jointController);
     ros::ServiceServer sendSyncToAXService = n.advertiseService("SendSyncToAX",
         &JointController::sendSyncToAX, &jointController);
+    ros::ServiceServer receiveBulkFromAXService = n.advertiseService("ReceiveBulkFromAX",
+        &JointController::receiveBulkFromAX, &jointController);
+    ros::ServiceServer stageSyncToAXService = n.advertiseService("StageSyncToAX",
+        &JointController::stageSyncToAX, &jointController);
+    ros::ServiceServer triggerStagedAXService = n.advertiseService("TriggerStagedAX",
+        &JointController::triggerStagedAX, &jointController);
     //
     ros::ServiceServer getMotorCurrentPositionInRadService = n.advertiseService("GetMotorCurrentPositionInRad",
         &JointController::getMotorCurrentPositionInRad, &jointController);
@@ -115,12 +429,21 @@ int main(int argc, char **argv)
     ros::ServiceServer setMotorMaxTorquesInDecimalService = n.advertiseService("SetMotorMaxTorquesInDecimal",
         &JointController::setMotorMaxTorquesInDecimal, &jointController);
     //
+    // Commands and state of several joints in one round trip, as a service and as an action
+    ros::ServiceServer exchangeStateService = n.advertiseService("ExchangeState",
+        &JointController::exchangeState, &jointController);
+    ExchangeStateServer exchangeStateServer(n, "ExchangeStateAction",
+        boost::bind(&JointController::executeExchangeState, &jointController, _1, &exchangeStateServer), false);
+    //
     ros::ServiceServer homeMotorsService = n.advertiseService("HomeAllMotors",
         &JointController::homeAllMotors, &jointController);
+    ros::ServiceServer calibrateBusTimingService = n.advertiseService("CalibrateBusTiming",
+        &JointController::calibrateBusTiming, &jointController);
 
     // Initialise joint controller, which provides USB2AX interface and RobotHW interface for MoveIt!
     if (!jointController.init())
         return -1;
+    exchangeStateServer.start();
 
     // Initial motor settings
     usb2ax_controller::SendToAX::Request set_req;
@@ -173,26 +496,17 @@ int main(int argc, char **argv)
     jointController.sendToAX(set_req, set_res);
     ROS_INFO("All motor torques turned off.");
 
-    // Main program loop
-    ros::Time prevTime = ros::Time::now();
-    while (ros::ok())
+    // Fit the receive timeouts, now that the return delay times are set
+    if (calibrateTiming)
     {
-        const ros::Time currentTime = ros::Time::now();
-
-//        ROS_INFO("Current time (ms): %g", (currentTime.toNSec())/pow(10.0, 6));
-//        ROS_INFO("Period (ms): %g", (currentTime - prevTime).toNSec()/pow(10.0, 6));
-
-        jointController.read();
-        jointController.cm->update(currentTime, currentTime - prevTime);
-        if (jointController.getPositionControlEnabled())
-            jointController.write();
-
-        prevTime = currentTime;
-
-        ros::spinOnce();
-        loop_rate.sleep();
+        std_srvs::Empty::Request empty_req;
+        std_srvs::Empty::Response empty_res;
+        jointController.calibrateBusTiming(empty_req, empty_res);
     }
 
+    // Main program loop
+    controlLoop.run();
+
     ros::waitForShutdown();
     return 0;
 }
@@ -236,30 +550,257 @@ const std::map<int, bool> Ax12ControlTable::addressWordMap =
 };
 
 
+// The Bioloid humanoid, on motor IDs 1 to 18, when ~joints is not set
+static const struct
+{
+    const char* name;
+    int sign;
+} bioloidHumanoidJoints[] =
+{
+    {"right_shoulder_swing_joint", 1},
+    {"left_shoulder_swing_joint", -1},
+    {"right_shoulder_lateral_joint", 1},
+    {"left_shoulder_lateral_joint", -1},
+    {"right_elbow_joint", 1},
+    {"left_elbow_joint", -1},
+    {"right_hip_twist_joint", 1},
+    {"left_hip_twist_joint", -1},
+    {"right_hip_lateral_joint", -1},
+    {"left_hip_lateral_joint", 1},
+    {"right_hip_swing_joint", -1},
+    {"left_hip_swing_joint", 1},
+    {"right_knee_joint", 1},
+    {"left_knee_joint", -1},
+    {"right_ankle_swing_joint", 1},
+    {"left_ankle_swing_joint", -1},
+    {"right_ankle_lateral_joint", 1},
+    {"left_ankle_lateral_joint", -1}
+};
+
+
 JointController::JointController() :
     positionControlEnabled(false),
     deviceIndex(0),
     baudNum(1),
+    rxMode(DXL_HAL_RX_POLL),
+    motorBusIndex(BROADCAST_ID, 0),
+    jointCommandsPending(false),
+    pipelinedReadEnabled(true),
+    prefetchPending(false),
+    prefetchReady(false),
+    prefetchSuccess(false),
+    bulkReadNative(false),
+    telemetryBytesPerCycle(12),
+    goalTelemetry(AX12_GOAL_POSITION_L, 3, 6),
+    thermalTelemetry(AX12_PRESENT_VOLTAGE, 2, 2),
+    movingTelemetryEnabled(true),
+    stagedWriteEnabled(false),
+    timingCalibrationSamples(50),
+    timingSafetyFactor(1.5),
+    timingMarginMs(1.0),
+    statusReturnLevel(-1),
+    writeVerifyPeriod(0),
+    writeVerifyCounter(0),
+    scanFirstID(0),
+    scanLastID(252),
+    scanTimeoutMs(2.0),
+    faultThreshold(3),
+    probeBackoffMin(0.1),
+    probeBackoffMax(5.0),
+    deltaWriteEnabled(true),
+    goalDeadband(0),
+    goalKeepAlivePeriod(1.0),
+    timeOfLastGoalRefresh(0, 0),
+    shadowEnabled(true),
+    shadowMaxAge(0.1),
+    serviceSlot(0.002),
+    serviceMaxWait(0.5),
+    controlReserve(0.005),
+    telemetryDuration(0.0),
+    controlLoopRunning(false),
     numOfConnectedMotors(0),
-    timeOfLastGoalJointStatePublication(0, 0),
-    goalJointStatePublicationPeriodInMSecs(2000)
+    latencyPublicationPeriod(1.0),
+    latencySnapshot(new DxlStats),
+    latencyPrevious(new DxlStats)
+{
+    sem_init(&stateReady, 0, 0);
+    std::vector<JointInfo> bioloidJoints;
+    for (int j = 0; j < sizeof(bioloidHumanoidJoints)/sizeof(bioloidHumanoidJoints[0]); ++j)
+    {
+        JointInfo joint;
+        joint.name = bioloidHumanoidJoints[j].name;
+        joint.dxlID = j + 1;
+        joint.sign = bioloidHumanoidJoints[j].sign;
+        joint.offset = 0.0;
+        bioloidJoints.push_back(joint);
+    }
+    setJoints(bioloidJoints);
+}
+
+
+JointController::~JointController()
 {
-    connectedMotors.resize(NUM_OF_MOTORS);
-    for (std::vector<bool>::iterator it = connectedMotors.begin(); it != connectedMotors.end(); ++it)
-        *it = false;
+    busWorkers.stop();
+    for (std::vector<DxlBus*>::iterator it = buses.begin(); it != buses.end(); ++it)
+    {
+        dxl_bus_terminate(*it);
+        delete *it;
+    }
+    delete latencySnapshot;
+    delete latencyPrevious;
+    sem_destroy(&stateReady);
+}
 
-    joint_state.name.resize(NUM_OF_MOTORS);
-    joint_state.position.resize(NUM_OF_MOTORS);
-    joint_state.velocity.resize(NUM_OF_MOTORS);
-    joint_state.effort.resize(NUM_OF_MOTORS);
 
-    directionSign.resize(NUM_OF_MOTORS);
+void JointController::setBusTiming(int busIndex, int timingClass, const DxlTiming& timing)
+{
+    if ( (busIndex < 0) || (timingClass < 0) || (timingClass >= DXL_NUM_TIMING) )
+        return;
+    if (busTimings.size() <= busIndex)
+        busTimings.resize(busIndex + 1, std::vector<DxlTiming>(DXL_NUM_TIMING, DxlTiming()));
+    busTimings[busIndex][timingClass] = timing;
 }
 
 
-JointController::~JointController()
+void JointController::setJoints(const std::vector<JointInfo>& value)
+{
+    // Everything kept for each motor is indexed by joint; the IDs map to the joints through
+    // jointIndexForID
+    joints = value;
+    jointIndexForID.assign(BROADCAST_ID, -1);
+    jointIndexByName.clear();
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        jointIndexForID[joints[j].dxlID] = j;
+        jointIndexByName[joints[j].name] = j;
+    }
+
+    int numOfJoints = joints.size();
+    connectedMotors.assign(numOfJoints, false);
+    motorHealth.assign(numOfJoints, MotorHealthState());
+    goalSent.assign(numOfJoints, -1);
+    speedLimitSent.assign(numOfJoints, -1);
+    torqueLimitSent.assign(numOfJoints, -1);
+    MotorShadow motorShadow;
+    motorShadow.values.assign(AX12_PUNCH_H + 1, 0);
+    motorShadow.stamps.assign(AX12_PUNCH_H + 1, ros::Time(0, 0));
+    shadow.assign(numOfJoints, motorShadow);
+    jointCommands.reset(new JointCommandSlot[numOfJoints]);
+    for (int j = 0; j < numOfJoints; ++j)
+    {
+        jointCommands[j].position = NAN;
+        jointCommands[j].speed = NAN;
+        jointCommands[j].torque = NAN;
+    }
+    jointCommandsPending = false;
+
+    joint_state.name.resize(numOfJoints);
+    for (int j = 0; j < numOfJoints; ++j)
+        joint_state.name[j] = joints[j].name;
+    joint_state.position.assign(numOfJoints, 0.0);
+    joint_state.velocity.assign(numOfJoints, 0.0);
+    joint_state.effort.assign(numOfJoints, 0.0);
+}
+
+
+int JointController::jointIndex(int dxlID) const
+{
+    return ( (dxlID >= 0) && (dxlID < jointIndexForID.size()) ) ? jointIndexForID[dxlID] : -1;
+}
+
+
+int JointController::jointIndexForName(const std::string& name) const
+{
+    std::map<std::string, int>::const_iterator it = jointIndexByName.find(name);
+    return (it != jointIndexByName.end()) ? it->second : -1;
+}
+
+
+void JointController::setDiscoveryRange(int firstID, int lastID, double timeoutMs)
+{
+    scanFirstID = std::max(firstID, 0);
+    scanLastID = std::min(lastID, BROADCAST_ID - 1);
+    scanTimeoutMs = timeoutMs;
+}
+
+
+void JointController::setFaultHandling(int threshold, double backoffMin, double backoffMax)
+{
+    faultThreshold = std::max(threshold, 1);
+    probeBackoffMin = std::max(backoffMin, 0.0);
+    probeBackoffMax = std::max(backoffMax, probeBackoffMin);
+}
+
+
+void JointController::setDeltaWrite(bool enabled, int deadband, double keepAlivePeriod)
+{
+    deltaWriteEnabled = enabled;
+    goalDeadband = std::max(deadband, 0);
+    goalKeepAlivePeriod = keepAlivePeriod;
+}
+
+
+void JointController::setTelemetry(int bytesPerCycle, double goalRate, double thermalRate, bool movingEnabled)
+{
+    telemetryBytesPerCycle = bytesPerCycle;
+    goalTelemetry.rate = goalRate;
+    thermalTelemetry.rate = thermalRate;
+    movingTelemetryEnabled = movingEnabled;
+}
+
+
+void JointController::setShadowCache(bool enabled, double maxAge)
+{
+    shadowEnabled = enabled;
+    shadowMaxAge = std::max(maxAge, 0.0);
+}
+
+
+void JointController::setArbitration(double serviceSlotMs, double serviceMaxWait, double controlReserveMs)
+{
+    serviceSlot = std::max(serviceSlotMs, 0.0)/1000.0;
+    this->serviceMaxWait = serviceMaxWait;
+    controlReserve = std::max(controlReserveMs, 0.0)/1000.0;
+}
+
+
+void JointController::openSlack(const ros::WallTime& cycleStart, double cyclePeriod)
+{
+    // The control loop is done with the buses until the prefetch: the rest of the cycle, less the
+    // reserve for the prefetch and the next read(), is left to service requests and diagnostics
+    double elapsed = (ros::WallTime::now() - cycleStart).toSec();
+    scheduler.setSlack(std::max(cyclePeriod - elapsed - controlReserve, 0.0));
+}
+
+
+bool JointController::refuseService(const char* name)
+{
+    ROS_WARN_THROTTLE(1.0, "%s refused: no slack left on the buses in this cycle (%u service requests refused).",
+                      name, scheduler.getNumRefused(BusScheduler::SERVICE));
+    return false;
+}
+
+
+void JointController::setTimingCalibration(int samples, double safetyFactor, double marginMs)
 {
+    timingCalibrationSamples = std::max(samples, 1);
+    timingSafetyFactor = std::max(safetyFactor, 1.0);
+    timingMarginMs = std::max(marginMs, 0.0);
+}
+
 
+void JointController::addBus(int busDeviceIndex, const std::vector<int>& dxlIDs, int protocol,
+                             const std::string& busDevicePath)
+{
+    int busIndex = busDeviceIndices.size();
+    busDeviceIndices.push_back(busDeviceIndex);
+    busDevicePaths.push_back(busDevicePath);
+    busProtocols.push_back(protocol);
+    for (std::vector<int>::const_iterator it = dxlIDs.begin(); it != dxlIDs.end(); ++it)
+    {
+        if ( (0 <= *it) && (*it < BROADCAST_ID) )
+            motorBusIndex[*it] = busIndex;
+    }
 }
 
 
@@ -280,287 +821,1064 @@ bool JointController::init()
         ROS_WARN("Position controller DISABLED. "
                  "Command values from ROS hardware_interface will not be written to motors!");
 
-    // Initialise comms
-    if( dxl_initialize(deviceIndex, baudNum) == 0 )
+    // Initialise comms, one bus per USB2AX
+    if (busDeviceIndices.empty())
     {
-        ROS_ERROR("Failed to open USB2AX.");
-        return false;
+        busDeviceIndices.push_back(deviceIndex);
+        busDevicePaths.push_back(devicePath);
+        busProtocols.push_back(DXL_PROTOCOL_1);
     }
-    else
+    for (int i = 0; i < busDeviceIndices.size(); ++i)
     {
-        ROS_INFO("USB2AX opened successfully.");
-
-        // Find motors with IDs 1-NUM_OF_MOTORS
-        for (int dxlID = 1; dxlID <= NUM_OF_MOTORS; ++dxlID)
+        DxlBus* bus = new DxlBus;
+        dxl_bus_init(bus);
+        dxl_port_set_rx_mode(bus->port, rxMode);
+        dxl_bus_set_protocol(bus, busProtocols[i]);
+        buses.push_back(bus);
+        if (!busDevicePaths[i].empty())
         {
-            dxl_ping(dxlID);
-            if(dxl_get_result() == COMM_RXSUCCESS)
+            if( dxl_bus_initialize_path(bus, busDevicePaths[i].c_str(), baudNum) == 0 )
             {
-                connectedMotors[dxlID - 1] = true;
-                ++numOfConnectedMotors;
-                ROS_INFO("Motor with ID %d connected.", dxlID);
+                ROS_ERROR("Failed to open %s.", busDevicePaths[i].c_str());
+                return false;
             }
+            ROS_INFO("USB2AX %d is %s.", busDeviceIndices[i], busDevicePaths[i].c_str());
+        }
+        else if( dxl_bus_initialize(bus, busDeviceIndices[i], baudNum) == 0 )
+        {
+            ROS_ERROR("Failed to open USB2AX %d.", busDeviceIndices[i]);
+            return false;
+        }
+        if (busProtocols[i] == DXL_PROTOCOL_2)
+            ROS_INFO("USB2AX %d uses Dynamixel Protocol 2.0.", busDeviceIndices[i]);
+    }
+
+    ROS_INFO("%d USB2AX opened successfully.", (int)buses.size());
+    busWorkers.start(buses.size());
+
+    // Stored receive timeouts
+    for (int b = 0; (b < busTimings.size()) && (b < buses.size()); ++b)
+    {
+        for (int c = 0; c < busTimings[b].size(); ++c)
+        {
+            const DxlTiming& timing = busTimings[b][c];
+            if (timing.calibrated)
+                dxl_bus_set_timing(buses[b], c, timing.baseMs, timing.perByteMs, timing.perMotorMs);
         }
+    }
 
-        ROS_INFO("%d motors connected.", numOfConnectedMotors);
-        if (numOfConnectedMotors != NUM_OF_MOTORS)
-            ROS_WARN("Number of motors should be %d.", NUM_OF_MOTORS);
-
-        // Right arm
-        joint_state.name[0] = "right_shoulder_swing_joint";
-        directionSign[0] = 1;
-        joint_state.name[2] = "right_shoulder_lateral_joint";
-        directionSign[2] = 1;
-        joint_state.name[4] = "right_elbow_joint";
-        directionSign[4] = 1;
-
-        // Left arm
-        joint_state.name[1] ="left_shoulder_swing_joint";
-        directionSign[1] = -1;
-        joint_state.name[3] ="left_shoulder_lateral_joint";
-        directionSign[3] = -1;
-        joint_state.name[5] ="left_elbow_joint";
-        directionSign[5] = -1;
-
-        // Right leg
-        joint_state.name[6] ="right_hip_twist_joint";
-        directionSign[6] = 1;
-        joint_state.name[8] ="right_hip_lateral_joint";
-        directionSign[8] = -1;
-        joint_state.name[10] ="right_hip_swing_joint";
-        directionSign[10] = -1;
-        joint_state.name[12] ="right_knee_joint";
-        directionSign[12] = 1;
-        joint_state.name[14] ="right_ankle_swing_joint";
-        directionSign[14] = 1;
-        joint_state.name[16] ="right_ankle_lateral_joint";
-        directionSign[16] = 1;
-
-        // Left leg
-        joint_state.name[7] ="left_hip_twist_joint";
-        directionSign[7] = -1;
-        joint_state.name[9] ="left_hip_lateral_joint";
-        directionSign[9] = 1;
-        joint_state.name[11] ="left_hip_swing_joint";
-        directionSign[11] = 1;
-        joint_state.name[13] ="left_knee_joint";
-        directionSign[13] = -1;
-        joint_state.name[15] ="left_ankle_swing_joint";
-        directionSign[15] = -1;
-        joint_state.name[17] ="left_ankle_lateral_joint";
-        directionSign[17] = -1;
+    // Find the motors, and the other devices, on all buses
+    discoverMotors();
+
+    ROS_INFO("%d motors connected.", numOfConnectedMotors);
+
+    // Status return levels: the level stored in each motor, or the one asked for, so that
+    // the bus only waits for the status packets that will come
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        int dxlID = joints[j].dxlID;
+        DxlBus* bus = busForMotor(dxlID);
+        if ( !connectedMotors[j] || (dxl_bus_get_protocol(bus) != DXL_PROTOCOL_1) )
+            continue;
+        int level = dxl_bus_read_byte(bus, dxlID, AX12_STATUS_RETURN_LEVEL);
+        if (dxl_bus_get_result(bus) == COMM_RXSUCCESS)
+            dxl_bus_set_status_return_level(bus, dxlID, level);
+    }
+    if (statusReturnLevel >= 0)
+    {
+        for (int b = 0; b < buses.size(); ++b)
+        {
+            if (dxl_bus_get_protocol(buses[b]) == DXL_PROTOCOL_1)
+                dxl_bus_write_byte(buses[b], BROADCAST_ID, AX12_STATUS_RETURN_LEVEL, statusReturnLevel);
+        }
+        ROS_INFO("All status return levels set to %d.", statusReturnLevel);
+    }
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        if (!connectedMotors[j])
+            ROS_WARN("No motor with ID %d for %s.", joints[j].dxlID, joints[j].name.c_str());
     }
 
+    loadShadow();
+
     goal_joint_state = joint_state;
 
+    motor_telemetry.dxlIDs.resize(joints.size());
+    motor_telemetry.voltage.resize(joints.size(), 0.0);
+    motor_telemetry.temperature.resize(joints.size(), 0.0);
+    for (int j = 0; j < joints.size(); ++j)
+        motor_telemetry.dxlIDs[j] = joints[j].dxlID;
+    motor_moving.dxlIDs = motor_telemetry.dxlIDs;
+    motor_moving.moving.resize(joints.size(), false);
+
     // RobotHW interface for MoveIt!
-    std::vector<std::string> jointNames(NUM_OF_MOTORS);
-    for (int i = 0; i < NUM_OF_MOTORS; ++i)
-        jointNames[i] = joint_state.name[i];
-    bioloidHw = new BioloidHw(jointNames);
+    bioloidHw = new BioloidHw(joint_state.name);
     cm = new controller_manager::ControllerManager(bioloidHw);
 
     // Perform an initial read, and set cmd() to the initial read values, to avoid moving robot to home position
     // (at program start-up, all motors would be homed because cmd() is zero-initialised)
     read();
-    for (int dxlID = 1; dxlID <= numOfConnectedMotors; ++dxlID)
-        bioloidHw->setCmd( dxlID - 1, joint_state.position[dxlID - 1] );
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        if (connectedMotors[j])
+            bioloidHw->setCmd( j, joint_state.position[j] );
+    }
 
     return true;
 }
 
 
-void JointController::read()
+void JointController::discoverMotors()
 {
-    const ros::Time currentTime = ros::Time::now();
-
-    // Get position, speed and torque with a sync_read command
-    joint_state.header.stamp = currentTime;
-    usb2ax_controller::ReceiveSyncFromAX::Request req;
-    usb2ax_controller::ReceiveSyncFromAX::Response res;
-    req.dxlIDs.resize(numOfConnectedMotors);
-    req.startAddress = AX12_PRESENT_POSITION_L;
-    req.numOfValuesPerMotor = 3;
-    for (int dxlID = 1; dxlID <= numOfConnectedMotors; ++dxlID)
-    {
-        if (connectedMotors[dxlID - 1])
-            req.dxlIDs[dxlID - 1] = dxlID;
-    }
-    if ( receiveSyncFromAX(req, res) )
-    {
-        if ( res.values.size() < numOfConnectedMotors*3 )
-            return;
-
-        int i = 0;
-        for (int dxlID = 1; dxlID <= numOfConnectedMotors; ++dxlID)
+    // All buses are scanned at once, each with its calibrated status timeout if there is one.
+    // A motor belongs to the bus it answers on, whatever ~buses says.
+    ros::WallTime start = ros::WallTime::now();
+    std::vector<int> allBuses;
+    for (int b = 0; b < buses.size(); ++b)
+        allBuses.push_back(b);
+    std::vector<std::vector<DxlDeviceInfo> > found(buses.size());
+    runOnBuses(allBuses, [&](int b)
+    {
+        // Replies without the default 500 us return delay, so that the windows can be short
+        if (dxl_bus_get_protocol(buses[b]) == DXL_PROTOCOL_1)
+            dxl_bus_write_byte(buses[b], BROADCAST_ID, AX12_RETURN_DELAY_TIME, 0);
+        found[b].resize(DXL_NUM_DEVICE_ID);
+        int numDevices = dxl_bus_scan(buses[b], scanFirstID, scanLastID, pingTimeoutForBus(buses[b]),
+                                      &found[b][0], found[b].size());
+        found[b].resize(numDevices);
+    });
+
+    // A motor that answered too late for the short window of the scan would stay disconnected for
+    // the whole session: the joints not found get one more PING on their bus, with the normal
+    // status timeout
+    std::vector<bool> foundIDs(BROADCAST_ID, false);
+    for (int b = 0; b < buses.size(); ++b)
+    {
+        for (int i = 0; i < found[b].size(); ++i)
+            foundIDs[found[b][i].id] = true;
+    }
+    runOnBuses(allBuses, [&](int b)
+    {
+        for (int j = 0; j < joints.size(); ++j)
         {
-            joint_state.position[dxlID - 1] = directionSign[dxlID - 1] * axPositionToRad(res.values[i++]);
-            joint_state.velocity[dxlID - 1] = axSpeedToRadPerSec(res.values[i++]);
-            joint_state.effort[dxlID - 1] = axTorqueToDecimal(res.values[i++]);
-
-            bioloidHw->setPos( dxlID - 1, joint_state.position[dxlID - 1] );
-            bioloidHw->setVel( dxlID - 1, joint_state.velocity[dxlID - 1] );
-            bioloidHw->setEff( dxlID - 1, joint_state.effort[dxlID - 1] );
+            int dxlID = joints[j].dxlID;
+            if ( foundIDs[dxlID] || (motorBusIndex[dxlID] != b) )
+                continue;
+            dxl_bus_ping(buses[b], dxlID);
+            if (dxl_bus_get_result(buses[b]) != COMM_RXSUCCESS)
+                continue;
+            DxlDeviceInfo device;
+            device.id = dxlID;
+            device.modelNumber = dxl_bus_read_word(buses[b], dxlID, AX12_MODEL_NUMBER_L);
+            if (dxl_bus_get_result(buses[b]) != COMM_RXSUCCESS)
+                device.modelNumber = 0;
+            device.firmwareVersion = dxl_bus_read_byte(buses[b], dxlID, AX12_FIRMWARE_VERSION);
+            if (dxl_bus_get_result(buses[b]) != COMM_RXSUCCESS)
+                device.firmwareVersion = 0;
+            ROS_WARN("Motor ID %d missed the scan, found with the normal status timeout.", dxlID);
+            found[b].push_back(device);
         }
-    }
-    jointStatePub.publish(joint_state);
+    });
 
-    if ( ((currentTime - timeOfLastGoalJointStatePublication).toSec()*1000) >=
-         goalJointStatePublicationPeriodInMSecs )
+    motorInventory.clear();
+    for (int b = 0; b < buses.size(); ++b)
     {
-        // Get goal position, goal speed and max torque with a sync_read command
-        goal_joint_state.header.stamp = currentTime;
-        usb2ax_controller::ReceiveSyncFromAX::Request req;
-        usb2ax_controller::ReceiveSyncFromAX::Response res;
-        req.dxlIDs.resize(numOfConnectedMotors);
-        req.startAddress = AX12_GOAL_POSITION_L;
-        req.numOfValuesPerMotor = 3;
-        for (int dxlID = 1; dxlID <= numOfConnectedMotors; ++dxlID)
-        {
-            if (connectedMotors[dxlID - 1])
-                req.dxlIDs[dxlID - 1] = dxlID;
-        }
-        if ( receiveSyncFromAX(req, res) )
+        for (int i = 0; i < found[b].size(); ++i)
         {
-            if ( res.values.size() < numOfConnectedMotors*3 )
-                return;
-
-            int i = 0;
-            for (int dxlID = 1; dxlID <= numOfConnectedMotors; ++dxlID)
+            MotorInfo motor;
+            motor.dxlID = found[b][i].id;
+            motor.busIndex = b;
+            motor.modelNumber = found[b][i].modelNumber;
+            motor.firmwareVersion = found[b][i].firmwareVersion;
+            motorInventory.push_back(motor);
+
+            int dxlID = motor.dxlID;
+            int j = jointIndex(dxlID);
+            if (j < 0)
+            {
+                ROS_INFO("Device with ID %d (model %d, firmware %d) found on USB2AX %d.", dxlID,
+                         motor.modelNumber, motor.firmwareVersion, busDeviceIndices[b]);
+                continue;
+            }
+            if (connectedMotors[j])
+            {
+                ROS_WARN("Motor ID %d answers on USB2AX %d and %d, using USB2AX %d.", dxlID,
+                         busDeviceIndices[motorBusIndex[dxlID]], busDeviceIndices[b],
+                         busDeviceIndices[motorBusIndex[dxlID]]);
+                continue;
+            }
+            if (motorBusIndex[dxlID] != b)
             {
-                goal_joint_state.position[dxlID - 1] = directionSign[dxlID - 1] * axPositionToRad(res.values[i++]);
-                goal_joint_state.velocity[dxlID - 1] = axSpeedToRadPerSec(res.values[i++]);
-                goal_joint_state.effort[dxlID - 1] = axTorqueToDecimal(res.values[i++]);
+                ROS_WARN("Motor ID %d is mapped to USB2AX %d but found on USB2AX %d.", dxlID,
+                         busDeviceIndices[motorBusIndex[dxlID]], busDeviceIndices[b]);
+                motorBusIndex[dxlID] = b;
             }
+            connectedMotors[j] = true;
+            ++numOfConnectedMotors;
+            ROS_INFO("Motor with ID %d (model %d, firmware %d) connected on USB2AX %d for %s.", dxlID,
+                     motor.modelNumber, motor.firmwareVersion, busDeviceIndices[b], joints[j].name.c_str());
         }
-        goalJointStatePub.publish(goal_joint_state);
-
-        timeOfLastGoalJointStatePublication = currentTime;
     }
+
+    ROS_INFO("Scan of IDs %d-%d found %d devices in %.1f ms.", scanFirstID, scanLastID,
+             (int)motorInventory.size(), (ros::WallTime::now() - start).toSec()*1000.0);
 }
 
 
-void JointController::write()
+float JointController::pingTimeoutForBus(DxlBus* bus)
 {
-    // Set position with a sync_write command (speed & torque not set currently)
-    usb2ax_controller::SendSyncToAX::Request req;
-    usb2ax_controller::SendSyncToAX::Response res;
-    req.dxlIDs.resize(numOfConnectedMotors);
-    req.startAddress = AX12_GOAL_POSITION_L;
-    req.values.resize(numOfConnectedMotors*1);//*3);
-    int i = 0;
-    for (int dxlID = 1; dxlID <= numOfConnectedMotors; ++dxlID)
-    {
-//        ROS_INFO("Pos %d: %g", dxlID, bioloidHw->getPos(dxlID - 1));
-//        ROS_INFO("Cmd %d: %g", dxlID, bioloidHw->getCmd(dxlID - 1));
-        if (connectedMotors[dxlID - 1])
-        {
-            req.dxlIDs[dxlID - 1] = dxlID;
+    const DxlTiming& timing = bus->timing[DXL_TIMING_STATUS];
+    return timing.calibrated ? (timing.baseMs + 6*timing.perByteMs) : scanTimeoutMs;
+}
 
-            req.values[i++] = radToAxPosition( directionSign[dxlID - 1] * bioloidHw->getCmd(dxlID - 1) );
-//            ROS_INFO("AX value: %d", req.values[i-1]);
-//            req.values[i++] = radPerSecToAxSpeed(bioloidHw->get_(dxlID - 1));
-//            req.values[i++] = decimalToAxTorque(bioloidHw->get_(dxlID - 1));
-        }
-//        ROS_INFO("-----");
+
+bool JointController::probeMotor(int dxlID)
+{
+    // A PING with the short window of the startup scan
+    DxlBus* bus = busForMotor(dxlID);
+    if (dxl_bus_get_protocol(bus) == DXL_PROTOCOL_2)
+    {
+        dxl_bus_ping(bus, dxlID);
+        return dxl_bus_get_result(bus) == COMM_RXSUCCESS;
     }
-//    ROS_INFO("==========");
-    sendSyncToAX(req, res);
+    DxlDeviceInfo device;
+    return dxl_bus_scan(bus, dxlID, dxlID, pingTimeoutForBus(bus), &device, 1) == 1;
 }
 
 
-//void JointController::execute(const control_msgs::FollowJointTrajectoryGoalConstPtr &goal, Server* as)
-//{
-//    // Do stuff
-//    ROS_INFO("Executing FollowJointTrajectory!");
-
-//    as->setSucceeded();
-//}
+void JointController::probeDroppedMotors()
+{
+    // Ping the dropped motor due first, one per cycle, while the buses are idle between
+    // write() and the next prefetch
+    const ros::Time now = ros::Time::now();
+    int due = -1;
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        const MotorHealthState& h = motorHealth[j];
+        if ( !h.dropped || (h.nextProbe > now) )
+            continue;
+        if ( (due < 0) || (h.nextProbe < motorHealth[due].nextProbe) )
+            due = j;
+    }
+    if (due < 0)
+        return;
+    int dueID = joints[due].dxlID;
+
+    BusGrant grant(scheduler, BusScheduler::DIAGNOSTIC, pingTimeoutForBus(busForMotor(dueID))/1000.0, 0.0);
+    if (!grant.granted())
+        return;
+    completePrefetch();
+    MotorHealthState& h = motorHealth[due];
+    if (probeMotor(dueID))
+    {
+        // The backoff is kept until a state read succeeds, in case the motor fails again
+        h.dropped = false;
+        h.consecutiveFailures = 0;
+        ROS_INFO("Motor %d answers again, back in the state read.", dueID);
+    }
+    else
+    {
+        h.backoff = std::min(2*h.backoff, probeBackoffMax);
+        h.nextProbe = now + ros::Duration(h.backoff);
+    }
+}
 
 
-bool JointController::receiveFromAX(usb2ax_controller::ReceiveFromAX::Request &req,
-                                    usb2ax_controller::ReceiveFromAX::Response &res)
+void JointController::updateMotorHealth(const SyncReadTransaction& t)
 {
-    // Motor
-    if ( (1 <= req.dxlID) && (req.dxlID < 100) )
-    {
-        // Read word
-        switch (req.address)
-        {
-        case AX12_MODEL_NUMBER_L:
-        case AX12_CW_ANGLE_LIMIT_L:
-        case AX12_CCW_ANGLE_LIMIT_L:
-        case AX12_MAX_TORQUE_L:
-        case AX12_GOAL_POSITION_L:
-        case AX12_MOVING_SPEED_L:
-        case AX12_TORQUE_LIMIT_L:
-        case AX12_PRESENT_POSITION_L:
-        case AX12_PRESENT_SPEED_L:
-        case AX12_PRESENT_LOAD_L:
-        case AX12_PUNCH_L:
-        {
-            res.value = dxl_read_word(req.dxlID, req.address);
-            break;
-        }
-            // Read byte
-        default:
+    // Outcome for each motor of a state read: the first failure of its chunks, if any
+    std::vector<int> status(joints.size(), COMM_RXSUCCESS);
+    std::vector<int> errors(joints.size(), 0);
+    std::vector<bool> inRead(joints.size(), false);
+    for (int k = 0; k < t.usedBuses.size(); ++k)
+    {
+        const std::vector<SyncReadChunk>& chunks = t.busChunks[t.usedBuses[k]];
+        for (int c = 0; c < chunks.size(); ++c)
         {
-            res.value = dxl_read_byte(req.dxlID, req.address);
-            break;
-        }
+            for (int m = 0; m < chunks[c].motorIDs.size(); ++m)
+            {
+                int j = jointIndex(chunks[c].motorIDs[m]);
+                if (j < 0)
+                    continue;
+                inRead[j] = true;
+                if (status[j] == COMM_RXSUCCESS)
+                    status[j] = chunks[c].motorStatus[m];
+                errors[j] |= chunks[c].motorErrors[m];
+            }
         }
     }
-    // Sensor
-    else if (req.dxlID >= 100)
+
+    const ros::Time now = ros::Time::now();
+    for (int j = 0; j < joints.size(); ++j)
     {
-        // Read word
-        switch (req.address)
-        {
-        case AXS1_MODEL_NUMBER_L:
-        case AXS1_SOUND_DETECTED_TIME_L:
-        case AXS1_REMOCON_RX_DATA_L:
-        case AXS1_REMOCON_TX_DATA_L:
+        if (!inRead[j])
+            continue;
+        MotorHealthState& h = motorHealth[j];
+        if (status[j] == COMM_RXSUCCESS)
         {
-            res.value = dxl_read_word(req.dxlID, req.address);
-            break;
+            h.consecutiveFailures = 0;
+            h.errorBits = errors[j];
+            h.backoff = 0.0;
+            continue;
         }
-            // Read byte
-        default:
+
+        ++h.consecutiveFailures;
+        if (status[j] == COMM_RXTIMEOUT)
+            ++h.timeouts;
+        else if (status[j] == COMM_RXCORRUPT)
+            ++h.corrupt;
+        if ( !h.dropped && (h.consecutiveFailures >= faultThreshold) )
         {
-            res.value = dxl_read_byte(req.dxlID, req.address);
-            break;
-        }
+            h.dropped = true;
+            h.backoff = (h.backoff > 0.0) ? std::min(2*h.backoff, probeBackoffMax) : probeBackoffMin;
+            h.nextProbe = now + ros::Duration(h.backoff);
+            ROS_WARN("Motor %d dropped from the state read after %d failed reads, next probe in %.1f s.",
+                     joints[j].dxlID, h.consecutiveFailures, h.backoff);
         }
     }
-    else
+}
+
+
+void JointController::publishMotorHealth(const StateSample& sample)
+{
+    usb2ax_controller::MotorHealth msg;
+    msg.header.stamp = sample.jointState.header.stamp;
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        if (!sample.connectedMotors[j])
+            continue;
+        const MotorHealthState& h = sample.motorHealth[j];
+        msg.dxlIDs.push_back(joints[j].dxlID);
+        msg.stale.push_back(h.stale);
+        msg.dropped.push_back(h.dropped);
+        msg.consecutive_failures.push_back(h.consecutiveFailures);
+        msg.timeouts.push_back(h.timeouts);
+        msg.corrupt.push_back(h.corrupt);
+        msg.error_bits.push_back(h.errorBits);
+    }
+    motorHealthPub.publish(msg);
+}
+
+
+void JointController::publishBusLatency()
+{
+    // Histograms of the transactions since the previous publication, from the counters kept
+    // by the protocol layer (see dxl_stats.h)
+    if (latencyPublicationPeriod <= 0.0)
+        return;
+
+    const ros::Time currentTime = ros::Time::now();
+    if (timeOfLastLatencyPublication.isZero())
     {
-        res.rxSuccess = false;
-        return false;
+        dxl_stats_snapshot(latencyPrevious);
+        timeOfLastLatencyPublication = currentTime;
+        return;
     }
+    if ((currentTime - timeOfLastLatencyPublication).toSec() < latencyPublicationPeriod)
+        return;
 
-    int CommStatus = dxl_get_result();
-    if (CommStatus == COMM_RXSUCCESS)
+    dxl_stats_snapshot(latencySnapshot);
+    std::swap(latencySnapshot, latencyPrevious);
+    dxl_stats_diff(latencyPrevious, latencySnapshot, latencySnapshot);
+
+    usb2ax_controller::BusLatency msg;
+    msg.header.stamp = currentTime;
+    msg.period = (currentTime - timeOfLastLatencyPublication).toSec();
+    timeOfLastLatencyPublication = currentTime;
+    msg.goal_values_sent = goalWriteCounters.valuesSent;
+    msg.goal_values_skipped = goalWriteCounters.valuesSkipped;
+    msg.goal_bytes_sent = goalWriteCounters.bytesSent;
+    msg.goal_bytes_saved = goalWriteCounters.bytesSaved;
+    goalWriteCounters = GoalWriteCounters();
+
+    for (int i = 0; i < DXL_STATS_NUM_INST; ++i)
     {
-        //ROS_DEBUG("Value received: %d", res.value);
-        printErrorCode();
-        res.rxSuccess = true;
-        return true;
+        for (int j = 0; j < DXL_STATS_NUM_OUTCOME; ++j)
+        {
+            const DxlHistogram& hist = latencySnapshot->byInstruction[i][j];
+            if (dxl_stats_histogram_count(&hist) == 0)
+                continue;
+            usb2ax_controller::LatencyHistogram h;
+            fillLatencyHistogram(hist, h);
+            h.instruction = dxl_stats_instruction_name(i);
+            h.outcome = dxl_stats_outcome_name(j);
+            h.id = 0;
+            h.timeouts = (j == DXL_STATS_RXTIMEOUT) ? h.count : 0;
+            h.corrupt = (j == DXL_STATS_RXCORRUPT) ? h.count : 0;
+            msg.by_instruction.push_back(h);
+        }
     }
-    else
+
+    for (int id = 0; id < DXL_STATS_NUM_ID; ++id)
     {
-        printCommStatus(CommStatus);
-        res.rxSuccess = false;
-        return false;
+        const DxlHistogram& hist = latencySnapshot->byId[id];
+        if (dxl_stats_histogram_count(&hist) == 0)
+            continue;
+        usb2ax_controller::LatencyHistogram h;
+        fillLatencyHistogram(hist, h);
+        h.id = id;
+        h.timeouts = latencySnapshot->idOutcome[id][DXL_STATS_RXTIMEOUT];
+        h.corrupt = latencySnapshot->idOutcome[id][DXL_STATS_RXCORRUPT];
+        msg.by_id.push_back(h);
     }
+
+    busLatencyPub.publish(msg);
 }
 
 
-bool JointController::sendToAX(usb2ax_controller::SendToAX::Request &req,
-                               usb2ax_controller::SendToAX::Response &res)
+void JointController::fillLatencyHistogram(const DxlHistogram& hist, usb2ax_controller::LatencyHistogram& msg)
 {
-    // Motor
-    if ( ((1 <= req.dxlID) && (req.dxlID < 100)) || (req.dxlID == BROADCAST_ID) )
-    {
+    msg.count = dxl_stats_histogram_count(&hist);
+    msg.mean_us = (msg.count > 0) ? (float)hist.totalUs/msg.count : 0.0f;
+    msg.p50_us = dxl_stats_histogram_percentile(&hist, 50.0);
+    msg.p99_us = dxl_stats_histogram_percentile(&hist, 99.0);
+    msg.max_us = 0;
+    for (int b = 0; b < DXL_STATS_NUM_BUCKETS; ++b)
+    {
+        if (hist.count[b] == 0)
+            continue;
+        msg.bucket_upper_us.push_back(dxl_stats_bucket_upper(b));
+        msg.bucket_counts.push_back(hist.count[b]);
+        msg.max_us = dxl_stats_bucket_upper(b);
+    }
+}
+
+
+void JointController::makeStateReadRequest(usb2ax_controller::ReceiveSyncFromAX::Request &req)
+{
+    // The connected motors, less the ones dropped for failing
+    req.dxlIDs.clear();
+    req.startAddress = AX12_PRESENT_POSITION_L;
+    req.numOfValuesPerMotor = 3;
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        if (connectedMotors[j] && !motorHealth[j].dropped)
+            req.dxlIDs.push_back(joints[j].dxlID);
+    }
+}
+
+
+bool JointController::prepareStateRead(SyncReadTransaction& t)
+{
+    usb2ax_controller::ReceiveSyncFromAX::Request req;
+    makeStateReadRequest(req);
+    if ( req.dxlIDs.empty() || !prepareSyncRead(req, t) )
+        return false;
+
+    // The moving flags ride along in the same transaction, one more chunk per bus, while someone listens
+    if ( movingTelemetryEnabled && (motorMovingPub.getNumSubscribers() > 0) )
+        return addSyncReadWindow(t, AX12_MOVING, 1);
+    return true;
+}
+
+
+void JointController::prefetchRead()
+{
+    // Send the position, speed and torque sync_read for the next cycle, without waiting for the reply
+    if ( !pipelinedReadEnabled || prefetchPending || (numOfConnectedMotors == 0) )
+        return;
+
+    if (!prepareStateRead(prefetchTransaction))
+        return;
+
+    BusGrant grant(scheduler, BusScheduler::CONTROL);
+    prefetchStamp = ros::Time::now();
+    sendSyncRead(prefetchTransaction);
+    prefetchPending = true;
+    prefetchReady = false;
+}
+
+
+void JointController::completePrefetch()
+{
+    // Collect an outstanding prefetch, so that the buses are free for the next command.
+    // The values are kept for the next read().
+    if (!prefetchPending)
+        return;
+
+    receiveSyncRead(prefetchTransaction);
+    prefetchSuccess = mergeSyncRead(prefetchTransaction, prefetchValues, &prefetchValid);
+    updateMotorHealth(prefetchTransaction);
+    prefetchPending = false;
+    prefetchReady = true;
+}
+
+
+void JointController::loadShadow()
+{
+    // The EEPROM area of every motor, in two sync_reads around the reserved address 10, so that it
+    // is never read again from the bus; and the goal position, moving speed and torque limit, which
+    // write() falls back on for the limits no controller commands
+    usb2ax_controller::ReceiveSyncFromAX::Request req;
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        if (connectedMotors[j])
+            req.dxlIDs.push_back(joints[j].dxlID);
+    }
+    if ( !shadowEnabled || req.dxlIDs.empty() )
+        return;
+
+    const int windows[3][2] = {{AX12_MODEL_NUMBER_L, 7}, {AX12_HIGH_LIMIT_TEMPERATURE, 7}, {AX12_GOAL_POSITION_L, 3}};
+    for (int w = 0; w < 3; ++w)
+    {
+        req.startAddress = windows[w][0];
+        req.numOfValuesPerMotor = windows[w][1];
+        SyncReadTransaction t;
+        std::vector<uint16_t> values;
+        if (!prepareSyncRead(req, t))
+            continue;
+        sendSyncRead(t);
+        receiveSyncRead(t);
+        if (!mergeSyncRead(t, values))
+            ROS_WARN("Control table of some motors not cached, it will be read on demand.");
+    }
+}
+
+
+bool JointController::lookupShadow(int dxlID, int address, int& value, double& age)
+{
+    // EEPROM fields only change through the controller's own writes, so they are served as long
+    // as they are known; RAM fields only while younger than the maximum age
+    int j = jointIndex(dxlID);
+    if ( !shadowEnabled || (j < 0) || (address < 0) || (address > AX12_PUNCH_H) )
+        return false;
+
+    std::lock_guard<std::mutex> lock(shadowMutex);
+    const MotorShadow& motorShadow = shadow[j];
+    if (motorShadow.stamps[address].isZero())
+        return false;
+    age = std::max((ros::Time::now() - motorShadow.stamps[address]).toSec(), 0.0);
+    if ( (address >= AX12_TORQUE_ENABLE) && (age > shadowMaxAge) )
+        return false;
+    value = motorShadow.values[address];
+    return true;
+}
+
+
+bool JointController::shadowValue(int dxlID, int address, int& value)
+{
+    // Last known value, however old
+    int j = jointIndex(dxlID);
+    if ( (j < 0) || (address < 0) || (address > AX12_PUNCH_H) )
+        return false;
+
+    std::lock_guard<std::mutex> lock(shadowMutex);
+    const MotorShadow& motorShadow = shadow[j];
+    if (motorShadow.stamps[address].isZero())
+        return false;
+    value = motorShadow.values[address];
+    return true;
+}
+
+
+void JointController::storeShadow(int dxlID, int startAddress, const std::vector<uint16_t>& values, int first,
+                                  int count, const ros::Time& stamp)
+{
+    // Values as laid out by the services, one per control table entry from startAddress
+    int j = jointIndex(dxlID);
+    if (j < 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(shadowMutex);
+    MotorShadow& motorShadow = shadow[j];
+    int address = startAddress;
+    for (int j = 0; j < count; ++j)
+    {
+        std::map<int, bool>::const_iterator it = Ax12ControlTable::addressWordMap.find(address);
+        if (it == Ax12ControlTable::addressWordMap.end())
+            return;
+        motorShadow.values[address] = values[first + j];
+        motorShadow.stamps[address] = stamp;
+        address += it->second ? 2 : 1;
+    }
+}
+
+
+void JointController::invalidateShadow(int dxlID, int startAddress, int count)
+{
+    // count < 0 forgets everything from startAddress
+    int j = jointIndex(dxlID);
+    if (j < 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(shadowMutex);
+    MotorShadow& motorShadow = shadow[j];
+    int end = (count < 0) ? (AX12_PUNCH_H + 1) : std::min(startAddress + 2*count, AX12_PUNCH_H + 1);
+    for (int address = std::max(startAddress, 0); address < end; ++address)
+        motorShadow.stamps[address] = ros::Time(0, 0);
+}
+
+
+void JointController::read()
+{
+    const ros::Time currentTime = ros::Time::now();
+
+    // Get position, speed and torque with a sync_read command, or from the prefetched one.
+    // The stamp is the time the sync_read was sent.
+    // A motor that does not answer only loses its own state, which keeps the last value read
+    // and is flagged stale on ax_motor_health.
+    std::vector<uint16_t> values;
+    std::vector<int> readIDs;
+    std::vector<bool> motorValid;
+    int numOfValues = 0;              // Per motor: the state, then the moving flag if it was read
+    BusGrant grant(scheduler, BusScheduler::CONTROL);
+    completePrefetch();
+    if (prefetchReady)
+    {
+        joint_state.header.stamp = prefetchStamp;
+        values = prefetchValues;
+        readIDs = prefetchTransaction.dxlIDs;
+        motorValid = prefetchValid;
+        numOfValues = prefetchTransaction.numOfValuesPerMotor;
+        prefetchReady = false;
+    }
+    else
+    {
+        joint_state.header.stamp = currentTime;
+        SyncReadTransaction t;
+        if (prepareStateRead(t))
+        {
+            sendSyncRead(t);
+            receiveSyncRead(t);
+            mergeSyncRead(t, values, &motorValid);
+            updateMotorHealth(t);
+            readIDs = t.dxlIDs;
+            numOfValues = t.numOfValuesPerMotor;
+        }
+    }
+
+    for (int j = 0; j < joints.size(); ++j)
+        motorHealth[j].stale = true;
+    bool movingRead = false;
+    for (int i = 0; (i < readIDs.size()) && (numOfValues >= 3) && (numOfValues*i + 2 < values.size()); ++i)
+    {
+        int j = jointIndex(readIDs[i]);
+        if ( !motorValid[i] || (j < 0) )
+            continue;
+        const uint16_t* state = &values[numOfValues*i];
+        joint_state.position[j] = jointPositionFromAx(j, state[0]);
+        joint_state.velocity[j] = axSpeedToRadPerSec(state[1]);
+        joint_state.effort[j] = axTorqueToDecimal(state[2]);
+        if ( (numOfValues > 3) && (j < motor_moving.moving.size()) )
+        {
+            motor_moving.moving[j] = (state[3] != 0);
+            movingRead = true;
+        }
+
+        bioloidHw->setPos( j, joint_state.position[j] );
+        bioloidHw->setVel( j, joint_state.velocity[j] );
+        bioloidHw->setEff( j, joint_state.effort[j] );
+        motorHealth[j].stale = false;
+    }
+    // Published with the motor health by the publication thread, so that serialising the messages
+    // is not done in the cycle
+    StateSample& sample = stateBuffer.writeBuffer();
+    sample.jointState = joint_state;
+    sample.movingRead = movingRead;
+    if (movingRead)
+    {
+        motor_moving.header.stamp = joint_state.header.stamp;
+        sample.motorMoving = motor_moving;
+    }
+    sample.motorHealth = motorHealth;
+    sample.connectedMotors = connectedMotors;
+    stateBuffer.commit();
+    sem_post(&stateReady);
+}
+
+
+void JointController::publishState(double maxWait)
+{
+    // Waits up to maxWait s for a state from read() and publishes it. The semaphore counts the
+    // commits, so one posted before the wait is not lost; the states committed meanwhile are
+    // all in the last one, and their posts are taken at once.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    long long ns = deadline.tv_nsec + (long long)(maxWait*1e9);
+    deadline.tv_sec += ns/1000000000LL;
+    deadline.tv_nsec = ns%1000000000LL;
+    while ( (sem_timedwait(&stateReady, &deadline) != 0) && (errno == EINTR) )
+        ;
+    while (sem_trywait(&stateReady) == 0)
+        ;
+    if (!stateBuffer.fetch())
+        return;
+    const StateSample& sample = stateBuffer.readBuffer();
+    jointStatePub.publish(sample.jointState);
+    if (sample.movingRead)
+        motorMovingPub.publish(sample.motorMoving);
+    publishMotorHealth(sample);
+}
+
+
+void JointController::readTelemetry()
+{
+    // Slow registers, spread over the cycles: each group sweeps all motors at its own rate, a few motors
+    // per cycle, and a cycle reads at most telemetryBytesPerCycle data bytes (at least one motor), so
+    // that no cycle gets a long read. A group nobody listens to is not read.
+    const ros::Time currentTime = ros::Time::now();
+    std::vector<int> motors;
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        if (connectedMotors[j] && !motorHealth[j].dropped)
+            motors.push_back(joints[j].dxlID);
+    }
+    if (motors.empty())
+        return;
+
+    TelemetryGroup* groups[2] = {&goalTelemetry, &thermalTelemetry};
+    const ros::Publisher* publishers[2] = {&goalJointStatePub, &motorTelemetryPub};
+    int numToRead[2] = {0, 0};
+    int budget = telemetryBytesPerCycle;
+    for (int g = 0; g < 2; ++g)
+    {
+        TelemetryGroup& group = *groups[g];
+        if ( (group.rate <= 0.0) || (publishers[g]->getNumSubscribers() == 0) )
+        {
+            // Start afresh when someone subscribes, rather than with a burst of late reads
+            group.nextRead = currentTime;
+            continue;
+        }
+        if (group.nextIndex >= motors.size())
+            group.nextIndex = 0;
+        if (group.nextRead > currentTime)
+            continue;
+
+        // The motors due by now, within the budget and the sweep
+        double interval = 1.0/(group.rate*motors.size());  // s between two motors
+        int due = (int)((currentTime - group.nextRead).toSec()/interval) + 1;
+        int affordable = std::max(budget/group.dataLength, (budget == telemetryBytesPerCycle) ? 1 : 0);
+        numToRead[g] = std::min(std::min(due, affordable), (int)motors.size() - group.nextIndex);
+        budget -= numToRead[g]*group.dataLength;
+    }
+    if ( (numToRead[0] == 0) && (numToRead[1] == 0) )
+        return;
+
+    // Diagnostics only run in the slack of the cycle: if the last read does not fit, the groups
+    // stay due for the next cycle
+    BusGrant grant(scheduler, BusScheduler::DIAGNOSTIC, telemetryDuration, 0.0);
+    if (!grant.granted())
+        return;
+    const ros::WallTime start = ros::WallTime::now();
+    for (int g = 0; g < 2; ++g)
+    {
+        if (numToRead[g] == 0)
+            continue;
+        if (readTelemetryGroup(*groups[g], motors, numToRead[g], currentTime) > 0)
+            continue;
+
+        // End of a sweep
+        if (groups[g] == &goalTelemetry)
+        {
+            goal_joint_state.header.stamp = currentTime;
+            goalJointStatePub.publish(goal_joint_state);
+        }
+        else
+        {
+            motor_telemetry.header.stamp = currentTime;
+            motorTelemetryPub.publish(motor_telemetry);
+        }
+    }
+    telemetryDuration = (ros::WallTime::now() - start).toSec();
+}
+
+
+int JointController::readTelemetryGroup(TelemetryGroup& group, const std::vector<int>& motors, int maxMotors,
+                                        const ros::Time& currentTime)
+{
+    // Reads the next motors of the sweep; returns the index of the next one, 0 when the sweep is done
+    usb2ax_controller::ReceiveSyncFromAX::Request req;
+    req.startAddress = group.startAddress;
+    req.numOfValuesPerMotor = group.numOfValues;
+    req.dxlIDs.assign(motors.begin() + group.nextIndex, motors.begin() + group.nextIndex + maxMotors);
+    SyncReadTransaction t;
+    std::vector<uint16_t> values;
+    std::vector<bool> motorValid;
+    if (prepareSyncRead(req, t))
+    {
+        sendSyncRead(t);
+        receiveSyncRead(t);
+        mergeSyncRead(t, values, &motorValid);
+        for (int i = 0; i < t.numOfMotors; ++i)
+        {
+            if (!motorValid[i])
+                continue;
+            int address = group.startAddress;
+            for (int j = 0; j < group.numOfValues; ++j)
+            {
+                applyTelemetryValue(t.dxlIDs[i], address, values[i*group.numOfValues + j]);
+                address += Ax12ControlTable::addressWordMap.at(address) ? 2 : 1;
+            }
+        }
+    }
+
+    // A motor that does not answer keeps its last value, and is not read again before the next sweep
+    double interval = 1.0/(group.rate*motors.size());
+    group.nextRead += ros::Duration(maxMotors*interval);
+    if (group.nextRead < currentTime - ros::Duration(1.0/group.rate))
+        group.nextRead = currentTime;
+    group.nextIndex += maxMotors;
+    if (group.nextIndex >= motors.size())
+        group.nextIndex = 0;
+    return group.nextIndex;
+}
+
+
+void JointController::applyTelemetryValue(int dxlID, int address, int value)
+{
+    int j = jointIndex(dxlID);
+    if (j < 0)
+        return;
+    switch (address)
+    {
+    case AX12_GOAL_POSITION_L:
+        goal_joint_state.position[j] = jointPositionFromAx(j, value);
+        break;
+    case AX12_MOVING_SPEED_L:
+        goal_joint_state.velocity[j] = axSpeedToRadPerSec(value);
+        break;
+    case AX12_TORQUE_LIMIT_L:
+        goal_joint_state.effort[j] = axTorqueToDecimal(value);
+        break;
+    case AX12_PRESENT_VOLTAGE:
+        motor_telemetry.voltage[j] = value/10.0;  // 0.1 V per unit
+        break;
+    case AX12_PRESENT_TEMPERATURE:
+        motor_telemetry.temperature[j] = value;  // Degrees C
+        break;
+    default:
+        break;
+    }
+}
+
+
+// TX bytes of the goal writes of a bus: a sync_write is 8 bytes plus the ID and data of each motor;
+// a REG_WRITE is 7 bytes plus the data, and the staged values start with one 6-byte ACTION
+static unsigned int goalWriteBytes(int numOfPositions, int numOfFull, bool staged)
+{
+    unsigned int bytes = 0;
+    if (staged)
+    {
+        bytes = numOfPositions*(7 + 2) + numOfFull*(7 + 6);
+        return (bytes > 0) ? (bytes + 6) : 0;
+    }
+    if (numOfPositions > 0)
+        bytes += 8 + numOfPositions*(1 + 2);
+    if (numOfFull > 0)
+        bytes += 8 + numOfFull*(1 + 6);
+    return bytes;
+}
+
+
+void JointController::write()
+{
+    // Goal position of every joint, with its moving speed and torque limit when a controller
+    // commands them: addresses 30 to 35 in one sync_write, 6 bytes per motor. A limit a controller
+    // leaves unset keeps the value last known in the shadow.
+    // Only the joints whose command moved by more than the dead-band from the values last sent are
+    // written, and all of them every keep-alive period, since bus time is what limits the rate.
+    // The commands streamed on ax_joint_commands since the last cycle go out in the same sync_writes:
+    // they take over from the controllers for this cycle, and are the only goals written when
+    // position control is off. A joint streamed without a position keeps its goal from the shadow.
+    bool streamed = jointCommandsPending.exchange(false);
+    if (!positionControlEnabled && !streamed)
+        return;
+
+    BusGrant grant(scheduler, BusScheduler::CONTROL);
+    const ros::Time currentTime = ros::Time::now();
+    bool refreshAll = positionControlEnabled && ( !deltaWriteEnabled || timeOfLastGoalRefresh.isZero() ||
+        ((goalKeepAlivePeriod > 0.0) && ((currentTime - timeOfLastGoalRefresh).toSec() >= goalKeepAlivePeriod)) );
+    usb2ax_controller::SendSyncToAX::Request positionReq, fullReq;
+    positionReq.startAddress = AX12_GOAL_POSITION_L;
+    fullReq.startAddress = AX12_GOAL_POSITION_L;
+    std::vector<int> busPositions(buses.size(), 0), busFull(buses.size(), 0);
+    std::vector<int> busPositionsSent(buses.size(), 0), busFullSent(buses.size(), 0);
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        float streamPosition = NAN, streamSpeed = NAN, streamTorque = NAN;
+        if (streamed)
+        {
+            streamPosition = jointCommands[j].position.exchange(NAN);
+            streamSpeed = jointCommands[j].speed.exchange(NAN);
+            streamTorque = jointCommands[j].torque.exchange(NAN);
+        }
+        bool stream = !std::isnan(streamPosition) || !std::isnan(streamSpeed) || !std::isnan(streamTorque);
+        if ( !connectedMotors[j] || (!positionControlEnabled && !stream) )
+            continue;
+        int dxlID = joints[j].dxlID;
+        int b = motorBusIndex[dxlID];
+        int position;
+        if (!std::isnan(streamPosition))
+            position = jointPositionToAx(j, streamPosition);
+        else if (positionControlEnabled)
+            position = jointPositionToAx( j, bioloidHw->getCmd(j) );
+        else if (!shadowValue(dxlID, AX12_GOAL_POSITION_L, position))
+        {
+            ROS_WARN_THROTTLE(1.0, "Goal position of motor %d unknown, command on ax_joint_commands dropped.", dxlID);
+            continue;
+        }
+        double velCmd = !std::isnan(streamSpeed) ? streamSpeed : (positionControlEnabled ? bioloidHw->getVelCmd(j) : NAN);
+        double effCmd = !std::isnan(streamTorque) ? streamTorque : (positionControlEnabled ? bioloidHw->getEffCmd(j) : NAN);
+        bool changed = refreshAll || stream || (goalSent[j] < 0) || (std::abs(position - goalSent[j]) > goalDeadband);
+        // Speed 0 is the full speed of an AX-12, so the slowest speed is 1 unit (0.0116 rad/s).
+        // A limit left unset comes from the shadow, or is the one write() sent last; if neither
+        // is known, only the goal position is written rather than a made-up limit.
+        bool limits = !std::isnan(velCmd) || !std::isnan(effCmd);
+        int speed = speedLimitSent[j], torque = torqueLimitSent[j];
+        if (!std::isnan(velCmd))
+            speed = std::max(radPerSecToAxSpeed( std::min(std::fabs(velCmd), 1023*0.0116) ), 1);
+        else if ( limits && !shadowValue(dxlID, AX12_MOVING_SPEED_L, speed) && (speed < 0) )
+            limits = false;
+        if (!std::isnan(effCmd))
+            torque = decimalToAxTorque( std::min(std::max(effCmd, 0.0), 1023*0.001) );
+        else if ( limits && !shadowValue(dxlID, AX12_TORQUE_LIMIT_L, torque) && (torque < 0) )
+            limits = false;
+        if ( !limits && (!std::isnan(velCmd) || !std::isnan(effCmd)) )
+            ROS_WARN_THROTTLE(1.0, "Limits of motor %d unknown, only its goal position is written.", dxlID);
+        if (!limits)
+        {
+            ++busPositions[b];
+            if (!changed)
+                continue;
+            positionReq.dxlIDs.push_back(dxlID);
+            positionReq.values.push_back(position);
+            ++busPositionsSent[b];
+            continue;
+        }
+        ++busFull[b];
+        if ( !changed && (speed == speedLimitSent[j]) && (torque == torqueLimitSent[j]) )
+            continue;
+        fullReq.dxlIDs.push_back(dxlID);
+        fullReq.values.push_back(position);
+        fullReq.values.push_back(speed);
+        fullReq.values.push_back(torque);
+        ++busFullSent[b];
+    }
+    if (refreshAll)
+        timeOfLastGoalRefresh = currentTime;
+
+    for (int b = 0; b < buses.size(); ++b)
+    {
+        unsigned int fullBytes = goalWriteBytes(busPositions[b], busFull[b], stagedWriteEnabled);
+        unsigned int sentBytes = goalWriteBytes(busPositionsSent[b], busFullSent[b], stagedWriteEnabled);
+        goalWriteCounters.valuesSent += busPositionsSent[b] + 3*busFullSent[b];
+        goalWriteCounters.valuesSkipped += (busPositions[b] - busPositionsSent[b]) + 3*(busFull[b] - busFullSent[b]);
+        goalWriteCounters.bytesSent += sentBytes;
+        goalWriteCounters.bytesSaved += fullBytes - sentBytes;
+    }
+
+    // Staged, both windows start with one ACTION after the last of them
+    bool positionSuccess = true, fullSuccess = true;
+    if (stagedWriteEnabled)
+    {
+        usb2ax_controller::StageSyncToAX::Request stageReq;
+        usb2ax_controller::StageSyncToAX::Response stageRes;
+        stageReq.startAddress = AX12_GOAL_POSITION_L;
+        if (!positionReq.dxlIDs.empty())
+        {
+            stageReq.dxlIDs = positionReq.dxlIDs;
+            stageReq.values = positionReq.values;
+            stageReq.trigger = fullReq.dxlIDs.empty();
+            positionSuccess = stageSync(stageReq, stageRes);
+        }
+        if (!fullReq.dxlIDs.empty())
+        {
+            stageReq.dxlIDs = fullReq.dxlIDs;
+            stageReq.values = fullReq.values;
+            stageReq.trigger = true;
+            fullSuccess = stageSync(stageReq, stageRes);
+        }
+    }
+    else
+    {
+        usb2ax_controller::SendSyncToAX::Response res;
+        if (!positionReq.dxlIDs.empty())
+            positionSuccess = sendSyncToAX(positionReq, res);
+        if (!fullReq.dxlIDs.empty())
+            fullSuccess = sendSyncToAX(fullReq, res);
+    }
+
+    // A failed write is sent again in the next cycle
+    for (int k = 0; k < positionReq.dxlIDs.size(); ++k)
+        goalSent[jointIndex(positionReq.dxlIDs[k])] = positionSuccess ? positionReq.values[k] : -1;
+    for (int k = 0; k < fullReq.dxlIDs.size(); ++k)
+    {
+        int j = jointIndex(fullReq.dxlIDs[k]);
+        goalSent[j] = fullSuccess ? fullReq.values[3*k] : -1;
+        speedLimitSent[j] = fullSuccess ? fullReq.values[3*k + 1] : -1;
+        torqueLimitSent[j] = fullSuccess ? fullReq.values[3*k + 2] : -1;
+    }
+}
+
+
+void JointController::jointCommandCallback(const sensor_msgs::JointState::ConstPtr& msg)
+{
+    // Example: both elbows to 0.5 rad at 2 rad/s
+    // rostopic pub /ax_joint_commands sensor_msgs/JointState '{name: [right_elbow_joint, left_elbow_joint], position: [0.5, 0.5], velocity: [2.0, 2.0]}'
+    //
+    // Positions in rad, velocities as moving speeds in rad/s, efforts as torque limits from 0 to 1;
+    // an empty array commands nothing, no names means all joints in order. Only the latest command
+    // of each joint is kept until the next write().
+    int numOfJoints = msg->name.empty() ? joints.size() : msg->name.size();
+    if ( (!msg->position.empty() && (msg->position.size() != numOfJoints)) ||
+         (!msg->velocity.empty() && (msg->velocity.size() != numOfJoints)) ||
+         (!msg->effort.empty() && (msg->effort.size() != numOfJoints)) )
+    {
+        ROS_ERROR_THROTTLE(1.0, "Input data size mismatch on ax_joint_commands.");
+        return;
+    }
+    for (int k = 0; k < numOfJoints; ++k)
+    {
+        int j = msg->name.empty() ? k : jointIndexForName(msg->name[k]);
+        if (j < 0)
+        {
+            ROS_WARN_THROTTLE(1.0, "Unknown joint %s on ax_joint_commands.", msg->name[k].c_str());
+            continue;
+        }
+        if (!msg->position.empty())
+            jointCommands[j].position = msg->position[k];
+        if (!msg->velocity.empty())
+            jointCommands[j].speed = msg->velocity[k];
+        if (!msg->effort.empty())
+            jointCommands[j].torque = msg->effort[k];
+    }
+    jointCommandsPending = true;
+}
+
+
+//void JointController::execute(const control_msgs::FollowJointTrajectoryGoalConstPtr &goal, Server* as)
+//{
+//    // Do stuff
+//    ROS_INFO("Executing FollowJointTrajectory!");
+
+//    as->setSucceeded();
+//}
+
+
+bool JointController::receiveFromAX(usb2ax_controller::ReceiveFromAX::Request &req,
+                                    usb2ax_controller::ReceiveFromAX::Response &res)
+{
+    // From the shadow of the control table when it is fresh enough, without the bus
+    int cachedValue;
+    double age;
+    if ( lookupShadow(req.dxlID, req.address, cachedValue, age) )
+    {
+        res.value = cachedValue;
+        res.age = age;
+        res.rxSuccess = true;
+        return true;
+    }
+
+    BusGrant grant(scheduler, BusScheduler::SERVICE, serviceSlot, serviceMaxWait);
+    if (!grant.granted())
+        return refuseService("ReceiveFromAX");
+    completePrefetch();
+    DxlBus* bus = busForMotor(req.dxlID);
+
+    // Motor
+    if ( (1 <= req.dxlID) && (req.dxlID < 100) )
+    {
+        // Read word
         switch (req.address)
         {
         case AX12_MODEL_NUMBER_L:
@@ -575,14 +1893,13 @@ bool JointController::sendToAX(usb2ax_controller::SendToAX::Request &req,
         case AX12_PRESENT_LOAD_L:
         case AX12_PUNCH_L:
         {
-            // 2 bytes
-            dxl_write_word(req.dxlID, req.address, req.value);
+            res.value = dxl_bus_read_word(bus, req.dxlID, req.address);
             break;
         }
+            // Read byte
         default:
         {
-            // 1 byte
-            dxl_write_byte(req.dxlID, req.address, req.value);
+            res.value = dxl_bus_read_byte(bus, req.dxlID, req.address);
             break;
         }
         }
@@ -590,6 +1907,7 @@ bool JointController::sendToAX(usb2ax_controller::SendToAX::Request &req,
     // Sensor
     else if (req.dxlID >= 100)
     {
+        // Read word
         switch (req.address)
         {
         case AXS1_MODEL_NUMBER_L:
@@ -597,256 +1915,1235 @@ bool JointController::sendToAX(usb2ax_controller::SendToAX::Request &req,
         case AXS1_REMOCON_RX_DATA_L:
         case AXS1_REMOCON_TX_DATA_L:
         {
-            // 2 bytes
-            dxl_write_word(req.dxlID, req.address, req.value);
-            break;
+            res.value = dxl_bus_read_word(bus, req.dxlID, req.address);
+            break;
+        }
+            // Read byte
+        default:
+        {
+            res.value = dxl_bus_read_byte(bus, req.dxlID, req.address);
+            break;
+        }
+        }
+    }
+    else
+    {
+        res.rxSuccess = false;
+        return false;
+    }
+
+    int CommStatus = dxl_bus_get_result(bus);
+    if (CommStatus == COMM_RXSUCCESS)
+    {
+        //ROS_DEBUG("Value received: %d", res.value);
+        printErrorCode(bus);
+        storeShadow(req.dxlID, req.address, std::vector<uint16_t>(1, res.value), 0, 1, ros::Time::now());
+        res.age = 0.0;
+        res.rxSuccess = true;
+        return true;
+    }
+    else
+    {
+        printCommStatus(CommStatus);
+        res.rxSuccess = false;
+        return false;
+    }
+}
+
+
+bool JointController::sendToAX(usb2ax_controller::SendToAX::Request &req,
+                               usb2ax_controller::SendToAX::Response &res)
+{
+    BusGrant grant(scheduler, BusScheduler::SERVICE, serviceSlot, serviceMaxWait);
+    if (!grant.granted())
+        return refuseService("SendToAX");
+    completePrefetch();
+
+    // A broadcast is sent on every bus
+    std::vector<DxlBus*> targetBuses;
+    if (req.dxlID == BROADCAST_ID)
+        targetBuses = buses;
+    else
+        targetBuses.push_back(busForMotor(req.dxlID));
+
+    bool isWord = false;
+
+    // Motor
+    if ( ((1 <= req.dxlID) && (req.dxlID < 100)) || (req.dxlID == BROADCAST_ID) )
+    {
+        switch (req.address)
+        {
+        case AX12_MODEL_NUMBER_L:
+        case AX12_CW_ANGLE_LIMIT_L:
+        case AX12_CCW_ANGLE_LIMIT_L:
+        case AX12_MAX_TORQUE_L:
+        case AX12_GOAL_POSITION_L:
+        case AX12_MOVING_SPEED_L:
+        case AX12_TORQUE_LIMIT_L:
+        case AX12_PRESENT_POSITION_L:
+        case AX12_PRESENT_SPEED_L:
+        case AX12_PRESENT_LOAD_L:
+        case AX12_PUNCH_L:
+        {
+            // 2 bytes
+            isWord = true;
+            break;
+        }
+        default:
+        {
+            // 1 byte
+            isWord = false;
+            break;
+        }
+        }
+    }
+    // Sensor
+    else if (req.dxlID >= 100)
+    {
+        switch (req.address)
+        {
+        case AXS1_MODEL_NUMBER_L:
+        case AXS1_SOUND_DETECTED_TIME_L:
+        case AXS1_REMOCON_RX_DATA_L:
+        case AXS1_REMOCON_TX_DATA_L:
+        {
+            // 2 bytes
+            isWord = true;
+            break;
+        }
+        default:
+        {
+            // 1 byte
+            isWord = false;
+            break;
+        }
+        }
+    }
+    else
+    {
+        res.txSuccess = false;
+        return false;
+    }
+
+    // Whether the motor answers writes, before this write changes it
+    bool acknowledged = (req.dxlID != BROADCAST_ID) &&
+        (dxl_bus_get_status_return_level(targetBuses[0], req.dxlID) >= DXL_STATUS_RETURN_ALL);
+
+    for (std::vector<DxlBus*>::iterator it = targetBuses.begin(); it != targetBuses.end(); ++it)
+    {
+        if (isWord)
+            dxl_bus_write_word(*it, req.dxlID, req.address, req.value);
+        else
+            dxl_bus_write_byte(*it, req.dxlID, req.address, req.value);
+    }
+
+    // The shadow follows the write, unless it failed. A motor whose ID changes is forgotten.
+    const ros::Time stamp = ros::Time::now();
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        int dxlID = joints[j].dxlID;
+        if ( (dxlID != req.dxlID) && ((req.dxlID != BROADCAST_ID) || !connectedMotors[j]) )
+            continue;
+        if (req.address == AX12_ID)
+            invalidateShadow(dxlID, 0, -1);
+        else if ( (req.dxlID == BROADCAST_ID) || (dxl_bus_get_result(targetBuses[0]) == COMM_RXSUCCESS) )
+            storeShadow(dxlID, req.address, std::vector<uint16_t>(1, req.value), 0, 1, stamp);
+        else
+            invalidateShadow(dxlID, req.address, 1);
+    }
+
+    // No return Status Packet from a broadcast command
+    if (req.dxlID == BROADCAST_ID)
+    {
+        res.txSuccess = true;
+        return true;
+    }
+    else
+    {
+        int CommStatus = dxl_bus_get_result(targetBuses[0]);
+        if ( (CommStatus == COMM_RXSUCCESS) && !acknowledged )
+        {
+            // No status packet at status return level 0 or 1: check a sample of the writes
+            res.txSuccess = verifyWrite(targetBuses[0], req.dxlID, req.address, isWord, req.value);
+            return res.txSuccess;
+        }
+        else if (CommStatus == COMM_RXSUCCESS)
+        {
+            //ROS_DEBUG("Value sent: %d", val);
+            printErrorCode(targetBuses[0]);
+            res.txSuccess = true;
+            return true;
+        }
+        else
+        {
+            printCommStatus(CommStatus);
+            res.txSuccess = false;
+            return false;
+        }
+    }
+}
+
+
+bool JointController::verifyWrite(DxlBus* bus, int dxlID, int address, bool isWord, int value)
+{
+    if ( (writeVerifyPeriod <= 0) || (++writeVerifyCounter < writeVerifyPeriod) )
+        return true;
+    writeVerifyCounter = 0;
+
+    int readValue = isWord ? dxl_bus_read_word(bus, dxlID, address) : dxl_bus_read_byte(bus, dxlID, address);
+    int CommStatus = dxl_bus_get_result(bus);
+    if (CommStatus != COMM_RXSUCCESS)
+    {
+        ROS_WARN("Could not read back the write of %d to address %d of ID %d.", value, address, dxlID);
+        printCommStatus(CommStatus);
+        return false;
+    }
+    if (readValue != value)
+    {
+        ROS_WARN("Write of %d to address %d of ID %d reads back as %d.", value, address, dxlID, readValue);
+        return false;
+    }
+    return true;
+}
+
+
+bool JointController::receiveSyncFromAX(usb2ax_controller::ReceiveSyncFromAX::Request &req,
+                                        usb2ax_controller::ReceiveSyncFromAX::Response &res)
+{
+    // Example: IDs 1, 3, 5 - Get current position, current speed, current torque
+    // startAddress:         AX12_PRESENT_POSITION_L (36)
+    // numOfValuesPerMotor:  3
+    // dxlIDs:               |        1      |        3      |        5      |
+    // Returned values:      |  P1,  S1,  T1 |  P2,  S2,  T2 |  P3,  S3,  T3 |
+    //
+    // rosservice command line example:
+    // rosservice call /ReceiveSyncFromAX '[1, 3, 5]' 36 3
+    //
+    // Any number of motors and any window of the control table can be requested, e.g. goal
+    // position through present load (30 to 41, 7 values): the request is split into several
+    // sync_read packets that fit the USB2AX limits, and the results are merged in order.
+
+    BusGrant grant(scheduler, BusScheduler::SERVICE, serviceSlot, serviceMaxWait);
+    if (!grant.granted())
+        return refuseService("ReceiveSyncFromAX");
+    completePrefetch();
+
+    SyncReadTransaction t;
+    if ( !prepareSyncRead(req, t) )
+    {
+        res.rxSuccess = false;
+        return false;
+    }
+
+    sendSyncRead(t);
+    receiveSyncRead(t);
+    res.rxSuccess = mergeSyncRead(t, res.values);
+    return res.rxSuccess;
+}
+
+
+bool JointController::lookupDataLength(int startAddress, int numOfValues, std::vector<bool>& isWord, int& dataLength)
+{
+    // Walk the control table from startAddress, one value (byte or word) at a time
+    dataLength = 0;
+    isWord.assign(numOfValues, false);
+    std::map<int, bool>::const_iterator it;
+    for (int j = 0; j < numOfValues; ++j)
+    {
+        it = Ax12ControlTable::addressWordMap.find(startAddress + dataLength);
+        if (it == Ax12ControlTable::addressWordMap.end())
+        {
+            ROS_ERROR("Address lookup error.");
+            return false;
+        }
+        if (it->second == true)
+        {
+            dataLength = dataLength + 2;
+            isWord[j] = true;
+        }
+        else
+        {
+            ++dataLength;
+            isWord[j] = false;
+        }
+    }
+    return true;
+}
+
+
+bool JointController::prepareSyncRead(const usb2ax_controller::ReceiveSyncFromAX::Request &req,
+                                      SyncReadTransaction& t)
+{
+    int numOfMotors = req.dxlIDs.size();
+
+    if (numOfMotors <= 0)
+    {
+        ROS_ERROR("No motors specified.");
+        return false;
+    }
+
+    t.numOfMotors = numOfMotors;
+    t.numOfValuesPerMotor = 0;
+    t.windowAddresses.clear();
+    t.windowFirstValues.clear();
+    t.dxlIDs.assign(req.dxlIDs.begin(), req.dxlIDs.end());
+    t.usedBuses.clear();
+    t.busChunks.assign(buses.size(), std::vector<SyncReadChunk>());
+    return addSyncReadWindow(t, req.startAddress, req.numOfValuesPerMotor);
+}
+
+
+bool JointController::addSyncReadWindow(SyncReadTransaction& t, int startAddress, int numOfValues)
+{
+    // Length of data for each motor
+    int dataLength = 0;
+    std::vector<bool> isWord;
+    if ( !lookupDataLength(startAddress, numOfValues, isWord, dataLength) )
+        return false;
+
+    // Slice the address window into pieces the USB2AX accepts, without splitting a word
+    std::vector<int> sliceFirstValue;
+    std::vector<int> sliceNumOfValues;
+    std::vector<int> sliceAddress;
+    std::vector<int> sliceLength;
+    int address = startAddress;
+    for (int j = 0; j < numOfValues; ++j)
+    {
+        int size = isWord[j] ? 2 : 1;
+        if ( sliceLength.empty() || (sliceLength.back() + size > USB2AX_SYNC_READ_MAX_DATA_LENGTH) )
+        {
+            sliceFirstValue.push_back(j);
+            sliceNumOfValues.push_back(0);
+            sliceAddress.push_back(address);
+            sliceLength.push_back(0);
+        }
+        ++sliceNumOfValues.back();
+        sliceLength.back() += size;
+        address += size;
+    }
+
+    // The values of this window follow those of the previous ones
+    int firstValue = t.numOfValuesPerMotor;
+    t.windowAddresses.push_back(startAddress);
+    t.windowFirstValues.push_back(firstValue);
+    t.numOfValuesPerMotor += numOfValues;
+
+    // Split the motors by bus
+    std::vector<std::vector<int> > busMotorIDs(buses.size());
+    std::vector<std::vector<int> > busMotorIndices(buses.size());
+    for (int i = 0; i < t.numOfMotors; ++i)
+    {
+        int busIndex = (t.dxlIDs[i] < BROADCAST_ID) ? motorBusIndex[t.dxlIDs[i]] : 0;
+        busMotorIDs[busIndex].push_back(t.dxlIDs[i]);
+        busMotorIndices[busIndex].push_back(i);
+    }
+
+    // Then into chunks: each slice of the window, for groups of motors small enough for
+    // the USB2AX and for the status packet
+    for (int b = 0; b < buses.size(); ++b)
+    {
+        int numOnBus = busMotorIDs[b].size();
+        if (numOnBus == 0)
+            continue;
+        if (t.busChunks[b].empty())
+            t.usedBuses.push_back(b);
+
+        for (int s = 0; s < sliceAddress.size(); ++s)
+        {
+            int maxMotors = std::min(USB2AX_SYNC_READ_MAX_MOTORS, MAXNUM_RXPARAM/sliceLength[s]);
+            // Balance the groups rather than leaving a small remainder
+            int numOfGroups = (numOnBus + maxMotors - 1)/maxMotors;
+            int groupSize = (numOnBus + numOfGroups - 1)/numOfGroups;
+            for (int first = 0; first < numOnBus; first += groupSize)
+            {
+                SyncReadChunk chunk;
+                chunk.startAddress = sliceAddress[s];
+                chunk.dataLength = sliceLength[s];
+                chunk.firstValue = firstValue + sliceFirstValue[s];
+                chunk.isWord.assign(isWord.begin() + sliceFirstValue[s],
+                                    isWord.begin() + sliceFirstValue[s] + sliceNumOfValues[s]);
+                int last = std::min(first + groupSize, numOnBus);
+                chunk.motorIDs.assign(busMotorIDs[b].begin() + first, busMotorIDs[b].begin() + last);
+                chunk.motorIndices.assign(busMotorIndices[b].begin() + first, busMotorIndices[b].begin() + last);
+                chunk.success = false;
+                t.busChunks[b].push_back(chunk);
+            }
+        }
+    }
+    return true;
+}
+
+
+void JointController::syncReadChunkSend(DxlBus* bus, const SyncReadChunk& chunk)
+{
+    dxl_bus_sync_read_start(bus, chunk.startAddress, chunk.dataLength);
+    for (int i = 0; i < chunk.motorIDs.size(); ++i)
+        dxl_bus_sync_read_push_id(bus, chunk.motorIDs[i]);
+    dxl_bus_sync_read_noblock_send(bus);
+}
+
+
+void JointController::sendSyncRead(SyncReadTransaction& t)
+{
+    // Transmit the first chunk on every bus; this only writes to the ports and does not wait
+    t.stamp = ros::Time::now();
+    for (int k = 0; k < t.usedBuses.size(); ++k)
+    {
+        int b = t.usedBuses[k];
+        syncReadChunkSend(buses[b], t.busChunks[b][0]);
+    }
+}
+
+
+void JointController::receiveSyncRead(SyncReadTransaction& t)
+{
+    // Collect the replies, one thread per bus. Each further chunk is sent as soon as the
+    // previous reply is in, and decoding is left to mergeSyncRead.
+    runOnBuses(t.usedBuses, [&](int b)
+    {
+        std::vector<SyncReadChunk>& chunks = t.busChunks[b];
+        for (int c = 0; c < chunks.size(); ++c)
+        {
+            if (c > 0)
+                syncReadChunkSend(buses[b], chunks[c]);
+            chunks[c].success = syncReadFromBusReceive(buses[b], chunks[c].isWord,
+                                                       chunks[c].motorIDs, chunks[c].values);
+            int CommStatus = dxl_bus_get_result(buses[b]);
+            chunks[c].motorStatus.assign(chunks[c].motorIDs.size(), chunks[c].success ? COMM_RXSUCCESS : CommStatus);
+            chunks[c].motorErrors.assign(chunks[c].motorIDs.size(), 0);
+            if ( (CommStatus == COMM_RXTIMEOUT) || (CommStatus == COMM_RXCORRUPT) )
+                isolateSyncReadFailure(buses[b], chunks[c]);
+        }
+    });
+}
+
+
+bool JointController::mergeSyncRead(const SyncReadTransaction& t, std::vector<uint16_t>& values,
+                                    std::vector<bool>* motorValid)
+{
+    // Merge the chunk results back into request order. Fails if any motor is missing;
+    // motorValid then tells which ones are there.
+    values.assign(t.numOfMotors*t.numOfValuesPerMotor, 0);
+    std::vector<bool> valid(t.numOfMotors, true);
+
+    bool success = true;
+    for (int k = 0; k < t.usedBuses.size(); ++k)
+    {
+        const std::vector<SyncReadChunk>& chunks = t.busChunks[t.usedBuses[k]];
+        for (int c = 0; c < chunks.size(); ++c)
+        {
+            const SyncReadChunk& chunk = chunks[c];
+            int numOfValues = chunk.isWord.size();
+            for (int m = 0; m < chunk.motorIndices.size(); ++m)
+            {
+                if (chunk.motorStatus[m] != COMM_RXSUCCESS)
+                {
+                    success = false;
+                    valid[chunk.motorIndices[m]] = false;
+                    continue;
+                }
+                for (int j = 0; j < numOfValues; ++j)
+                    values[chunk.motorIndices[m]*t.numOfValuesPerMotor + chunk.firstValue + j] =
+                            chunk.values[m*numOfValues + j];
+            }
+        }
+    }
+
+    // Every motor read in full refreshes its shadow of the control table, window by window
+    for (int i = 0; i < t.numOfMotors; ++i)
+    {
+        if (!valid[i])
+            continue;
+        for (int w = 0; w < t.windowAddresses.size(); ++w)
+        {
+            int end = (w + 1 < t.windowFirstValues.size()) ? t.windowFirstValues[w + 1] : t.numOfValuesPerMotor;
+            storeShadow(t.dxlIDs[i], t.windowAddresses[w], values, i*t.numOfValuesPerMotor + t.windowFirstValues[w],
+                        end - t.windowFirstValues[w], t.stamp);
+        }
+    }
+    if (motorValid != NULL)
+        *motorValid = valid;
+    return success;
+}
+
+
+void JointController::isolateSyncReadFailure(DxlBus* bus, SyncReadChunk& chunk)
+{
+    // Read the motors of a failed sync_read one by one: a motor that does not answer then
+    // only costs its own timeout, and the others still get their values
+    int numOfValues = chunk.isWord.size();
+    chunk.values.resize(chunk.motorIDs.size()*numOfValues);
+    for (int m = 0; m < chunk.motorIDs.size(); ++m)
+    {
+        dxl_bus_set_txpacket_id(bus, chunk.motorIDs[m]);
+        dxl_bus_set_txpacket_instruction(bus, INST_READ);
+        dxl_bus_set_txpacket_parameter(bus, 0, chunk.startAddress);
+        dxl_bus_set_txpacket_parameter(bus, 1, chunk.dataLength);
+        dxl_bus_set_txpacket_length(bus, 4);
+        dxl_bus_txrx_packet(bus);
+        chunk.motorStatus[m] = dxl_bus_get_result(bus);
+        if (chunk.motorStatus[m] != COMM_RXSUCCESS)
+            continue;
+
+        for (int bit = ERRBIT_VOLTAGE; bit <= ERRBIT_INSTRUCTION; bit <<= 1)
+        {
+            if (dxl_bus_get_rxpacket_error(bus, bit))
+                chunk.motorErrors[m] |= bit;
+        }
+        int p = 0;
+        for (int j = 0; j < numOfValues; ++j)
+        {
+            if (chunk.isWord[j])
+            {
+                chunk.values[m*numOfValues + j] = dxl_makeword(dxl_bus_get_rxpacket_parameter(bus, p),
+                                                               dxl_bus_get_rxpacket_parameter(bus, p + 1));
+                p += 2;
+            }
+            else
+                chunk.values[m*numOfValues + j] = dxl_bus_get_rxpacket_parameter(bus, p++);
+        }
+    }
+}
+
+
+bool JointController::syncReadFromBusReceive(DxlBus* bus, const std::vector<bool>& isWord,
+                                             const std::vector<int>& dxlIDs, std::vector<int>& values)
+{
+    int numOfMotors = dxlIDs.size();
+    int numOfValuesPerMotor = isWord.size();
+    values.resize(numOfMotors*numOfValuesPerMotor);
+
+    // Wait for the status packet of the sync_read sent earlier
+    dxl_bus_sync_read_noblock_receive(bus);
+
+    int CommStatus = dxl_bus_get_result(bus);
+    if (CommStatus == COMM_RXSUCCESS)
+    {
+        int r;
+        for (int i = 0; i < numOfMotors; ++i)
+        {
+            for (int j = 0; j < numOfValuesPerMotor; ++j)
+            {
+                if (isWord[j])
+                    r = dxl_bus_sync_read_pop_word(bus);
+                else
+                    r = dxl_bus_sync_read_pop_byte(bus);
+
+//                ROS_DEBUG( "i = %d", i );
+//                ROS_DEBUG( "j = %d", j );
+//                ROS_DEBUG( "index = %d", i*numOfValuesPerMotor + j );
+//                ROS_DEBUG( "ID %d = %d", dxlIDs[i], r );
+                values[i*numOfValuesPerMotor + j] = r;
+            }
+        }
+        printErrorCode(bus);
+        return true;
+    }
+    else
+    {
+        printCommStatus(CommStatus);
+        return false;
+    }
+}
+
+
+bool JointController::sendSyncToAX(usb2ax_controller::SendSyncToAX::Request &req,
+                                   usb2ax_controller::SendSyncToAX::Response &res)
+{
+    // Example: IDs 1, 3, 5 - Set goal position 100, goal speed 300, max torque 512
+    // startAddress:  AX12_GOAL_POSITION_L (30)
+    // dxlIDs:        |        1      |        3      |        5      |
+    // values:        | 100, 300, 512 | 100, 300, 512 | 100, 300, 512 |
+    //
+    // rosservice command line example:
+    // rosservice call /SendSyncToAX '[1, 3, 5]' 30 '[100, 300, 512, 100, 300, 512, 100, 300, 512]'
+
+    BusGrant grant(scheduler, BusScheduler::SERVICE, serviceSlot, serviceMaxWait);
+    if (!grant.granted())
+        return refuseService("SendSyncToAX");
+    completePrefetch();
+
+    int numOfMotors = req.dxlIDs.size();
+
+    if (numOfMotors <= 0)
+    {
+        ROS_ERROR("No motors specified.");
+        res.txSuccess = false;
+        return false;
+    }
+
+    int numOfValuesPerMotor = req.values.size()/numOfMotors;
+
+    // Length of data for each motor
+    int dataLength = 0;
+    std::vector<bool> isWord;
+    if ( !lookupDataLength(req.startAddress, numOfValuesPerMotor, isWord, dataLength) )
+    {
+        res.txSuccess = false;
+        return false;
+    }
+
+    // Split the motors by bus, then run the sync_writes of each bus in parallel
+    std::vector<std::vector<int> > busMotorIDs(buses.size());
+    std::vector<std::vector<int> > busValues(buses.size());
+    for (int i = 0; i < numOfMotors; ++i)
+    {
+        int busIndex = (req.dxlIDs[i] < BROADCAST_ID) ? motorBusIndex[req.dxlIDs[i]] : 0;
+        busMotorIDs[busIndex].push_back(req.dxlIDs[i]);
+        for (int j = 0; j < numOfValuesPerMotor; ++j)
+            busValues[busIndex].push_back(req.values[i*numOfValuesPerMotor + j]);
+    }
+    std::vector<int> usedBuses;
+    for (int b = 0; b < buses.size(); ++b)
+    {
+        if (!busMotorIDs[b].empty())
+            usedBuses.push_back(b);
+    }
+
+    // A sync_write packet holds the address, the data length, then the ID and data of each motor
+    int maxMotors = (MAXNUM_TXPARAM - 2)/(dataLength + 1);
+    if (maxMotors <= 0)
+    {
+        ROS_ERROR("Too many values per motor.");
+        res.txSuccess = false;
+        return false;
+    }
+
+    std::vector<char> busSuccess(buses.size(), false);
+    runOnBuses(usedBuses, [&](int b)
+    {
+        bool success = true;
+        int numOnBus = busMotorIDs[b].size();
+        for (int first = 0; first < numOnBus; first += maxMotors)
+        {
+            int last = std::min(first + maxMotors, numOnBus);
+            std::vector<int> dxlIDs(busMotorIDs[b].begin() + first, busMotorIDs[b].begin() + last);
+            std::vector<int> values(busValues[b].begin() + first*numOfValuesPerMotor,
+                                    busValues[b].begin() + last*numOfValuesPerMotor);
+            if ( !syncWriteToBus(buses[b], req.startAddress, dataLength, isWord, dxlIDs, values) )
+                success = false;
+        }
+        busSuccess[b] = success;
+    });
+
+    bool success = true;
+    for (int k = 0; k < usedBuses.size(); ++k)
+    {
+        if (!busSuccess[usedBuses[k]])
+            success = false;
+    }
+
+    const ros::Time stamp = ros::Time::now();
+    for (int i = 0; i < numOfMotors; ++i)
+    {
+        int dxlID = req.dxlIDs[i];
+        if ( (dxlID < BROADCAST_ID) && busSuccess[motorBusIndex[dxlID]] )
+            storeShadow(dxlID, req.startAddress, req.values, i*numOfValuesPerMotor, numOfValuesPerMotor, stamp);
+        else
+            invalidateShadow(dxlID, req.startAddress, numOfValuesPerMotor);
+    }
+
+    res.txSuccess = success;
+    return success;
+}
+
+
+bool JointController::syncWriteToBus(DxlBus* bus, int startAddress, int dataLength, const std::vector<bool>& isWord,
+                                     const std::vector<int>& dxlIDs, const std::vector<int>& values)
+{
+    int numOfMotors = dxlIDs.size();
+    int numOfValuesPerMotor = isWord.size();
+
+    // Make sync_write packet
+//    ROS_DEBUG( "Packet" );
+//    ROS_DEBUG( "ID:\t\t\t %d", BROADCAST_ID );
+//    ROS_DEBUG( "Instr:\t\t\t %d", INST_SYNC_WRITE );
+//    ROS_DEBUG( "Param 0 (start addr):\t %d", startAddress );
+//    ROS_DEBUG( "Param 1 (data length):\t %d", dataLength );
+    dxl_bus_set_txpacket_id(bus, BROADCAST_ID);
+    dxl_bus_set_txpacket_instruction(bus, INST_SYNC_WRITE);
+    dxl_bus_set_txpacket_parameter(bus, 0, startAddress);
+    dxl_bus_set_txpacket_parameter(bus, 1, dataLength);
+
+    int paramIndex = 2;
+    for (int i = 0; i < numOfMotors; ++i)
+    {
+        dxl_bus_set_txpacket_parameter( bus, paramIndex++, dxlIDs[i] );
+        for (int j = 0; j < numOfValuesPerMotor; ++j)
+        {
+            if (isWord[j])
+            {
+                // 2 bytes
+                dxl_bus_set_txpacket_parameter( bus, paramIndex++,
+                                                dxl_get_lowbyte(values[i*numOfValuesPerMotor + j]) );
+                dxl_bus_set_txpacket_parameter( bus, paramIndex++,
+                                                dxl_get_highbyte(values[i*numOfValuesPerMotor + j]) );
+            }
+            else
+            {
+                // 1 byte
+                dxl_bus_set_txpacket_parameter( bus, paramIndex++, values[i*numOfValuesPerMotor + j] );
+            }
+        }
+    }
+
+//    ROS_DEBUG( "Length:\t\t\t %d", (dataLength + 1)*numOfMotors + 4 );
+    dxl_bus_set_txpacket_length( bus, (dataLength + 1)*numOfMotors + 4 );
+
+    dxl_bus_txrx_packet(bus);
+
+    int CommStatus = dxl_bus_get_result(bus);
+    if (CommStatus == COMM_RXSUCCESS)
+    {
+        printErrorCode(bus);
+        return true;
+    }
+    else
+    {
+        printCommStatus(CommStatus);
+        return false;
+    }
+}
+
+
+bool JointController::stageSyncToAX(usb2ax_controller::StageSyncToAX::Request &req,
+                                    usb2ax_controller::StageSyncToAX::Response &res)
+{
+    // With ~staged_write, write() stages the goals of every joint and fires an ACTION in each
+    // cycle, which would overwrite or start early a pose staged here for TriggerStagedAX
+    if (stagedWriteEnabled && !req.trigger)
+    {
+        ROS_ERROR("StageSyncToAX without trigger refused: ~staged_write triggers the staged goals every cycle.");
+        res.txSuccess = false;
+        return false;
+    }
+    return stageSync(req, res);
+}
+
+
+bool JointController::stageSync(usb2ax_controller::StageSyncToAX::Request &req,
+                                usb2ax_controller::StageSyncToAX::Response &res)
+{
+    // Same layout as SendSyncToAX, but each motor holds its values in its registered buffer
+    // until an ACTION: set trigger to start all the motors at once right after staging, or
+    // leave it unset and call TriggerStagedAX later (e.g. stage the next pose during a move).
+    // Example: IDs 1, 3, 5 - Stage goal position 100, goal speed 300, max torque 512
+    // startAddress:  AX12_GOAL_POSITION_L (30)
+    // dxlIDs:        |        1      |        3      |        5      |
+    // values:        | 100, 300, 512 | 100, 300, 512 | 100, 300, 512 |
+    //
+    // rosservice command line example:
+    // rosservice call /StageSyncToAX '[1, 3, 5]' 30 '[100, 300, 512, 100, 300, 512, 100, 300, 512]' false
+    // rosservice call /TriggerStagedAX
+
+    BusGrant grant(scheduler, BusScheduler::SERVICE, serviceSlot, serviceMaxWait);
+    if (!grant.granted())
+        return refuseService("StageSyncToAX");
+    completePrefetch();
+
+    int numOfMotors = req.dxlIDs.size();
+
+    if (numOfMotors <= 0)
+    {
+        ROS_ERROR("No motors specified.");
+        res.txSuccess = false;
+        return false;
+    }
+
+    int numOfValuesPerMotor = req.values.size()/numOfMotors;
+
+    // Length of data for each motor
+    int dataLength = 0;
+    std::vector<bool> isWord;
+    if ( !lookupDataLength(req.startAddress, numOfValuesPerMotor, isWord, dataLength) )
+    {
+        res.txSuccess = false;
+        return false;
+    }
+
+    // Split the motors by bus. A broadcast is staged on every bus.
+    std::vector<std::vector<int> > busMotorIDs(buses.size());
+    std::vector<std::vector<int> > busValues(buses.size());
+    for (int i = 0; i < numOfMotors; ++i)
+    {
+        if (req.dxlIDs[i] > BROADCAST_ID)
+        {
+            ROS_ERROR("Invalid motor ID %d.", req.dxlIDs[i]);
+            res.txSuccess = false;
+            return false;
         }
-        default:
+        for (int b = 0; b < buses.size(); ++b)
         {
-            // 1 byte
-            dxl_write_byte(req.dxlID, req.address, req.value);
-            break;
-        }
+            if ( (req.dxlIDs[i] != BROADCAST_ID) && (motorBusIndex[req.dxlIDs[i]] != b) )
+                continue;
+            busMotorIDs[b].push_back(req.dxlIDs[i]);
+            for (int j = 0; j < numOfValuesPerMotor; ++j)
+                busValues[b].push_back(req.values[i*numOfValuesPerMotor + j]);
         }
     }
-    else
+    std::vector<int> usedBuses;
+    for (int b = 0; b < buses.size(); ++b)
     {
-        res.txSuccess = false;
-        return false;
+        if (!busMotorIDs[b].empty())
+            usedBuses.push_back(b);
     }
 
-    // No return Status Packet from a broadcast command
-    if (req.dxlID == BROADCAST_ID)
+    // One REG_WRITE per motor, the buses in parallel
+    std::vector<char> busSuccess(buses.size(), false);
+    runOnBuses(usedBuses, [&](int b)
     {
-        res.txSuccess = true;
-        return true;
+        busSuccess[b] = stageToBus(buses[b], req.startAddress, isWord, busMotorIDs[b], busValues[b]);
+    });
+
+    bool success = true;
+    for (int k = 0; k < usedBuses.size(); ++k)
+    {
+        if (!busSuccess[usedBuses[k]])
+            success = false;
     }
-    else
+
+    // Motors that were staged still start on the trigger, even if others failed
+    if (req.trigger)
+        actionOnAllBuses();
+
+    // Staged values only count once triggered; until then the shadow forgets the old ones
+    const ros::Time stamp = ros::Time::now();
+    for (int i = 0; i < numOfMotors; ++i)
     {
-        int CommStatus = dxl_get_result();
-        if (CommStatus == COMM_RXSUCCESS)
-        {
-            //ROS_DEBUG("Value sent: %d", val);
-            printErrorCode();
-            res.txSuccess = true;
-            return true;
-        }
-        else
+        for (int j = 0; j < joints.size(); ++j)
         {
-            printCommStatus(CommStatus);
-            res.txSuccess = false;
-            return false;
+            int dxlID = joints[j].dxlID;
+            if ( (dxlID != req.dxlIDs[i]) && ((req.dxlIDs[i] != BROADCAST_ID) || !connectedMotors[j]) )
+                continue;
+            if (req.trigger && busSuccess[motorBusIndex[dxlID]])
+                storeShadow(dxlID, req.startAddress, req.values, i*numOfValuesPerMotor, numOfValuesPerMotor, stamp);
+            else
+                invalidateShadow(dxlID, req.startAddress, numOfValuesPerMotor);
         }
     }
+
+    res.txSuccess = success;
+    return success;
 }
 
 
-bool JointController::receiveSyncFromAX(usb2ax_controller::ReceiveSyncFromAX::Request &req,
-                                        usb2ax_controller::ReceiveSyncFromAX::Response &res)
+bool JointController::triggerStagedAX(std_srvs::Empty::Request &req, std_srvs::Empty::Response &res)
 {
-    // Example: IDs 1, 3, 5 - Get current position, current speed, current torque
-    // startAddress:         AX12_PRESENT_POSITION_L (36)
-    // numOfValuesPerMotor:  3
-    // dxlIDs:               |        1      |        3      |        5      |
-    // Returned values:      |  P1,  S1,  T1 |  P2,  S2,  T2 |  P3,  S3,  T3 |
-    //
-    // rosservice command line example:
-    // rosservice call /ReceiveSyncFromAX '[1, 3, 5]' 36 3
+    BusGrant grant(scheduler, BusScheduler::SERVICE, serviceSlot, serviceMaxWait);
+    if (!grant.granted())
+        return refuseService("TriggerStagedAX");
+    completePrefetch();
+    actionOnAllBuses();
+    return true;
+}
 
-    int numOfMotors = req.dxlIDs.size();
 
-    if (numOfMotors <= 0)
-    {
-        ROS_ERROR("No motors specified.");
-        res.rxSuccess = false;
-        return false;
-    }
-    else if (numOfMotors > 32)
+bool JointController::calibrateBusTiming(std_srvs::Empty::Request &req, std_srvs::Empty::Response &res)
+{
+    // Measure the round trips of each bus and fit its receive timeouts, the buses in parallel.
+    // Thousands of transactions that hold the buses for seconds: only before the control loop
+    // starts (~calibrate_timing), never in its cycles.
+    if (controlLoopRunning)
     {
-        ROS_ERROR("Maximum number of motors must be 32.");
-        res.rxSuccess = false;
+        ROS_ERROR("CalibrateBusTiming refused: the control loop is running. Calibrate at startup with ~calibrate_timing.");
         return false;
     }
+    BusGrant grant(scheduler, BusScheduler::CONTROL);
+    completePrefetch();
 
-    res.values.resize(req.numOfValuesPerMotor*numOfMotors);
+    std::vector<int> allBuses;
+    for (int b = 0; b < buses.size(); ++b)
+        allBuses.push_back(b);
+    std::vector<std::vector<DxlTiming> > timings(buses.size());
+    std::vector<char> busSuccess(buses.size(), false);
+    runOnBuses(allBuses, [&](int b)
+    {
+        busSuccess[b] = calibrateBus(b, timings[b]);
+    });
 
-    // Length of data for each motor
-    int dataLength = 0;
-    std::map<int, bool>::const_iterator it;
-    std::vector<bool> isWord(req.numOfValuesPerMotor, false);
-    for (int j = 0; j < req.numOfValuesPerMotor; ++j)
+    // Store the result, so that it can be saved and given back as ~bus_timing
+    const char* classNames[DXL_NUM_TIMING] = {"status", "read", "sync_read"};
+    XmlRpc::XmlRpcValue busTimingList;
+    busTimingList.setSize(buses.size());
+    for (int b = 0; b < buses.size(); ++b)
     {
-        it = Ax12ControlTable::addressWordMap.find(req.startAddress + dataLength);
-        if (it == Ax12ControlTable::addressWordMap.end())
+        if (!busSuccess[b])
         {
-            ROS_ERROR("Address lookup error.");
-            res.rxSuccess = false;
-            return false;
+            ROS_WARN("Timing calibration of USB2AX %d failed, keeping the default timeouts.", busDeviceIndices[b]);
+            busTimingList[b] = XmlRpc::XmlRpcValue(false);
+            continue;
         }
-        if (it->second == true)
+        for (int c = 0; c < DXL_NUM_TIMING; ++c)
         {
-            dataLength = dataLength + 2;
-            isWord[j] = true;
+            const DxlTiming& timing = timings[b][c];
+            dxl_bus_set_timing(buses[b], c, timing.baseMs, timing.perByteMs, timing.perMotorMs);
+            setBusTiming(b, c, timing);
+            busTimingList[b][classNames[c]][0] = timing.baseMs;
+            busTimingList[b][classNames[c]][1] = timing.perByteMs;
+            busTimingList[b][classNames[c]][2] = timing.perMotorMs;
         }
-        else
+        ROS_INFO("USB2AX %d timeouts: status %.2f ms, read %.2f ms + %.3f ms/byte, "
+                 "sync_read %.2f ms + %.3f ms/byte + %.3f ms/motor.", busDeviceIndices[b],
+                 timings[b][DXL_TIMING_STATUS].baseMs + 6*timings[b][DXL_TIMING_STATUS].perByteMs,
+                 timings[b][DXL_TIMING_READ].baseMs, timings[b][DXL_TIMING_READ].perByteMs,
+                 timings[b][DXL_TIMING_SYNC_READ].baseMs, timings[b][DXL_TIMING_SYNC_READ].perByteMs,
+                 timings[b][DXL_TIMING_SYNC_READ].perMotorMs);
+    }
+    ros::NodeHandle("~").setParam("bus_timing", busTimingList);
+    return true;
+}
+
+
+// 99th percentile, or the largest value of a small sample
+static float percentile99(std::vector<float> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[std::min((int)values.size() - 1, (int)(values.size()*0.99))];
+}
+
+
+bool JointController::calibrateBus(int busIndex, std::vector<DxlTiming>& timing)
+{
+    DxlBus* bus = buses[busIndex];
+    std::vector<int> dxlIDs;
+    for (int j = 0; j < joints.size(); ++j)
+    {
+        if (connectedMotors[j] && (motorBusIndex[joints[j].dxlID] == busIndex))
+            dxlIDs.push_back(joints[j].dxlID);
+    }
+    if (dxlIDs.empty())
+        return false;
+
+    // Measure with the generous default timeouts
+    dxl_bus_clear_timing(bus);
+
+    // PING (6 byte reply), READ of 2 and 8 bytes (8 and 14 byte replies), in ms
+    std::vector<float> pingTimes, read2Times, read8Times;
+    for (int k = 0; k < timingCalibrationSamples; ++k)
+    {
+        for (int i = 0; i < dxlIDs.size(); ++i)
         {
-            ++dataLength;
-            isWord[j] = false;
+            long long t0 = dxl_stats_now_us();
+            dxl_bus_ping(bus, dxlIDs[i]);
+            long long t1 = dxl_stats_now_us();
+            if (dxl_bus_get_result(bus) == COMM_RXSUCCESS)
+                pingTimes.push_back((t1 - t0)*0.001f);
+
+            dxl_bus_read_word(bus, dxlIDs[i], AX12_PRESENT_POSITION_L);
+            long long t2 = dxl_stats_now_us();
+            if (dxl_bus_get_result(bus) == COMM_RXSUCCESS)
+                read2Times.push_back((t2 - t1)*0.001f);
+
+            dxl_bus_set_txpacket_id(bus, dxlIDs[i]);
+            dxl_bus_set_txpacket_instruction(bus, INST_READ);
+            dxl_bus_set_txpacket_parameter(bus, 0, AX12_PRESENT_POSITION_L);
+            dxl_bus_set_txpacket_parameter(bus, 1, 8);
+            dxl_bus_set_txpacket_length(bus, 4);
+            dxl_bus_txrx_packet(bus);
+            long long t3 = dxl_stats_now_us();
+            if (dxl_bus_get_result(bus) == COMM_RXSUCCESS)
+                read8Times.push_back((t3 - t2)*0.001f);
         }
     }
-    if (dataLength > 6)
+
+    // sync_read of the first m motors, 2 bytes each
+    std::vector<std::vector<float> > syncTimes(dxlIDs.size());
+    for (int m = 1; m <= dxlIDs.size(); ++m)
     {
-        ROS_ERROR("Maximum data length must be 6 bytes.");
-        res.rxSuccess = false;
+        for (int k = 0; k < timingCalibrationSamples; ++k)
+        {
+            long long t0 = dxl_stats_now_us();
+            dxl_bus_sync_read_start(bus, AX12_PRESENT_POSITION_L, 2);
+            for (int i = 0; i < m; ++i)
+                dxl_bus_sync_read_push_id(bus, dxlIDs[i]);
+            dxl_bus_sync_read_send(bus);
+            long long t1 = dxl_stats_now_us();
+            if (dxl_bus_get_result(bus) == COMM_RXSUCCESS)
+                syncTimes[m - 1].push_back((t1 - t0)*0.001f);
+        }
+    }
+
+    if ( pingTimes.empty() || read2Times.empty() || read8Times.empty() )
+        return false;
+
+    // Fit lines through the 99th percentiles: time = base + perByte*bytes (+ perMotor*motors)
+    float perByte = std::max(0.0f, (percentile99(read8Times) - percentile99(read2Times))/6.0f);
+    float statusBase = std::max(0.0f, percentile99(pingTimes) - 6*perByte);
+    float readBase = std::max(0.0f, percentile99(read2Times) - 8*perByte);
+
+    // Least squares over the motor counts for sync_read
+    double sumM = 0.0, sumT = 0.0, sumMM = 0.0, sumMT = 0.0;
+    int numPoints = 0;
+    for (int m = 1; m <= syncTimes.size(); ++m)
+    {
+        if (syncTimes[m - 1].empty())
+            continue;
+        double t = percentile99(syncTimes[m - 1]);
+        sumM += m;
+        sumT += t;
+        sumMM += m*m;
+        sumMT += m*t;
+        ++numPoints;
+    }
+    if (numPoints == 0)
         return false;
+    float slope, intercept;
+    if ( (numPoints >= 2) && (numPoints*sumMM - sumM*sumM > 0.0) )
+    {
+        slope = (numPoints*sumMT - sumM*sumT)/(numPoints*sumMM - sumM*sumM);
+        intercept = (sumT - slope*sumM)/numPoints;
     }
+    else
+    {
+        // A single motor count: assume it all scales with the motors
+        slope = sumT/sumM;
+        intercept = 0.0f;
+    }
+    float syncPerMotor = std::max(0.0f, slope - 2*perByte);
+    float syncBase = std::max(0.0f, intercept - 6*perByte);
+
+    // Timeouts: the fitted times with a safety factor, plus a fixed margin
+    float sf = timingSafetyFactor;
+    float margin = timingMarginMs;
+    timing.assign(DXL_NUM_TIMING, DxlTiming());
+    timing[DXL_TIMING_STATUS].calibrated = 1;
+    timing[DXL_TIMING_STATUS].baseMs = statusBase*sf + margin;
+    timing[DXL_TIMING_STATUS].perByteMs = perByte*sf;
+    timing[DXL_TIMING_STATUS].perMotorMs = 0.0f;
+    timing[DXL_TIMING_READ].calibrated = 1;
+    timing[DXL_TIMING_READ].baseMs = readBase*sf + margin;
+    timing[DXL_TIMING_READ].perByteMs = perByte*sf;
+    timing[DXL_TIMING_READ].perMotorMs = 0.0f;
+    timing[DXL_TIMING_SYNC_READ].calibrated = 1;
+    timing[DXL_TIMING_SYNC_READ].baseMs = syncBase*sf + margin;
+    timing[DXL_TIMING_SYNC_READ].perByteMs = perByte*sf;
+    timing[DXL_TIMING_SYNC_READ].perMotorMs = syncPerMotor*sf;
+
+    ROS_INFO("USB2AX %d round trips (p99): ping %.2f ms, read 2 bytes %.2f ms, read 8 bytes %.2f ms, "
+             "sync_read of %d motors %.2f ms.", busDeviceIndices[busIndex], percentile99(pingTimes),
+             percentile99(read2Times), percentile99(read8Times), (int)dxlIDs.size(),
+             syncTimes.back().empty() ? 0.0f : percentile99(syncTimes.back()));
+    return true;
+}
 
-    // Generate sync_read command
-    dxl_sync_read_start(req.startAddress, dataLength);
-    for (int i = 0; i < numOfMotors; ++i)
-        dxl_sync_read_push_id(req.dxlIDs[i]);
-    dxl_sync_read_send();
 
-    int CommStatus = dxl_get_result();
-    if (CommStatus == COMM_RXSUCCESS)
+bool JointController::stageToBus(DxlBus* bus, int startAddress, const std::vector<bool>& isWord,
+                                 const std::vector<int>& dxlIDs, const std::vector<int>& values)
+{
+    int numOfMotors = dxlIDs.size();
+    int numOfValuesPerMotor = isWord.size();
+    unsigned char data[MAXNUM_TXPARAM];
+
+    bool success = true;
+    for (int i = 0; i < numOfMotors; ++i)
     {
-        int r;
-        for (int i = 0; i < numOfMotors; ++i)
+        int dataLength = 0;
+        for (int j = 0; j < numOfValuesPerMotor; ++j)
         {
-            for (int j = 0; j < req.numOfValuesPerMotor; ++j)
-            {
-                if (isWord[j])
-                    r = dxl_sync_read_pop_word();
-                else
-                    r = dxl_sync_read_pop_byte();
+            int value = values[i*numOfValuesPerMotor + j];
+            data[dataLength++] = dxl_get_lowbyte(value);
+            if (isWord[j])
+                data[dataLength++] = dxl_get_highbyte(value);
+        }
+        dxl_bus_reg_write(bus, dxlIDs[i], startAddress, data, dataLength);
 
-//                ROS_DEBUG( "i = %d", i );
-//                ROS_DEBUG( "j = %d", j );
-//                ROS_DEBUG( "index = %d", i*req.numOfValuesPerMotor + j );
-//                ROS_DEBUG( "ID %d = %d", req.dxlIDs[i], r );
-                res.values[i*req.numOfValuesPerMotor + j] = r;
-            }
+        // No return Status Packet from a broadcast command
+        if (dxlIDs[i] == BROADCAST_ID)
+            continue;
+
+        int CommStatus = dxl_bus_get_result(bus);
+        if (CommStatus == COMM_RXSUCCESS)
+        {
+            printErrorCode(bus);
+        }
+        else
+        {
+            ROS_ERROR("Could not stage values for motor %d.", dxlIDs[i]);
+            printCommStatus(CommStatus);
+            success = false;
         }
-        printErrorCode();
-        res.rxSuccess = true;
-        return true;
-    }
-    else
-    {
-        printCommStatus(CommStatus);
-        res.rxSuccess = false;
-        return false;
     }
+    return success;
 }
 
 
-bool JointController::sendSyncToAX(usb2ax_controller::SendSyncToAX::Request &req,
-                                   usb2ax_controller::SendSyncToAX::Response &res)
+void JointController::actionOnAllBuses()
 {
-    // Example: IDs 1, 3, 5 - Set goal position 100, goal speed 300, max torque 512
-    // startAddress:  AX12_GOAL_POSITION_L (30)
-    // dxlIDs:        |        1      |        3      |        5      |
-    // values:        | 100, 300, 512 | 100, 300, 512 | 100, 300, 512 |
+    // ACTION is a short broadcast without reply: send it to the buses one after the other from
+    // this thread, which is quicker than starting a thread per bus and keeps the skew between
+    // the buses to the USB transfer of a 6 byte packet.
+    for (int b = 0; b < buses.size(); ++b)
+        dxl_bus_action(buses[b]);
+}
+
+
+bool JointController::receiveBulkFromAX(usb2ax_controller::ReceiveBulkFromAX::Request &req,
+                                        usb2ax_controller::ReceiveBulkFromAX::Response &res)
+{
+    // Example: ID 1 - Get current position, current speed, current torque
+    //          ID 2 - Get voltage and temperature
+    // dxlIDs:          |       1       |      2      |
+    // startAddresses:  |      36       |     42      |
+    // numOfValues:     |       3       |      2      |
+    // Returned values: |  P1,  S1,  T1 |  V2,  T2    |
     //
     // rosservice command line example:
-    // rosservice call /SendSyncToAX '[1, 3, 5]' 30 '[100, 300, 512, 100, 300, 512, 100, 300, 512]'
+    // rosservice call /ReceiveBulkFromAX '[1, 2]' '[36, 42]' '[3, 2]'
 
-    int numOfMotors = req.dxlIDs.size();
+    BusGrant grant(scheduler, BusScheduler::SERVICE, serviceSlot, serviceMaxWait);
+    if (!grant.granted())
+        return refuseService("ReceiveBulkFromAX");
+    completePrefetch();
 
-    if (numOfMotors <= 0)
+    int numOfEntries = req.dxlIDs.size();
+
+    if (numOfEntries <= 0)
     {
         ROS_ERROR("No motors specified.");
-        res.txSuccess = false;
+        res.rxSuccess = false;
+        return false;
+    }
+    if ( (req.startAddresses.size() != numOfEntries) || (req.numOfValues.size() != numOfEntries) )
+    {
+        ROS_ERROR("Input data size mismatch.");
+        res.rxSuccess = false;
         return false;
     }
 
-    int numOfValuesPerMotor = req.values.size()/numOfMotors;
-
-    // Length of data for each motor
-    int dataLength = 0;
-    std::map<int, bool>::const_iterator it;
-    std::vector<bool> isWord(numOfValuesPerMotor, false);
-    for (int j = 0; j < numOfValuesPerMotor; ++j)
+    // Data length and position in the returned values of each entry
+    std::vector<std::vector<bool> > isWord(numOfEntries);
+    std::vector<int> dataLength(numOfEntries);
+    std::vector<int> offset(numOfEntries);
+    int numOfValues = 0;
+    for (int e = 0; e < numOfEntries; ++e)
     {
-        it = Ax12ControlTable::addressWordMap.find(req.startAddress + dataLength);
-        if (it == Ax12ControlTable::addressWordMap.end())
+        if ( !lookupDataLength(req.startAddresses[e], req.numOfValues[e], isWord[e], dataLength[e]) )
         {
-            ROS_ERROR("Address lookup error.");
-            res.txSuccess = false;
+            res.rxSuccess = false;
             return false;
         }
-        if (it->second == true)
+        offset[e] = numOfValues;
+        numOfValues += req.numOfValues[e];
+    }
+    res.values.assign(numOfValues, 0);
+
+    bool success = true;
+    if (bulkReadNative)
+    {
+        // One bulk_read per bus (more if the packet would be too long), each motor answering
+        // with its own window
+        std::vector<std::vector<int> > busEntries(buses.size());
+        for (int e = 0; e < numOfEntries; ++e)
         {
-            dataLength = dataLength + 2;
-            isWord[j] = true;
+            int busIndex = (req.dxlIDs[e] < BROADCAST_ID) ? motorBusIndex[req.dxlIDs[e]] : 0;
+            busEntries[busIndex].push_back(e);
         }
-        else
+        std::vector<int> usedBuses;
+        for (int b = 0; b < buses.size(); ++b)
         {
-            ++dataLength;
-            isWord[j] = false;
+            if (!busEntries[b].empty())
+                usedBuses.push_back(b);
         }
-    }
 
-    // Make sync_write packet
-//    ROS_DEBUG( "Packet" );
-//    ROS_DEBUG( "ID:\t\t\t %d", BROADCAST_ID );
-//    ROS_DEBUG( "Instr:\t\t\t %d", INST_SYNC_WRITE );
-//    ROS_DEBUG( "Param 0 (start addr):\t %d", req.startAddress );
-//    ROS_DEBUG( "Param 1 (data length):\t %d", dataLength );
-    dxl_set_txpacket_id(BROADCAST_ID);
-    dxl_set_txpacket_instruction(INST_SYNC_WRITE);
-    dxl_set_txpacket_parameter(0, req.startAddress);
-    dxl_set_txpacket_parameter(1, dataLength);
+        const ros::Time stamp = ros::Time::now();
+        std::vector<char> busSuccess(buses.size(), false);
+        runOnBuses(usedBuses, [&](int b)
+        {
+            DxlBus* bus = buses[b];
+            bool busOk = true;
+            int numOnBus = busEntries[b].size();
+            int first = 0;
+            while (first < numOnBus)
+            {
+                // Fill a bulk_read packet: 3 parameters for each entry after the leading 0,
+                // and the data of all the entries in the status packet
+                int last = first;
+                int rxLength = 0;
+                while ( (last < numOnBus) && (3*(last - first + 1) + 1 <= MAXNUM_TXPARAM) &&
+                        (rxLength + dataLength[busEntries[b][last]] <= MAXNUM_RXPARAM) )
+                {
+                    rxLength += dataLength[busEntries[b][last]];
+                    ++last;
+                }
+                if (last == first)
+                {
+                    ROS_ERROR("Bulk read entry too long.");
+                    busOk = false;
+                    break;
+                }
+
+                dxl_bus_bulk_read_start(bus);
+                for (int k = first; k < last; ++k)
+                {
+                    int e = busEntries[b][k];
+                    dxl_bus_bulk_read_push(bus, req.dxlIDs[e], req.startAddresses[e], dataLength[e]);
+                }
+                dxl_bus_bulk_read_send(bus);
+
+                int CommStatus = dxl_bus_get_result(bus);
+                if (CommStatus != COMM_RXSUCCESS)
+                {
+                    printCommStatus(CommStatus);
+                    busOk = false;
+                    first = last;
+                    continue;
+                }
+                for (int k = first; k < last; ++k)
+                {
+                    int e = busEntries[b][k];
+                    for (int j = 0; j < req.numOfValues[e]; ++j)
+                    {
+                        if (isWord[e][j])
+                            res.values[offset[e] + j] = dxl_bus_bulk_read_pop_word(bus);
+                        else
+                            res.values[offset[e] + j] = dxl_bus_bulk_read_pop_byte(bus);
+                    }
+                    storeShadow(req.dxlIDs[e], req.startAddresses[e], res.values, offset[e], req.numOfValues[e], stamp);
+                }
+                printErrorCode(bus);
+                first = last;
+            }
+            busSuccess[b] = busOk;
+        });
 
-    int paramIndex = 2;
-    for (int i = 0; i < numOfMotors; ++i)
+        for (int k = 0; k < usedBuses.size(); ++k)
+        {
+            if (!busSuccess[usedBuses[k]])
+                success = false;
+        }
+    }
+    else
     {
-//        ROS_DEBUG( "Param %d (dxl %d):\t %d", paramIndex, i, req.dxlIDs[i] );
-        dxl_set_txpacket_parameter( paramIndex++, req.dxlIDs[i] );
-        for (int j = 0; j < numOfValuesPerMotor; ++j)
+        // Emulate with one sync_read for each group of motors sharing the same address window
+        std::map<std::pair<int, int>, std::vector<int> > windows;
+        for (int e = 0; e < numOfEntries; ++e)
+            windows[std::make_pair(req.startAddresses[e], req.numOfValues[e])].push_back(e);
+
+        for (std::map<std::pair<int, int>, std::vector<int> >::iterator it = windows.begin();
+             it != windows.end(); ++it)
         {
-            //                ROS_DEBUG( "Value: %d", req.values[i*numOfValuesPerMotor + j] );
-            if (isWord[j])
+            usb2ax_controller::ReceiveSyncFromAX::Request req2;
+            usb2ax_controller::ReceiveSyncFromAX::Response res2;
+            req2.startAddress = it->first.first;
+            req2.numOfValuesPerMotor = it->first.second;
+            for (int k = 0; k < it->second.size(); ++k)
+                req2.dxlIDs.push_back(req.dxlIDs[it->second[k]]);
+            if ( !receiveSyncFromAX(req2, res2) )
             {
-                // 2 bytes
-//                ROS_DEBUG( "Param %d (data %dL):\t %d", paramIndex, j,
-//                           dxl_get_lowbyte((int)(req.values[i*numOfValuesPerMotor + j])) );
-//                ROS_DEBUG( "Param %d (data %dH):\t %d", paramIndex + 1, j,
-//                           dxl_get_highbyte((int)(req.values[i*numOfValuesPerMotor + j])) );
-                dxl_set_txpacket_parameter( paramIndex++,
-                                            dxl_get_lowbyte((int)(req.values[i*numOfValuesPerMotor + j])) );
-                dxl_set_txpacket_parameter( paramIndex++,
-                                            dxl_get_highbyte((int)(req.values[i*numOfValuesPerMotor + j])) );
+                success = false;
+                continue;
             }
-            else
+            for (int k = 0; k < it->second.size(); ++k)
             {
-                // 1 byte
-//                ROS_DEBUG( "Param %d (data %d):\t %d", paramIndex, j,
-//                           dxl_get_highbyte((int)(req.values[i*numOfValuesPerMotor + j])) );
-                dxl_set_txpacket_parameter(paramIndex++, (int)(req.values[i*numOfValuesPerMotor + j]) );
+                int e = it->second[k];
+                for (int j = 0; j < req.numOfValues[e]; ++j)
+                    res.values[offset[e] + j] = res2.values[k*req2.numOfValuesPerMotor + j];
             }
-//            ROS_DEBUG("--");
         }
     }
 
-//    ROS_DEBUG( "Length:\t\t\t %d", (dataLength + 1)*numOfMotors + 4 );
-    dxl_set_txpacket_length( (dataLength + 1)*numOfMotors + 4 );
-
-    dxl_txrx_packet();
-
-    int CommStatus = dxl_get_result();
-    if (CommStatus == COMM_RXSUCCESS)
-    {
-        printErrorCode();
-        res.txSuccess = true;
-        return true;
-    }
-    else
-    {
-        printCommStatus(CommStatus);
-        res.txSuccess = false;
-        return false;
-    }
+    res.rxSuccess = success;
+    return success;
 }
 
 
@@ -859,7 +3156,7 @@ bool JointController::getMotorCurrentPositionInRad(usb2ax_controller::GetMotorPa
     req2.address = AX12_PRESENT_POSITION_L;
     if ( receiveFromAX(req2, res2) )
     {
-        res.value = directionSign[req.dxlID - 1] * axPositionToRad(res2.value);
+        res.value = jointPositionFromAx(jointIndex(req.dxlID), res2.value);
         res.rxSuccess = res2.rxSuccess;
         return true;
     }
@@ -880,7 +3177,7 @@ bool JointController::getMotorGoalPositionInRad(usb2ax_controller::GetMotorParam
     req2.address = AX12_GOAL_POSITION_L;
     if ( receiveFromAX(req2, res2) )
     {
-        res.value = directionSign[req.dxlID - 1] * axPositionToRad(res2.value);
+        res.value = jointPositionFromAx(jointIndex(req.dxlID), res2.value);
         res.rxSuccess = res2.rxSuccess;
         return true;
     }
@@ -895,14 +3192,14 @@ bool JointController::getMotorGoalPositionInRad(usb2ax_controller::GetMotorParam
 bool JointController::setMotorGoalPositionInRad(usb2ax_controller::SetMotorParam::Request &req,
                                                 usb2ax_controller::SetMotorParam::Response &res)
 {
-    ROS_DEBUG("Direction sign: %d", directionSign[req.dxlID - 1]);
-    ROS_DEBUG("Value: %d", radToAxPosition(directionSign[req.dxlID - 1] * req.value));
+    ROS_DEBUG("Joint index: %d", jointIndex(req.dxlID));
+    ROS_DEBUG("Value: %d", jointPositionToAx(jointIndex(req.dxlID), req.value));
     ROS_DEBUG("----");
     usb2ax_controller::SendToAX::Request req2;
     usb2ax_controller::SendToAX::Response res2;
     req2.dxlID = req.dxlID;
     req2.address = AX12_GOAL_POSITION_L;
-    req2.value = radToAxPosition(directionSign[req.dxlID - 1] * req.value);
+    req2.value = jointPositionToAx(jointIndex(req.dxlID), req.value);
     if ( sendToAX(req2, res2) )
     {
         res.txSuccess = res2.txSuccess;
@@ -1054,7 +3351,7 @@ bool JointController::getMotorCurrentPositionsInRad(usb2ax_controller::GetMotorP
     {
         res.values.resize(res2.values.size());
         for (int i = 0; i < req2.dxlIDs.size(); ++i)
-            res.values[i] = directionSign[req2.dxlIDs[i] - 1] * axPositionToRad(res2.values[i]);
+            res.values[i] = jointPositionFromAx(jointIndex(req2.dxlIDs[i]), res2.values[i]);
         res.rxSuccess = res2.rxSuccess;
         return true;
     }
@@ -1078,7 +3375,7 @@ bool JointController::getMotorGoalPositionsInRad(usb2ax_controller::GetMotorPara
     {
         res.values.resize(res2.values.size());
         for (int i = 0; i < req2.dxlIDs.size(); ++i)
-            res.values[i] = directionSign[req2.dxlIDs[i] - 1] * axPositionToRad(res2.values[i]);
+            res.values[i] = jointPositionFromAx(jointIndex(req2.dxlIDs[i]), res2.values[i]);
         res.rxSuccess = res2.rxSuccess;
         return true;
     }
@@ -1105,7 +3402,7 @@ bool JointController::setMotorGoalPositionsInRad(usb2ax_controller::SetMotorPara
     req2.startAddress = AX12_GOAL_POSITION_L;
     req2.values.resize(req.values.size());
     for (int i = 0; i < req2.dxlIDs.size(); ++i)
-        req2.values[i] = radToAxPosition( directionSign[req2.dxlIDs[i] - 1] * req.values[i] );
+        req2.values[i] = jointPositionToAx( jointIndex(req2.dxlIDs[i]), req.values[i] );
     if ( sendSyncToAX(req2, res2) )
         return true;
     else
@@ -1255,6 +3552,155 @@ bool JointController::setMotorMaxTorquesInDecimal(usb2ax_controller::SetMotorPar
 }
 
 
+bool JointController::exchangeState(usb2ax_controller::ExchangeState::Request &req,
+                                    usb2ax_controller::ExchangeState::Response &res)
+{
+    // Example: left and right elbows to 0.5 rad at 2 rad/s, and the state of both
+    // rosservice call /ExchangeState '[right_elbow_joint, left_elbow_joint]' '[0.5, 0.5]' '[2.0, 2.0]' '[]'
+    //
+    // The goals go out in one sync_write: goal positions only, or goal position, moving speed and
+    // torque limit (addresses 30 to 35) if any speed or torque is commanded, the values left unset
+    // being taken from the shadow. The state comes back in one sync_read of addresses 36 to 41.
+    std::vector<int> jointIndices;
+    if (req.names.empty())
+    {
+        for (int j = 0; j < joints.size(); ++j)
+            jointIndices.push_back(j);
+    }
+    for (int k = 0; k < req.names.size(); ++k)
+    {
+        int j = jointIndexForName(req.names[k]);
+        if (j < 0)
+        {
+            ROS_ERROR("Unknown joint %s.", req.names[k].c_str());
+            return false;
+        }
+        jointIndices.push_back(j);
+    }
+    int numOfJoints = jointIndices.size();
+    if ( (!req.positions.empty() && (req.positions.size() != numOfJoints)) ||
+         (!req.speeds.empty() && (req.speeds.size() != numOfJoints)) ||
+         (!req.torques.empty() && (req.torques.size() != numOfJoints)) )
+    {
+        ROS_ERROR("Input data size mismatch.");
+        return false;
+    }
+
+    BusGrant grant(scheduler, BusScheduler::SERVICE, serviceSlot, serviceMaxWait);
+    if (!grant.granted())
+        return refuseService("ExchangeState");
+
+    // Goals
+    bool limits = !req.speeds.empty() || !req.torques.empty();
+    usb2ax_controller::SendSyncToAX::Request writeReq;
+    usb2ax_controller::SendSyncToAX::Response writeRes;
+    writeReq.startAddress = AX12_GOAL_POSITION_L;
+    res.txSuccess = true;
+    for (int k = 0; k < numOfJoints; ++k)
+    {
+        int j = jointIndices[k];
+        int dxlID = joints[j].dxlID;
+        float position = req.positions.empty() ? NAN : req.positions[k];
+        float speed = req.speeds.empty() ? NAN : req.speeds[k];
+        float torque = req.torques.empty() ? NAN : req.torques[k];
+        if ( !connectedMotors[j] || (std::isnan(position) && std::isnan(speed) && std::isnan(torque)) )
+            continue;
+
+        // Speed 0 is the full speed of an AX-12, so the slowest speed is 1 unit (0.0116 rad/s)
+        int values[3];
+        bool known = true;
+        if (!std::isnan(position))
+            values[0] = jointPositionToAx(j, position);
+        else
+            known = shadowValue(dxlID, AX12_GOAL_POSITION_L, values[0]);
+        if (!std::isnan(speed))
+            values[1] = std::max(radPerSecToAxSpeed( std::min(std::fabs(speed), 1023*0.0116f) ), 1);
+        else if (limits)
+            known = shadowValue(dxlID, AX12_MOVING_SPEED_L, values[1]) && known;
+        if (!std::isnan(torque))
+            values[2] = decimalToAxTorque( std::min(std::max(torque, 0.0f), 1023*0.001f) );
+        else if (limits)
+            known = shadowValue(dxlID, AX12_TORQUE_LIMIT_L, values[2]) && known;
+        if (!known)
+        {
+            ROS_WARN("Goals of motor %d unknown, not written.", dxlID);
+            res.txSuccess = false;
+            continue;
+        }
+        writeReq.dxlIDs.push_back(dxlID);
+        writeReq.values.insert(writeReq.values.end(), values, values + (limits ? 3 : 1));
+    }
+    if (!writeReq.dxlIDs.empty())
+        res.txSuccess = sendSyncToAX(writeReq, writeRes) && res.txSuccess;
+
+    // State
+    res.state.name.resize(numOfJoints);
+    res.state.position.assign(numOfJoints, NAN);
+    res.state.velocity.assign(numOfJoints, NAN);
+    res.state.effort.assign(numOfJoints, NAN);
+    usb2ax_controller::ReceiveSyncFromAX::Request readReq;
+    readReq.startAddress = AX12_PRESENT_POSITION_L;
+    readReq.numOfValuesPerMotor = 3;
+    std::vector<int> readIndices;
+    for (int k = 0; k < numOfJoints; ++k)
+    {
+        int j = jointIndices[k];
+        res.state.name[k] = joints[j].name;
+        if (connectedMotors[j])
+        {
+            readReq.dxlIDs.push_back(joints[j].dxlID);
+            readIndices.push_back(k);
+        }
+    }
+    res.state.header.stamp = ros::Time::now();
+    res.rxSuccess = false;
+    SyncReadTransaction t;
+    if ( !readReq.dxlIDs.empty() && prepareSyncRead(readReq, t) )
+    {
+        completePrefetch();
+        std::vector<uint16_t> values;
+        std::vector<bool> motorValid;
+        sendSyncRead(t);
+        receiveSyncRead(t);
+        res.rxSuccess = mergeSyncRead(t, values, &motorValid) && (readIndices.size() == numOfJoints);
+        res.state.header.stamp = t.stamp;
+        for (int i = 0; i < readIndices.size(); ++i)
+        {
+            if (!motorValid[i])
+                continue;
+            int k = readIndices[i];
+            res.state.position[k] = jointPositionFromAx(jointIndices[k], values[3*i]);
+            res.state.velocity[k] = axSpeedToRadPerSec(values[3*i + 1]);
+            res.state.effort[k] = axTorqueToDecimal(values[3*i + 2]);
+        }
+    }
+    // Motors that did not answer are reported in the response, not by failing the call
+    return true;
+}
+
+
+void JointController::executeExchangeState(const usb2ax_controller::ExchangeStateGoalConstPtr &goal,
+                                           ExchangeStateServer* as)
+{
+    usb2ax_controller::ExchangeState::Request req;
+    usb2ax_controller::ExchangeState::Response res;
+    req.names = goal->names;
+    req.positions = goal->positions;
+    req.speeds = goal->speeds;
+    req.torques = goal->torques;
+    bool success = exchangeState(req, res) && res.txSuccess && res.rxSuccess;
+
+    usb2ax_controller::ExchangeStateResult result;
+    result.state = res.state;
+    result.txSuccess = res.txSuccess;
+    result.rxSuccess = res.rxSuccess;
+    if (success)
+        as->setSucceeded(result);
+    else
+        as->setAborted(result);
+}
+
+
 bool JointController::homeAllMotors(std_srvs::Empty::Request &req, std_srvs::Empty::Response &res)
 {
 //    usb2ax_controller::SendSyncToAX::Request req2;
@@ -1288,6 +3734,23 @@ bool JointController::homeAllMotors(std_srvs::Empty::Request &req, std_srvs::Emp
 }
 
 
+DxlBus* JointController::busForMotor(int dxlID)
+{
+    if ( (0 <= dxlID) && (dxlID < BROADCAST_ID) )
+        return buses[motorBusIndex[dxlID]];
+    else
+        return buses[0];
+}
+
+
+void JointController::runOnBuses(const std::vector<int>& busIndices, const std::function<void(int)>& fn)
+{
+    // Each bus is half-duplex and independent, so transactions on different buses run concurrently.
+    // The first bus is served on the calling thread, the others by their worker.
+    busWorkers.run(busIndices, fn);
+}
+
+
 void JointController::printCommStatus(int CommStatus)
 {
     switch(CommStatus)
@@ -1331,31 +3794,48 @@ void JointController::printCommStatus(int CommStatus)
 }
 
 
-void JointController::printErrorCode()
+void JointController::printErrorCode(DxlBus* bus)
 {
-    if(dxl_get_rxpacket_error(ERRBIT_VOLTAGE) == 1)
+    if(dxl_bus_get_rxpacket_error(bus, ERRBIT_VOLTAGE) == 1)
         ROS_ERROR("Input voltage error!");
 
-    if(dxl_get_rxpacket_error(ERRBIT_ANGLE) == 1)
+    if(dxl_bus_get_rxpacket_error(bus, ERRBIT_ANGLE) == 1)
         ROS_ERROR("Angle limit error!");
 
-    if(dxl_get_rxpacket_error(ERRBIT_OVERHEAT) == 1)
+    if(dxl_bus_get_rxpacket_error(bus, ERRBIT_OVERHEAT) == 1)
         ROS_ERROR("Overheat error!");
 
-    if(dxl_get_rxpacket_error(ERRBIT_RANGE) == 1)
+    if(dxl_bus_get_rxpacket_error(bus, ERRBIT_RANGE) == 1)
         ROS_ERROR("Out of range error!");
 
-    if(dxl_get_rxpacket_error(ERRBIT_CHECKSUM) == 1)
+    if(dxl_bus_get_rxpacket_error(bus, ERRBIT_CHECKSUM) == 1)
         ROS_ERROR("Checksum error!");
 
-    if(dxl_get_rxpacket_error(ERRBIT_OVERLOAD) == 1)
+    if(dxl_bus_get_rxpacket_error(bus, ERRBIT_OVERLOAD) == 1)
         ROS_ERROR("Overload error!");
 
-    if(dxl_get_rxpacket_error(ERRBIT_INSTRUCTION) == 1)
+    if(dxl_bus_get_rxpacket_error(bus, ERRBIT_INSTRUCTION) == 1)
         ROS_ERROR("Instruction code error!");
 }
 
 
+float JointController::jointPositionFromAx(int jointIndex, int value)
+{
+    // A device that is not a joint has the motor's own angle
+    if (jointIndex < 0)
+        return axPositionToRad(value);
+    return joints[jointIndex].sign * axPositionToRad(value) + joints[jointIndex].offset;
+}
+
+
+int JointController::jointPositionToAx(int jointIndex, double position)
+{
+    if (jointIndex < 0)
+        return radToAxPosition(position);
+    return radToAxPosition( joints[jointIndex].sign * (position - joints[jointIndex].offset) );
+}
+
+
 float JointController::axPositionToRad(int oldValue)
 {
     // Convert AX-12 position to rads
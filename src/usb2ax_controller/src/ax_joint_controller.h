@@ -2,9 +2,14 @@
 #define AX_JOINT_CONTROLLER_H
 
 #include <map>
+#include <string>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
 #include <stdexcept>
+#include <semaphore.h>
 #include "ros/ros.h"
 #include "sensor_msgs/JointState.h"
 #include "control_msgs/FollowJointTrajectoryAction.h"
@@ -13,15 +18,29 @@
 #include "usb2ax_controller/SendToAX.h"
 #include "usb2ax_controller/ReceiveSyncFromAX.h"
 #include "usb2ax_controller/SendSyncToAX.h"
+#include "usb2ax_controller/StageSyncToAX.h"
+#include "usb2ax_controller/ReceiveBulkFromAX.h"
+#include "usb2ax_controller/MotorTelemetry.h"
+#include "usb2ax_controller/MotorMoving.h"
+#include "usb2ax_controller/BusLatency.h"
+#include "usb2ax_controller/MotorHealth.h"
 #include "usb2ax_controller/GetMotorParam.h"
 #include "usb2ax_controller/SetMotorParam.h"
 #include "usb2ax_controller/GetMotorParams.h"
 #include "usb2ax_controller/SetMotorParams.h"
+#include "usb2ax_controller/ExchangeState.h"
+#include "usb2ax_controller/ExchangeStateAction.h"
 #include "actionlib/server/simple_action_server.h"
 #include "controller_manager/controller_manager.h"
 #include "bioloidhw.h"
+#include "bus_scheduler.h"
+#include "bus_workers.h"
+#include "triple_buffer.h"
+#include "usb2ax/dynamixel_syncread.h"
+#include "usb2ax/dxl_stats.h"
 
 typedef actionlib::SimpleActionServer<control_msgs::FollowJointTrajectoryAction> Server;
+typedef actionlib::SimpleActionServer<usb2ax_controller::ExchangeStateAction> ExchangeStateServer;
 
 int main(int argc, char **argv);
 
@@ -32,6 +51,122 @@ public:
     static const std::map<int, bool> addressWordMap;
 };
 
+// USB2AX sync_read limits. Larger requests are split into several sync_read packets.
+#define USB2AX_SYNC_READ_MAX_MOTORS 32
+#define USB2AX_SYNC_READ_MAX_DATA_LENGTH 6
+
+// A joint of the robot, and the motor that drives it
+struct JointInfo
+{
+    std::string name;
+    int dxlID;
+    int sign;                       // -1 if the motor turns the other way
+    double offset;                  // rad, joint angle at the centre position of the motor
+};
+
+// A device found on one of the buses at startup
+struct MotorInfo
+{
+    int dxlID;
+    int busIndex;
+    int modelNumber;
+    int firmwareVersion;
+};
+
+// Health of a motor, from the replies to the state sync_read
+struct MotorHealthState
+{
+    int consecutiveFailures;
+    unsigned int timeouts;
+    unsigned int corrupt;
+    int errorBits;                  // Error byte of the last status packet
+    bool stale;                     // No fresh state in the last read
+    bool dropped;                   // Out of the state sync_read, pinged now and then
+    ros::Time nextProbe;
+    double backoff;                 // s, doubled after each probe without answer
+};
+
+// Last known control table of a motor, by address: read from it, or written to it by the controller
+struct MotorShadow
+{
+    std::vector<int> values;
+    std::vector<ros::Time> stamps;  // Zero when not known
+};
+
+// Goal writes since the last bus latency publication
+struct GoalWriteCounters
+{
+    GoalWriteCounters() : valuesSent(0), valuesSkipped(0), bytesSent(0), bytesSaved(0) {}
+    unsigned int valuesSent;
+    unsigned int valuesSkipped;     // Unchanged, within the dead-band
+    unsigned int bytesSent;         // TX bytes of the goal packets
+    unsigned int bytesSaved;        // Against writing every joint every cycle
+};
+
+// Latest command streamed on ax_joint_commands for a joint, NaN when none is pending. The
+// subscriber callback overwrites it and write() takes it, without locks on either side.
+struct JointCommandSlot
+{
+    std::atomic<float> position;    // rad
+    std::atomic<float> speed;       // rad/s, moving speed
+    std::atomic<float> torque;      // Torque limit, 0 to 1
+};
+
+// State read in one cycle, handed from the control loop to the publication thread
+struct StateSample
+{
+    sensor_msgs::JointState jointState;
+    usb2ax_controller::MotorMoving motorMoving;
+    bool movingRead;                // motorMoving was read in this cycle
+    std::vector<MotorHealthState> motorHealth;  // For each joint
+    std::vector<bool> connectedMotors;
+};
+
+// Slow registers of all motors, read a few motors per cycle so that a sweep of all of them takes
+// 1/rate s, and published when the sweep is done
+struct TelemetryGroup
+{
+    TelemetryGroup(int startAddress, int numOfValues, int dataLength) :
+        startAddress(startAddress), numOfValues(numOfValues), dataLength(dataLength), rate(0.0), nextIndex(0) {}
+    int startAddress;
+    int numOfValues;
+    int dataLength;                 // Bytes per motor
+    double rate;                    // Hz, sweeps per second, 0 to disable
+    int nextIndex;                  // Next motor of the sweep
+    ros::Time nextRead;
+};
+
+// One sync_read packet: some of the motors of one bus, and a slice of the address window
+struct SyncReadChunk
+{
+    int startAddress;
+    int dataLength;
+    int firstValue;                 // Index of the first value of the slice for each motor
+    std::vector<bool> isWord;
+    std::vector<int> motorIDs;
+    std::vector<int> motorIndices;  // Position of each motor in the request
+    std::vector<int> values;
+    bool success;
+    std::vector<int> motorStatus;   // COMM_* result for each motor
+    std::vector<int> motorErrors;   // Error byte for each motor, when read on its own
+};
+
+// A sync_read split over the buses and into chunks, run either in one go or in two phases
+// (send the first chunk of each bus now, receive later). The chunks of a bus are sent back
+// to back, each one as soon as the reply to the previous one has arrived.
+// It may read several address windows; the values of a motor follow the window order.
+struct SyncReadTransaction
+{
+    int numOfMotors;
+    int numOfValuesPerMotor;
+    std::vector<int> windowAddresses;
+    std::vector<int> windowFirstValues;
+    std::vector<int> dxlIDs;        // In request order
+    ros::Time stamp;                // When the request was sent
+    std::vector<int> usedBuses;
+    std::vector<std::vector<SyncReadChunk> > busChunks;
+};
+
 class JointController
 {
 public:
@@ -39,13 +174,50 @@ public:
     virtual ~JointController();
     bool init();
     void read();
+    void readTelemetry();
+    void probeDroppedMotors();
     void write();
+    void openSlack(const ros::WallTime& cycleStart, double cyclePeriod);
+    void prefetchRead();
+    void publishBusLatency();
+    void publishState(double maxWait);
     bool getPositionControlEnabled() const { return positionControlEnabled; }
     void setPositionControlEnabled(bool value) { positionControlEnabled = value; }
     int getDeviceIndex() const {return deviceIndex;}
     void setDeviceIndex(int value) {deviceIndex = value;}
     int getBaudNum() const {return baudNum;}
     void setBaudNum(int value) {baudNum = value;}
+    int getRxMode() const {return rxMode;}
+    void setRxMode(int value) {rxMode = value;}
+    const std::string& getDevicePath() const {return devicePath;}
+    void setDevicePath(const std::string& value) {devicePath = value;}
+    void addBus(int busDeviceIndex, const std::vector<int>& dxlIDs, int protocol = DXL_PROTOCOL_1,
+                const std::string& busDevicePath = "");
+    bool getPipelinedReadEnabled() const {return pipelinedReadEnabled;}
+    void setPipelinedReadEnabled(bool value) {pipelinedReadEnabled = value;}
+    bool getBulkReadNative() const {return bulkReadNative;}
+    void setBulkReadNative(bool value) {bulkReadNative = value;}
+    void setTelemetry(int bytesPerCycle, double goalRate, double thermalRate, bool movingEnabled);
+    double getLatencyPublicationPeriod() const {return latencyPublicationPeriod;}
+    void setLatencyPublicationPeriod(double value) {latencyPublicationPeriod = value;}
+    void setBusTiming(int busIndex, int timingClass, const DxlTiming& timing);
+    void setTimingCalibration(int samples, double safetyFactor, double marginMs);
+    bool getStagedWriteEnabled() const {return stagedWriteEnabled;}
+    void setStagedWriteEnabled(bool value) {stagedWriteEnabled = value;}
+    int getStatusReturnLevel() const {return statusReturnLevel;}
+    void setStatusReturnLevel(int value) {statusReturnLevel = value;}
+    void setDiscoveryRange(int firstID, int lastID, double timeoutMs);
+    const std::vector<JointInfo>& getJoints() const {return joints;}
+    void setJoints(const std::vector<JointInfo>& value);
+    const std::vector<MotorInfo>& getMotorInventory() const {return motorInventory;}
+    void setFaultHandling(int threshold, double backoffMin, double backoffMax);
+    int getWriteVerifyPeriod() const {return writeVerifyPeriod;}
+    void setWriteVerifyPeriod(int value) {writeVerifyPeriod = value;}
+    void setDeltaWrite(bool enabled, int deadband, double keepAlivePeriod);
+    void setShadowCache(bool enabled, double maxAge);
+    void setArbitration(double serviceSlotMs, double serviceMaxWait, double controlReserveMs);
+    void setControlLoopRunning(bool value) {controlLoopRunning = value;}
+    bool setBusWorkersRealtimePriority(int priority) {return busWorkers.setRealtimePriority(priority);}
     //
     bool receiveFromAX(usb2ax_controller::ReceiveFromAX::Request &req,
                        usb2ax_controller::ReceiveFromAX::Response &res);
@@ -56,6 +228,12 @@ public:
                            usb2ax_controller::ReceiveSyncFromAX::Response &res);
     bool sendSyncToAX(usb2ax_controller::SendSyncToAX::Request &req,
                       usb2ax_controller::SendSyncToAX::Response &res);
+    bool receiveBulkFromAX(usb2ax_controller::ReceiveBulkFromAX::Request &req,
+                           usb2ax_controller::ReceiveBulkFromAX::Response &res);
+    bool stageSyncToAX(usb2ax_controller::StageSyncToAX::Request &req,
+                       usb2ax_controller::StageSyncToAX::Response &res);
+    bool triggerStagedAX(std_srvs::Empty::Request &req, std_srvs::Empty::Response &res);
+    bool calibrateBusTiming(std_srvs::Empty::Request &req, std_srvs::Empty::Response &res);
     //
     bool getMotorCurrentPositionInRad(usb2ax_controller::GetMotorParam::Request &req,
                                       usb2ax_controller::GetMotorParam::Response &res);
@@ -99,16 +277,71 @@ public:
     bool setMotorMaxTorquesInDecimal(usb2ax_controller::SetMotorParams::Request &req,
                                      usb2ax_controller::SetMotorParams::Response &res);
     //
+    bool exchangeState(usb2ax_controller::ExchangeState::Request &req,
+                       usb2ax_controller::ExchangeState::Response &res);
+    void executeExchangeState(const usb2ax_controller::ExchangeStateGoalConstPtr &goal, ExchangeStateServer* as);
+    //
     bool homeAllMotors(std_srvs::Empty::Request &req, std_srvs::Empty::Response &res);
     //
+    void jointCommandCallback(const sensor_msgs::JointState::ConstPtr& msg);
+    //
     ros::Publisher jointStatePub;
     ros::Publisher goalJointStatePub;
+    ros::Publisher motorTelemetryPub;
+    ros::Publisher motorMovingPub;
+    ros::Publisher busLatencyPub;
+    ros::Publisher motorHealthPub;
     BioloidHw* bioloidHw;
     controller_manager::ControllerManager* cm;
 
 private:
+    DxlBus* busForMotor(int dxlID);
+    int jointIndex(int dxlID) const;
+    int jointIndexForName(const std::string& name) const;
+    void discoverMotors();
+    void runOnBuses(const std::vector<int>& busIndices, const std::function<void(int)>& fn);
+    bool lookupDataLength(int startAddress, int numOfValues, std::vector<bool>& isWord, int& dataLength);
+    bool prepareSyncRead(const usb2ax_controller::ReceiveSyncFromAX::Request &req, SyncReadTransaction& t);
+    bool addSyncReadWindow(SyncReadTransaction& t, int startAddress, int numOfValues);
+    void sendSyncRead(SyncReadTransaction& t);
+    void receiveSyncRead(SyncReadTransaction& t);
+    bool mergeSyncRead(const SyncReadTransaction& t, std::vector<uint16_t>& values,
+                       std::vector<bool>* motorValid = NULL);
+    void isolateSyncReadFailure(DxlBus* bus, SyncReadChunk& chunk);
+    void updateMotorHealth(const SyncReadTransaction& t);
+    bool probeMotor(int dxlID);
+    void publishMotorHealth(const StateSample& sample);
+    float pingTimeoutForBus(DxlBus* bus);
+    void completePrefetch();
+    void loadShadow();
+    bool lookupShadow(int dxlID, int address, int& value, double& age);
+    bool shadowValue(int dxlID, int address, int& value);
+    void storeShadow(int dxlID, int startAddress, const std::vector<uint16_t>& values, int first, int count,
+                     const ros::Time& stamp);
+    void invalidateShadow(int dxlID, int startAddress, int count);
+    void makeStateReadRequest(usb2ax_controller::ReceiveSyncFromAX::Request &req);
+    bool prepareStateRead(SyncReadTransaction& t);
+    int readTelemetryGroup(TelemetryGroup& group, const std::vector<int>& motors, int maxMotors,
+                           const ros::Time& currentTime);
+    void applyTelemetryValue(int dxlID, int address, int value);
+    void syncReadChunkSend(DxlBus* bus, const SyncReadChunk& chunk);
+    bool syncReadFromBusReceive(DxlBus* bus, const std::vector<bool>& isWord,
+                                const std::vector<int>& dxlIDs, std::vector<int>& values);
+    bool syncWriteToBus(DxlBus* bus, int startAddress, int dataLength, const std::vector<bool>& isWord,
+                        const std::vector<int>& dxlIDs, const std::vector<int>& values);
+    bool stageToBus(DxlBus* bus, int startAddress, const std::vector<bool>& isWord,
+                    const std::vector<int>& dxlIDs, const std::vector<int>& values);
+    bool stageSync(usb2ax_controller::StageSyncToAX::Request &req,
+                   usb2ax_controller::StageSyncToAX::Response &res);
+    void actionOnAllBuses();
+    bool calibrateBus(int busIndex, std::vector<DxlTiming>& timing);
+    bool verifyWrite(DxlBus* bus, int dxlID, int address, bool isWord, int value);
+    void fillLatencyHistogram(const DxlHistogram& hist, usb2ax_controller::LatencyHistogram& msg);
+    bool refuseService(const char* name);
     void printCommStatus(int CommStatus);
-    void printErrorCode(void);
+    void printErrorCode(DxlBus* bus);
+    float jointPositionFromAx(int jointIndex, int value);
+    int jointPositionToAx(int jointIndex, double position);
     float axPositionToRad(int oldValue);
     int radToAxPosition(float oldValue);
     float axSpeedToRadPerSec(int oldValue);
@@ -118,13 +351,78 @@ private:
     bool positionControlEnabled;
     int deviceIndex;
     int baudNum;
+    int rxMode;
+    std::string devicePath;
+    std::vector<int> busDeviceIndices;
+    std::vector<std::string> busDevicePaths;  // Overrides the device index when not empty
+    std::vector<int> busProtocols;
+    std::vector<DxlBus*> buses;
+    BusWorkers busWorkers;            // Serve the buses but the first in runOnBuses()
+    std::vector<int> motorBusIndex;  // Bus index for each motor ID
+    std::vector<JointInfo> joints;
+    std::vector<int> jointIndexForID;  // Joint index for each motor ID, -1 for the other devices
+    std::map<std::string, int> jointIndexByName;
+    std::unique_ptr<JointCommandSlot[]> jointCommands;  // For each joint
+    std::atomic<bool> jointCommandsPending;
+    bool pipelinedReadEnabled;
+    bool prefetchPending;
+    bool prefetchReady;
+    bool prefetchSuccess;
+    ros::Time prefetchStamp;
+    SyncReadTransaction prefetchTransaction;
+    std::vector<uint16_t> prefetchValues;
+    std::vector<bool> prefetchValid;  // For each motor of the prefetch request
+    bool bulkReadNative;
+    int telemetryBytesPerCycle;       // Data bytes of the slow registers read in one cycle
+    TelemetryGroup goalTelemetry;     // Goal position, moving speed and torque limit
+    TelemetryGroup thermalTelemetry;  // Voltage and temperature
+    bool movingTelemetryEnabled;      // Moving flags, read with the state every cycle
+    bool stagedWriteEnabled;
+    std::vector<std::vector<DxlTiming> > busTimings;  // Receive timeouts for each bus, if set
+    int timingCalibrationSamples;
+    double timingSafetyFactor;
+    double timingMarginMs;
+    int statusReturnLevel;            // Written to all motors at startup, -1 to keep theirs
+    int writeVerifyPeriod;            // Read back every n-th unacknowledged write, 0 never
+    int writeVerifyCounter;
+    int scanFirstID;
+    int scanLastID;
+    double scanTimeoutMs;             // Receive window of each PING of the scan, unless calibrated
+    std::vector<MotorInfo> motorInventory;
+    std::vector<MotorHealthState> motorHealth;  // For each joint
+    int faultThreshold;               // Consecutive failed reads before a motor is dropped
+    double probeBackoffMin;           // s
+    double probeBackoffMax;           // s
+    bool deltaWriteEnabled;
+    int goalDeadband;                 // AX units
+    double goalKeepAlivePeriod;       // s, all goals are written again
+    std::vector<int> goalSent;        // Last goal position written to each motor, -1 if unknown
+    std::vector<int> speedLimitSent;  // Last moving speed written by write(), -1 if none
+    std::vector<int> torqueLimitSent; // Last torque limit written by write(), -1 if none
+    ros::Time timeOfLastGoalRefresh;
+    GoalWriteCounters goalWriteCounters;
+    std::vector<MotorShadow> shadow;  // For each joint
+    std::mutex shadowMutex;
+    bool shadowEnabled;
+    double shadowMaxAge;              // s, for RAM fields; EEPROM fields do not expire
+    BusScheduler scheduler;
+    double serviceSlot;               // s, bus time reserved for a service request
+    double serviceMaxWait;            // s, before a service request is refused
+    double controlReserve;            // s, kept free before the next cycle for the control loop
+    double telemetryDuration;         // s, bus time of the last telemetry read
+    std::atomic<bool> controlLoopRunning;
     int numOfConnectedMotors;
-    std::vector<bool> connectedMotors;
-    std::vector<int> directionSign;
+    std::vector<bool> connectedMotors;  // For each joint
     sensor_msgs::JointState joint_state;
     sensor_msgs::JointState goal_joint_state;
-    ros::Time timeOfLastGoalJointStatePublication;
-    int goalJointStatePublicationPeriodInMSecs;
+    usb2ax_controller::MotorTelemetry motor_telemetry;
+    usb2ax_controller::MotorMoving motor_moving;
+    TripleBuffer<StateSample> stateBuffer;  // From read() to publishState()
+    sem_t stateReady;                 // Posted by read() after each commit, never blocks it
+    double latencyPublicationPeriod;  // s, 0 to disable
+    ros::Time timeOfLastLatencyPublication;
+    DxlStats* latencySnapshot;
+    DxlStats* latencyPrevious;
 };
 
 #endif // AX_JOINT_CONTROLLER_H
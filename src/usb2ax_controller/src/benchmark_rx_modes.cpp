@@ -0,0 +1,139 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#include <sys/resource.h>
+#include "usb2ax/dynamixel_syncread.h"
+#include "usb2ax/dxl_hal.h"
+#include "ax12ControlTableMacros.h"
+
+// Compares the SPIN (busy-wait) and POLL (ppoll) receive modes of the USB2AX HAL.
+// For each mode it times a series of READ transactions to one motor, plus a few pings
+// to an unused ID to show the cost of a timeout, and reports CPU use and round-trip latency.
+//
+// Usage: benchmark_rx_modes [device index | device path] [baud num] [motor ID] [iterations] [unused ID]
+// A device path, e.g. the pty of ax_bus_simulator, is used instead of /dev/ttyACM<index>.
+// The unused ID (default 252) must not answer: not 253, which the USB2AX answers itself.
+
+
+static double monotonicSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+static double cpuSec()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1e-6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1e-6;
+}
+
+
+static void runBenchmark(const char* label, int mode, int dxlID, int iterations, int unusedID,
+                         int timeoutIterations)
+{
+    dxl_hal_set_rx_mode(mode);
+
+    // Warm up
+    for (int i = 0; i < 10; ++i)
+        dxl_read_word(dxlID, AX12_PRESENT_POSITION_L);
+
+    std::vector<double> latencies;
+    latencies.reserve(iterations);
+    int failures = 0;
+
+    double wallStart = monotonicSec();
+    double cpuStart = cpuSec();
+    for (int i = 0; i < iterations; ++i)
+    {
+        double t0 = monotonicSec();
+        dxl_read_word(dxlID, AX12_PRESENT_POSITION_L);
+        double t1 = monotonicSec();
+        if (dxl_get_result() == COMM_RXSUCCESS)
+            latencies.push_back((t1 - t0)*1e6);
+        else
+            ++failures;
+    }
+    double wall = monotonicSec() - wallStart;
+    double cpu = cpuSec() - cpuStart;
+
+    // Pings to an ID that does not exist, each of which should run into the receive timeout.
+    // Only those that did are timed.
+    double timeoutWall = 0.0, timeoutCpu = 0.0;
+    int timeouts = 0;
+    for (int i = 0; i < timeoutIterations; ++i)
+    {
+        double t0 = monotonicSec();
+        double c0 = cpuSec();
+        dxl_ping(unusedID);
+        double t1 = monotonicSec();
+        double c1 = cpuSec();
+        if (dxl_get_result() != COMM_RXTIMEOUT)
+            continue;
+        ++timeouts;
+        timeoutWall += t1 - t0;
+        timeoutCpu += c1 - c0;
+    }
+
+    printf("%s\n", label);
+    if (!latencies.empty())
+    {
+        std::sort(latencies.begin(), latencies.end());
+        double sum = 0.0;
+        for (size_t i = 0; i < latencies.size(); ++i)
+            sum += latencies[i];
+        printf("  READ round trip (us):  min %.1f  mean %.1f  p50 %.1f  p99 %.1f  max %.1f\n",
+               latencies.front(), sum/latencies.size(), latencies[latencies.size()/2],
+               latencies[(latencies.size()*99)/100], latencies.back());
+    }
+    printf("  READ transactions:     %d ok, %d failed, %.3f s wall, %.3f s CPU (%.1f%% of a core)\n",
+           (int)latencies.size(), failures, wall, cpu, (wall > 0.0) ? 100.0*cpu/wall : 0.0);
+    printf("  Timeouts:              %d of %d pings to ID %d, %.3f s wall, %.3f s CPU (%.1f%% of a core)\n",
+           timeouts, timeoutIterations, unusedID, timeoutWall, timeoutCpu,
+           (timeoutWall > 0.0) ? 100.0*timeoutCpu/timeoutWall : 0.0);
+    if (timeouts < timeoutIterations)
+        printf("  Warning: ID %d answered or failed otherwise, pick an unused ID.\n", unusedID);
+}
+
+
+int main(int argc, char **argv)
+{
+    char deviceName[100];
+    const char* device = (argc >= 2) ? argv[1] : "0";
+    int baudNum = (argc >= 3) ? atoi(argv[2]) : 1;
+    int dxlID = (argc >= 4) ? atoi(argv[3]) : 1;
+    int iterations = (argc >= 5) ? atoi(argv[4]) : 1000;
+    int unusedID = (argc >= 6) ? atoi(argv[5]) : 252;
+
+    if (device[0] == '/')
+        snprintf(deviceName, sizeof(deviceName), "%s", device);
+    else
+        snprintf(deviceName, sizeof(deviceName), "/dev/ttyACM%d", atoi(device));
+
+    if( dxl_initialize_path(deviceName, baudNum) == 0 )
+    {
+        fprintf(stderr, "Failed to open %s.\n", deviceName);
+        return -1;
+    }
+
+    dxl_ping(dxlID);
+    if (dxl_get_result() != COMM_RXSUCCESS)
+    {
+        fprintf(stderr, "Motor with ID %d did not answer ping.\n", dxlID);
+        dxl_terminate();
+        return -1;
+    }
+
+    printf("Device %s, baud num %d, motor ID %d, %d iterations, unused ID %d\n\n",
+           deviceName, baudNum, dxlID, iterations, unusedID);
+    runBenchmark("SPIN (non-blocking read loop)", DXL_HAL_RX_SPIN, dxlID, iterations, unusedID, 10);
+    runBenchmark("POLL (ppoll on receive deadline)", DXL_HAL_RX_POLL, dxlID, iterations, unusedID, 10);
+
+    dxl_terminate();
+    return 0;
+}
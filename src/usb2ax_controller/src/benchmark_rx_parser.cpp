@@ -0,0 +1,242 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <time.h>
+#include "usb2ax/dxl_ring.h"
+
+// Compares the former dxl_rx_packet() header search (byte by byte search, shift the buffer
+// down, start over on a bad packet) with the dxl_ring streaming parser.
+// Both parsers are fed the same byte stream in chunks, as read() would return them, and
+// report how many valid status packets they recovered and the time spent per byte.
+// The stream is either a raw capture of the USB2AX output, or generated: status packets of
+// the given parameter length mixed with line noise, stray 0xFF and corrupted checksums.
+//
+// Usage: benchmark_rx_parser [capture file | -] [packets] [params per packet] [chunk size]
+
+
+static double monotonicSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+static void appendStatusPacket(std::vector<unsigned char>& stream, int id, int numParams, bool corrupt)
+{
+    unsigned char checksum = 0;
+    stream.push_back(0xff);
+    stream.push_back(0xff);
+    stream.push_back(id);
+    stream.push_back(numParams + 2);
+    stream.push_back(0);  // Error
+    checksum = id + numParams + 2;
+    for (int i = 0; i < numParams; ++i)
+    {
+        unsigned char value = rand() & 0xff;
+        stream.push_back(value);
+        checksum += value;
+    }
+    checksum = ~checksum;
+    stream.push_back(corrupt ? (unsigned char)(checksum ^ 0x5a) : checksum);
+}
+
+
+static std::vector<unsigned char> generateStream(int numPackets, int numParams, int& numValid)
+{
+    std::vector<unsigned char> stream;
+    numValid = 0;
+    srand(1234);
+    for (int p = 0; p < numPackets; ++p)
+    {
+        // Line noise between packets, sometimes containing lone 0xFF bytes
+        int noise = rand() % 8;
+        for (int i = 0; i < noise; ++i)
+            stream.push_back((rand() % 4 == 0) ? 0xff : (rand() & 0xfe));
+        if (rand() % 20 == 0)
+            stream.push_back(0xff);  // 0xFF 0xFF 0xFF header
+
+        bool corrupt = (rand() % 25 == 0);
+        appendStatusPacket(stream, 1 + rand() % 18, numParams, corrupt);
+        if (!corrupt)
+            ++numValid;
+    }
+    return stream;
+}
+
+
+// Former parser, as dxl_rx_packet() did it on a 255 byte status buffer
+struct LegacyParser
+{
+    unsigned char statusPacket[256];
+    unsigned char rxPacketLength;
+    unsigned char rxGetLength;
+    bool waiting;
+
+    LegacyParser() : rxPacketLength(0), rxGetLength(0), waiting(false) {}
+
+    // Returns the number of bytes taken from the input, sets gotPacket when a valid packet ends
+    int feed(const unsigned char* pData, int numAvailable, bool& gotPacket)
+    {
+        unsigned char i, j;
+        unsigned char checksum = 0;
+        gotPacket = false;
+
+        if (!waiting)
+        {
+            rxGetLength = 0;
+            rxPacketLength = 6;
+            waiting = true;
+        }
+
+        int nRead = rxPacketLength - rxGetLength;
+        if (nRead > numAvailable)
+            nRead = numAvailable;
+        memcpy(&statusPacket[rxGetLength], pData, nRead);
+        rxGetLength += nRead;
+
+        for (i = 0; i < (rxGetLength - 1); i++)
+        {
+            if (statusPacket[i] == 0xff && statusPacket[i+1] == 0xff)
+                break;
+            else if (i == rxGetLength - 2 && statusPacket[rxGetLength - 1] == 0xff)
+                break;
+        }
+        if (i > 0)
+        {
+            for (j = 0; j < (rxGetLength - i); j++)
+                statusPacket[j] = statusPacket[j + i];
+            rxGetLength -= i;
+        }
+
+        if (rxGetLength < rxPacketLength)
+            return nRead;
+
+        rxPacketLength = statusPacket[3] + 4;
+        if (rxGetLength < rxPacketLength)
+            return nRead;
+
+        // The former loop counter was an unsigned char too, which never ends on a LENGTH of 255
+        for (int k = 0; k < (statusPacket[3] + 1); k++)
+            checksum += statusPacket[(k + 2) & 0xff];
+        checksum = ~checksum;
+
+        // Either way the transaction ends here, and any partial progress is dropped
+        waiting = false;
+        gotPacket = (statusPacket[statusPacket[3] + 3] == checksum);
+        return nRead;
+    }
+};
+
+
+static void runLegacy(const std::vector<unsigned char>& stream, int chunk, int repeat)
+{
+    int found = 0;
+    double t0 = monotonicSec();
+    for (int r = 0; r < repeat; ++r)
+    {
+        LegacyParser parser;
+        size_t pos = 0;
+        while (pos < stream.size())
+        {
+            size_t end = pos + chunk;
+            if (end > stream.size())
+                end = stream.size();
+            // Like the driver, ask for bytes until this chunk is used up
+            while (pos < end)
+            {
+                bool gotPacket;
+                pos += parser.feed(&stream[pos], end - pos, gotPacket);
+                if (gotPacket)
+                    ++found;
+            }
+        }
+    }
+    double elapsed = monotonicSec() - t0;
+    printf("  legacy shift parser:  %7d packets, %8.2f ns/byte, %8.1f ns/packet\n",
+           found/repeat, elapsed*1e9/((double)stream.size()*repeat),
+           (found > 0) ? elapsed*1e9/found : 0.0);
+}
+
+
+static void runRing(const std::vector<unsigned char>& stream, int chunk, int repeat)
+{
+    static DxlRing ring;
+    int found = 0;
+    unsigned int skipped = 0, checksumErrors = 0;
+    double t0 = monotonicSec();
+    for (int r = 0; r < repeat; ++r)
+    {
+        dxl_ring_init(&ring);
+        size_t pos = 0;
+        while (pos < stream.size())
+        {
+            int n = chunk;
+            if (n > (int)(stream.size() - pos))
+                n = stream.size() - pos;
+            pos += dxl_ring_write(&ring, &stream[pos], n);
+
+            DxlRingPacket packet;
+            while (dxl_ring_parse(&ring, &packet) == DXL_RING_PACKET)
+                ++found;
+        }
+        skipped = ring.nSkipped;
+        checksumErrors = ring.nChecksumErrors;
+    }
+    double elapsed = monotonicSec() - t0;
+    printf("  ring streaming parser: %6d packets, %8.2f ns/byte, %8.1f ns/packet (%u bytes skipped, %u bad checksums)\n",
+           found/repeat, elapsed*1e9/((double)stream.size()*repeat),
+           (found > 0) ? elapsed*1e9/found : 0.0, skipped, checksumErrors);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char* captureFile = (argc >= 2) ? argv[1] : "-";
+    int numPackets = (argc >= 3) ? atoi(argv[2]) : 10000;
+    int numParams = (argc >= 4) ? atoi(argv[3]) : 36;  // 18 motors x 2 bytes, as a USB2AX sync_read
+    int chunk = (argc >= 5) ? atoi(argv[4]) : 32;
+
+    std::vector<unsigned char> stream;
+    int numValid = -1;
+    if (strcmp(captureFile, "-") != 0)
+    {
+        FILE* f = fopen(captureFile, "rb");
+        if (f == NULL)
+        {
+            fprintf(stderr, "Could not open %s.\n", captureFile);
+            return -1;
+        }
+        unsigned char buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+            stream.insert(stream.end(), buffer, buffer + n);
+        fclose(f);
+    }
+    else
+    {
+        if (numParams < 0 || numParams > 249)
+        {
+            fprintf(stderr, "Params per packet must be between 0 and 249.\n");
+            return -1;
+        }
+        stream = generateStream(numPackets, numParams, numValid);
+    }
+    if (stream.empty() || chunk <= 0)
+    {
+        fprintf(stderr, "Nothing to parse.\n");
+        return -1;
+    }
+
+    // Repeat short streams so that the timings are meaningful
+    int repeat = 1 + 20000000/stream.size();
+
+    printf("%d bytes in chunks of %d, %d repetitions", (int)stream.size(), chunk, repeat);
+    if (numValid >= 0)
+        printf(", %d valid packets in the stream", numValid);
+    printf("\n");
+    runLegacy(stream, chunk, repeat);
+    runRing(stream, chunk, repeat);
+    return 0;
+}
@@ -1,20 +1,54 @@
 #include "bioloidhw.h"
+#include <limits>
+#include <set>
+#include <utility>
 
 
 BioloidHw::BioloidHw(std::vector<std::string> jointNames) :
     N(jointNames.size()), name(jointNames),
-    cmd(N, 0.0), pos(N, 0.0), vel(N, 0.0), eff(N, 0.0), stateHandles(N), posHandles(N)
+    cmd(N, 0.0), velCmd(N, std::numeric_limits<double>::quiet_NaN()),
+    effCmd(N, std::numeric_limits<double>::quiet_NaN()), pos(N, 0.0), vel(N, 0.0), eff(N, 0.0),
+    stateHandles(N), posHandles(N), velHandles(N), effHandles(N)
 {
-    // Connect and register the joint state and position interfaces
+    // Connect and register the joint state, position, and speed and torque limit interfaces
     for (int i = 0; i < N; ++i)
     {
         stateHandles[i] = new hardware_interface::JointStateHandle(name[i], &pos[i], &vel[i], &eff[i]);
         jointStateInterface.registerHandle(*stateHandles[i]);
         posHandles[i] = new hardware_interface::JointHandle(jointStateInterface.getHandle(name[i]), &cmd[i]);
         jointPosInterface.registerHandle(*posHandles[i]);
+        velHandles[i] = new hardware_interface::JointHandle(jointStateInterface.getHandle(name[i]), &velCmd[i]);
+        jointVelInterface.registerHandle(*velHandles[i]);
+        effHandles[i] = new hardware_interface::JointHandle(jointStateInterface.getHandle(name[i]), &effCmd[i]);
+        jointEffInterface.registerHandle(*effHandles[i]);
     }
     registerInterface(&jointStateInterface);
     registerInterface(&jointPosInterface);
+    registerInterface(&jointVelInterface);
+    registerInterface(&jointEffInterface);
+}
+
+
+bool BioloidHw::checkForConflict(const std::list<hardware_interface::ControllerInfo>& info) const
+{
+    // The three command interfaces are separate channels of a joint, so one controller may drive
+    // the position while another one shapes the speed or the compliance. Only two controllers
+    // claiming the same joint on the same interface conflict.
+    std::set<std::pair<std::string, std::string> > claimed;
+    for (std::list<hardware_interface::ControllerInfo>::const_iterator it = info.begin(); it != info.end(); ++it)
+    {
+        for (int k = 0; k < it->claimed_resources.size(); ++k)
+        {
+            const hardware_interface::InterfaceResources& resources = it->claimed_resources[k];
+            for (std::set<std::string>::const_iterator r = resources.resources.begin();
+                 r != resources.resources.end(); ++r)
+            {
+                if (!claimed.insert(std::make_pair(resources.hardware_interface, *r)).second)
+                    return true;
+            }
+        }
+    }
+    return false;
 }
 
 
@@ -34,6 +68,24 @@ void BioloidHw::setCmd(const int& i, const double& value)
 }
 
 
+double BioloidHw::getVelCmd(const int &i) const
+{
+    if (( i >= 0) && (i < velCmd.size()) )
+        return velCmd[i];
+    else
+        return std::numeric_limits<double>::quiet_NaN();
+}
+
+
+double BioloidHw::getEffCmd(const int &i) const
+{
+    if (( i >= 0) && (i < effCmd.size()) )
+        return effCmd[i];
+    else
+        return std::numeric_limits<double>::quiet_NaN();
+}
+
+
 double BioloidHw::getPos(const int &i) const
 {
     if (( i >= 0) && (i < pos.size()) )
@@ -1,36 +1,49 @@
 #ifndef BIOLOIDHW_H
 #define BIOLOIDHW_H
 
+#include <list>
 #include <string>
 #include <vector>
 #include <hardware_interface/robot_hw.h>
 #include <hardware_interface/joint_state_interface.h>
 #include <hardware_interface/joint_command_interface.h>
 
+// Position command of each joint, and two limits a controller may command along with it:
+// the moving speed (VelocityJointInterface, rad/s) and the torque limit (EffortJointInterface,
+// fraction of the max torque). A limit stays NaN until a controller commands it.
 class BioloidHw : public hardware_interface::RobotHW
 {
 public:
     BioloidHw(std::vector<std::string> jointNames);
     double getCmd(const int& i) const;
     void setCmd(const int& i, const double& value);
+    double getVelCmd(const int& i) const;
+    double getEffCmd(const int& i) const;
     double getPos(const int& i) const;
     void setPos(const int& i, const double& value);
     double getVel(const int& i) const;
     void setVel(const int& i, const double& value);
     double getEff(const int& i) const;
     void setEff(const int& i, const double& value);
+    virtual bool checkForConflict(const std::list<hardware_interface::ControllerInfo>& info) const;
 
 private:
     int N;
     std::vector<std::string> name;
     std::vector<double> cmd;
+    std::vector<double> velCmd;
+    std::vector<double> effCmd;
     std::vector<double> pos;
     std::vector<double> vel;
     std::vector<double> eff;
     std::vector<hardware_interface::JointStateHandle*> stateHandles;
     std::vector<hardware_interface::JointHandle*> posHandles;
+    std::vector<hardware_interface::JointHandle*> velHandles;
+    std::vector<hardware_interface::JointHandle*> effHandles;
     hardware_interface::JointStateInterface jointStateInterface;
     hardware_interface::PositionJointInterface jointPosInterface;
+    hardware_interface::VelocityJointInterface jointVelInterface;
+    hardware_interface::EffortJointInterface jointEffInterface;
 };
 
 #endif // BIOLOIDHW_H
@@ -0,0 +1,111 @@
+#include "bus_scheduler.h"
+#include <algorithm>
+
+
+BusScheduler::BusScheduler() :
+    busy(false),
+    depth(0),
+    slackSet(false)
+{
+    for (int p = 0; p < NUM_PRIORITIES; ++p)
+    {
+        waiting[p] = 0;
+        numRefused[p] = 0;
+    }
+}
+
+
+bool BusScheduler::fits(Priority priority, double estimatedSec, const Clock::time_point& now) const
+{
+    if ( (priority == CONTROL) || !slackSet )
+        return true;
+    return now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(estimatedSec)) <= slackEnd;
+}
+
+
+bool BusScheduler::acquire(Priority priority, double estimatedSec, double maxWaitSec)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    const std::thread::id self = std::this_thread::get_id();
+    if (busy && (owner == self))
+    {
+        ++depth;
+        return true;
+    }
+
+    const Clock::time_point deadline = Clock::now() +
+            std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(std::max(maxWaitSec, 0.0)));
+    ++waiting[priority];
+    while (true)
+    {
+        const Clock::time_point now = Clock::now();
+        bool higherWaiting = false;
+        for (int p = 0; p < priority; ++p)
+            higherWaiting = higherWaiting || (waiting[p] > 0);
+        bool inSlack = fits(priority, estimatedSec, now);
+        if (!busy && !higherWaiting && inSlack)
+            break;
+
+        // The control thread itself cannot wait for the next slack: it is the one opening it
+        bool hopeless = !inSlack && (self == controlThread);
+        if ( hopeless || ((maxWaitSec >= 0.0) && (now >= deadline)) )
+        {
+            --waiting[priority];
+            ++numRefused[priority];
+            cond.notify_all();
+            return false;
+        }
+        if (maxWaitSec >= 0.0)
+            cond.wait_until(lock, deadline);
+        else
+            cond.wait(lock);
+    }
+    --waiting[priority];
+    busy = true;
+    owner = self;
+    depth = 1;
+    return true;
+}
+
+
+void BusScheduler::release()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--depth > 0)
+        return;
+    busy = false;
+    owner = std::thread::id();
+    cond.notify_all();
+}
+
+
+void BusScheduler::setSlack(double slackSec)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    slackSet = true;
+    slackEnd = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(slackSec));
+    controlThread = std::this_thread::get_id();
+    cond.notify_all();
+}
+
+
+unsigned int BusScheduler::getNumRefused(Priority priority) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return numRefused[priority];
+}
+
+
+BusGrant::BusGrant(BusScheduler& scheduler, BusScheduler::Priority priority, double estimatedSec,
+                   double maxWaitSec) :
+    scheduler(scheduler),
+    isGranted(scheduler.acquire(priority, estimatedSec, maxWaitSec))
+{
+}
+
+
+BusGrant::~BusGrant()
+{
+    if (isGranted)
+        scheduler.release();
+}
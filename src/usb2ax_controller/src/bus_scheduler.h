@@ -0,0 +1,67 @@
+#ifndef BUS_SCHEDULER_H
+#define BUS_SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Arbitration of the buses between the control loop, service requests and diagnostics.
+// One transaction at a time holds the buses: a sequence of packets that must not be interleaved
+// with others, e.g. a split-phase sync_read and its reply. Waiting transactions are granted by
+// priority class. Below the control class, a transaction is only granted if its estimated
+// duration fits in the slack the control loop has left in its cycle (see setSlack()).
+// A thread that holds the buses may acquire them again, e.g. a service calling another one.
+class BusScheduler
+{
+public:
+    enum Priority
+    {
+        CONTROL = 0,      // Sync read / write of the control loop
+        SERVICE = 1,      // User requests
+        DIAGNOSTIC = 2,   // Telemetry, probes of dropped motors
+        NUM_PRIORITIES = 3
+    };
+
+    BusScheduler();
+    // Blocks until the buses are granted. maxWaitSec < 0 waits forever; returns false if the
+    // transaction could not be granted in time.
+    bool acquire(Priority priority, double estimatedSec, double maxWaitSec);
+    void release();
+    // Called by the control loop when its bus work for the cycle is done: the lower classes
+    // may use the buses for slackSec. Until the first call, they are not limited.
+    void setSlack(double slackSec);
+    unsigned int getNumRefused(Priority priority) const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    bool fits(Priority priority, double estimatedSec, const Clock::time_point& now) const;
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+    bool busy;
+    std::thread::id owner;
+    int depth;
+    int waiting[NUM_PRIORITIES];
+    unsigned int numRefused[NUM_PRIORITIES];
+    bool slackSet;
+    Clock::time_point slackEnd;
+    std::thread::id controlThread;    // The thread that calls setSlack()
+};
+
+// Holds the buses for its scope
+class BusGrant
+{
+public:
+    BusGrant(BusScheduler& scheduler, BusScheduler::Priority priority, double estimatedSec = 0.0,
+             double maxWaitSec = -1.0);
+    ~BusGrant();
+    bool granted() const {return isGranted;}
+
+private:
+    BusGrant(const BusGrant&);
+    BusGrant& operator=(const BusGrant&);
+    BusScheduler& scheduler;
+    bool isGranted;
+};
+
+#endif // BUS_SCHEDULER_H
@@ -0,0 +1,102 @@
+#include "bus_workers.h"
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+
+BusWorkers::BusWorkers() :
+    numPending(0),
+    quit(false)
+{
+}
+
+
+BusWorkers::~BusWorkers()
+{
+    stop();
+}
+
+
+void BusWorkers::start(int numBuses)
+{
+    stop();
+    quit = false;
+    jobs.assign(numBuses, NULL);
+    for (int b = 0; b < numBuses; ++b)
+        threads.push_back(std::thread(&BusWorkers::work, this, b));
+}
+
+
+void BusWorkers::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+        workCond.notify_all();
+    }
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it)
+        it->join();
+    threads.clear();
+}
+
+
+void BusWorkers::run(const std::vector<int>& busIndices, const std::function<void(int)>& fn)
+{
+    if (busIndices.empty())
+        return;
+
+    std::vector<int> inTurn;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int k = 1; k < busIndices.size(); ++k)
+        {
+            int b = busIndices[k];
+            if ( (b < 0) || (b >= threads.size()) )
+            {
+                inTurn.push_back(b);
+                continue;
+            }
+            jobs[b] = &fn;
+            ++numPending;
+        }
+        if (numPending > 0)
+            workCond.notify_all();
+    }
+    fn(busIndices[0]);
+    for (int k = 0; k < inTurn.size(); ++k)
+        fn(inTurn[k]);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCond.wait(lock, [this]() {return numPending == 0;});
+}
+
+
+bool BusWorkers::setRealtimePriority(int priority)
+{
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    bool success = true;
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it)
+        success = (pthread_setschedparam(it->native_handle(), SCHED_FIFO, &param) == 0) && success;
+    return success;
+}
+
+
+void BusWorkers::work(int busIndex)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        workCond.wait(lock, [this, busIndex]() {return quit || (jobs[busIndex] != NULL);});
+        if (quit)
+            return;
+        const std::function<void(int)>* job = jobs[busIndex];
+        lock.unlock();
+        (*job)(busIndex);
+        lock.lock();
+        jobs[busIndex] = NULL;
+        if (--numPending == 0)
+            doneCond.notify_one();
+    }
+}
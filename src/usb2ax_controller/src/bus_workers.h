@@ -0,0 +1,40 @@
+#ifndef BUS_WORKERS_H
+#define BUS_WORKERS_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// One long-lived thread per bus, for the transactions that run on several buses at once.
+// Starting a thread per bus and transaction would cost thread creations in every cycle, and in
+// realtime mode new stacks to lock. The calling thread serves the first bus itself.
+// One run() at a time: its callers hold the buses (see BusGrant).
+class BusWorkers
+{
+public:
+    BusWorkers();
+    ~BusWorkers();
+    void start(int numBuses);
+    void stop();
+    // Runs fn(b) for each bus b of busIndices concurrently and returns when all are done.
+    // Before start(), they run in turn on the calling thread.
+    void run(const std::vector<int>& busIndices, const std::function<void(int)>& fn);
+    // SCHED_FIFO priority of the workers, as that of the control loop; false if it could not be set
+    bool setRealtimePriority(int priority);
+
+private:
+    BusWorkers(const BusWorkers&);
+    BusWorkers& operator=(const BusWorkers&);
+    void work(int busIndex);
+    std::mutex mutex;
+    std::condition_variable workCond;   // A job was posted, or stop()
+    std::condition_variable doneCond;   // The last job of a run() is done
+    std::vector<std::thread> threads;   // For each bus
+    std::vector<const std::function<void(int)>*> jobs;  // For each bus, NULL when idle
+    int numPending;
+    bool quit;
+};
+
+#endif // BUS_WORKERS_H
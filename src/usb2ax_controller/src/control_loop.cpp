@@ -0,0 +1,233 @@
+#include "control_loop.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include "ax_joint_controller.h"
+
+namespace
+{
+
+const char* phaseNames[ControlLoop::NUM_PHASES] = {"read", "update", "write", "slack", "prefetch", "publish"};
+
+long long monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+void sleepUntilNs(long long deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline/1000000000LL;
+    ts.tv_nsec = deadline%1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+}  // namespace
+
+
+ControlLoop::ControlLoop(JointController& jointController) :
+    jointController(jointController),
+    rate(50.0),
+    realtime(false),
+    realtimePriority(80),
+    cpu(-1),
+    callbackThreads(2),
+    statisticsPeriod(1.0)
+{
+    resetStatistics();
+}
+
+
+void ControlLoop::setRealtime(bool enabled, int priority, int cpu)
+{
+    realtime = enabled;
+    realtimePriority = priority;
+    this->cpu = cpu;
+}
+
+
+void ControlLoop::run()
+{
+    // No page faults in the loop: lock what is mapped now and all that will be
+    if ( realtime && (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) )
+        ROS_WARN("Could not lock the memory of the controller: %s.", strerror(errno));
+
+    // The loop thread is the only one on the buses during the control phases. The ROS callbacks
+    // (services, command topic and actions) run in the spinner threads and get the buses in the
+    // slack of the cycles (see BusScheduler); a slow one only holds up the other callbacks.
+    std::thread loopThread([this]()
+    {
+        if (realtime)
+            configureThread();
+        loop();
+    });
+    std::thread publicationThread([this]()
+    {
+        while (ros::ok())
+            jointController.publishState(1.0/rate);
+    });
+    ros::AsyncSpinner spinner(std::max(callbackThreads, 1));
+    spinner.start();
+    ros::waitForShutdown();
+    loopThread.join();
+    publicationThread.join();
+}
+
+
+void ControlLoop::configureThread()
+{
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = std::min(std::max(realtimePriority, sched_get_priority_min(SCHED_FIFO)),
+                                    sched_get_priority_max(SCHED_FIFO));
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0)
+        ROS_WARN("Could not run the control loop with SCHED_FIFO priority %d: %s. "
+                 "Check the rtprio limit of the user.", param.sched_priority, strerror(error));
+    else
+        ROS_INFO("Control loop running with SCHED_FIFO priority %d.", param.sched_priority);
+
+    // The bus workers run the loop's transactions on the other buses: same priority
+    if ( (error == 0) && !jointController.setBusWorkersRealtimePriority(param.sched_priority) )
+        ROS_WARN("Could not run the bus workers with SCHED_FIFO priority %d.", param.sched_priority);
+
+    if (cpu >= 0)
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu, &cpuSet);
+        error = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        if (error != 0)
+            ROS_WARN("Could not pin the control loop to CPU %d: %s.", cpu, strerror(error));
+        else
+            ROS_INFO("Control loop pinned to CPU %d.", cpu);
+    }
+}
+
+
+void ControlLoop::loop()
+{
+    const long long periodNs = std::llround(1e9/rate);
+    long long deadline = monotonicNs();
+    long long previousStart = -1;
+    ros::Time prevTime = ros::Time::now();
+    ros::Time timeOfLastPublication = prevTime;
+    jointController.setControlLoopRunning(true);
+    while (ros::ok())
+    {
+        long long t[NUM_PHASES + 1];
+        t[0] = monotonicNs();
+        const ros::Time currentTime = ros::Time::now();
+        const ros::WallTime cycleStart = ros::WallTime::now();
+
+        jointController.read();
+        t[READ + 1] = monotonicNs();
+        jointController.cm->update(currentTime, currentTime - prevTime);
+        t[UPDATE + 1] = monotonicNs();
+        jointController.write();
+        t[WRITE + 1] = monotonicNs();
+        jointController.openSlack(cycleStart, 1.0/rate);
+        jointController.probeDroppedMotors();
+        jointController.readTelemetry();
+        t[SLACK + 1] = monotonicNs();
+        jointController.prefetchRead();
+        t[PREFETCH + 1] = monotonicNs();
+        jointController.publishBusLatency();
+        t[PUBLISH + 1] = monotonicNs();
+        prevTime = currentTime;
+
+        // Statistics, in us
+        ++numCycles;
+        wakeupLatencyMax = std::max(wakeupLatencyMax, (t[0] - deadline)/1000.0);
+        if (previousStart >= 0)
+        {
+            double period = (t[0] - previousStart)/1000.0;
+            ++numPeriods;
+            periodSum += period;
+            periodSquareSum += period*period;
+            periodMin = std::min(periodMin, period);
+            periodMax = std::max(periodMax, period);
+        }
+        previousStart = t[0];
+        for (int p = 0; p < NUM_PHASES; ++p)
+        {
+            double duration = (t[p + 1] - t[p])/1000.0;
+            phaseSum[p] += duration;
+            phaseMax[p] = std::max(phaseMax[p], duration);
+        }
+        if ( (statisticsPeriod > 0.0) && ((currentTime - timeOfLastPublication).toSec() >= statisticsPeriod) )
+        {
+            publishStatistics(currentTime);
+            timeOfLastPublication = currentTime;
+        }
+
+        // After an overrun, start again on the next deadline to come rather than catching up
+        deadline += periodNs;
+        const long long end = monotonicNs();
+        if (end > deadline)
+        {
+            ++numOverruns;
+            long long missed = (end - deadline)/periodNs + 1;
+            numMissedDeadlines += missed;
+            deadline += missed*periodNs;
+        }
+        sleepUntilNs(deadline);
+    }
+    jointController.setControlLoopRunning(false);
+}
+
+
+void ControlLoop::resetStatistics()
+{
+    numCycles = 0;
+    numPeriods = 0;
+    numOverruns = 0;
+    numMissedDeadlines = 0;
+    periodSum = 0.0;
+    periodSquareSum = 0.0;
+    periodMin = 1e12;
+    periodMax = 0.0;
+    wakeupLatencyMax = 0.0;
+    for (int p = 0; p < NUM_PHASES; ++p)
+    {
+        phaseSum[p] = 0.0;
+        phaseMax[p] = 0.0;
+    }
+}
+
+
+void ControlLoop::publishStatistics(const ros::Time& stamp)
+{
+    usb2ax_controller::LoopStatistics msg;
+    msg.header.stamp = stamp;
+    msg.rate = rate;
+    msg.realtime = realtime;
+    msg.cycles = numCycles;
+    msg.overruns = numOverruns;
+    msg.missed_deadlines = numMissedDeadlines;
+    if (numPeriods > 0)
+    {
+        double mean = periodSum/numPeriods;
+        msg.period_mean_us = mean;
+        msg.period_min_us = periodMin;
+        msg.period_max_us = periodMax;
+        msg.jitter_us = std::sqrt(std::max(periodSquareSum/numPeriods - mean*mean, 0.0));
+    }
+    msg.wakeup_latency_max_us = wakeupLatencyMax;
+    for (int p = 0; p < NUM_PHASES; ++p)
+    {
+        msg.phases.push_back(phaseNames[p]);
+        msg.phase_mean_us.push_back((numCycles > 0) ? phaseSum[p]/numCycles : 0.0);
+        msg.phase_max_us.push_back(phaseMax[p]);
+    }
+    statisticsPub.publish(msg);
+    resetStatistics();
+}
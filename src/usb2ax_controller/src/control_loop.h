@@ -0,0 +1,66 @@
+#ifndef CONTROL_LOOP_H
+#define CONTROL_LOOP_H
+
+#include <time.h>
+#include "ros/ros.h"
+#include "usb2ax_controller/LoopStatistics.h"
+
+class JointController;
+
+// The control loop of ax_joint_controller: read, controller update, write, then the work that fits
+// in the slack of the cycle. Cycles start on absolute deadlines of CLOCK_MONOTONIC, so that the
+// time spent in a cycle does not shift the next ones. The cycles run in a dedicated bus I/O thread,
+// SCHED_FIFO with memory locked in realtime mode. The ROS callbacks are served by a pool of other
+// threads, and the joint states are published from another one, so that neither delays a cycle.
+class ControlLoop
+{
+public:
+    enum Phase
+    {
+        READ = 0,
+        UPDATE,
+        WRITE,
+        SLACK,      // Probes of dropped motors and telemetry
+        PREFETCH,
+        PUBLISH,    // Bus latency publication
+        NUM_PHASES
+    };
+
+    explicit ControlLoop(JointController& jointController);
+    double getRate() const {return rate;}
+    void setRate(double value) {rate = value;}
+    void setRealtime(bool enabled, int priority, int cpu);
+    int getCallbackThreads() const {return callbackThreads;}
+    void setCallbackThreads(int value) {callbackThreads = value;}
+    void setStatisticsPeriod(double value) {statisticsPeriod = value;}
+    // Runs until ROS shuts down
+    void run();
+    ros::Publisher statisticsPub;
+
+private:
+    void loop();
+    void configureThread();
+    void resetStatistics();
+    void publishStatistics(const ros::Time& stamp);
+    JointController& jointController;
+    double rate;                // Hz
+    bool realtime;
+    int realtimePriority;       // SCHED_FIFO priority
+    int cpu;                    // CPU of the loop thread, -1 for any
+    int callbackThreads;        // Threads serving the ROS callbacks
+    double statisticsPeriod;    // s, 0 to disable
+    // Statistics since the last publication, in us
+    unsigned int numCycles;
+    unsigned int numPeriods;
+    unsigned int numOverruns;
+    unsigned int numMissedDeadlines;
+    double periodSum;
+    double periodSquareSum;
+    double periodMin;
+    double periodMax;
+    double wakeupLatencyMax;
+    double phaseSum[NUM_PHASES];
+    double phaseMax[NUM_PHASES];
+};
+
+#endif // CONTROL_LOOP_H
@@ -2,6 +2,7 @@
 #include "ros/ros.h"
 #include <tf/transform_listener.h>
 #include "std_srvs/Empty.h"
+#include "sensor_msgs/JointState.h"
 #include "usb2ax_controller/SetMotorParam.h"
 #include "simplePID.h"
 #include <deque>
@@ -24,6 +25,9 @@ int main(int argc, char **argv)
             n.serviceClient<usb2ax_controller::SetMotorParam>("SetMotorGoalSpeedInRadPerSec");
     ros::ServiceClient homeAllMotorsClient =
             n.serviceClient<std_srvs::Empty>("HomeAllMotors");
+    // Commands of the control loop, streamed rather than one blocking service call per joint
+    ros::Publisher jointCommandPub =
+            n.advertise<sensor_msgs::JointState>("ax_joint_commands", 10);
 
     //usb2ax_controller::GetMotorParam getMotorParamSrv;
     usb2ax_controller::SetMotorParam setMotorParamSrv;
@@ -98,6 +102,13 @@ int main(int argc, char **argv)
         SMA_window.push_back(0.0);
     float SMA_newValue, SMA_oldValue;
 
+    // Ankle swing joints
+    sensor_msgs::JointState jointCommand;
+    jointCommand.name.push_back("right_ankle_swing_joint");
+    jointCommand.name.push_back("left_ankle_swing_joint");
+    jointCommand.position.resize(2);
+    jointCommand.velocity.resize(2);
+
     while (n.ok())
     {
         //int i = getch();
@@ -132,20 +143,15 @@ int main(int argc, char **argv)
 
         if ( fabs(output) >= 0.0116 )
         {
-            // Set motor speeds - ankle swing joints
-            setMotorParamSrv.request.value = output;
-            setMotorParamSrv.request.dxlID = 15;
-            setMotorGoalSpeedInRadPerSecClient.call(setMotorParamSrv);
-            setMotorParamSrv.request.dxlID = 16;
-            setMotorGoalSpeedInRadPerSecClient.call(setMotorParamSrv);
-
-            // Set motor outputs - ankle swing joints
+            // Set motor speeds and outputs - ankle swing joints
             position = -PV;
-            setMotorParamSrv.request.value = position;
-            setMotorParamSrv.request.dxlID = 15;
-            setMotorGoalPositionInRadClient.call(setMotorParamSrv);
-            setMotorParamSrv.request.dxlID = 16;
-            setMotorGoalPositionInRadClient.call(setMotorParamSrv);
+            jointCommand.header.stamp = ros::Time::now();
+            for (int i=0; i<2; ++i)
+            {
+                jointCommand.position[i] = position;
+                jointCommand.velocity[i] = output;
+            }
+            jointCommandPub.publish(jointCommand);
 
             std::cout << "pitch angle: " << PV;
             std::cout << "\t output speed: " << output;
@@ -0,0 +1,48 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Latest-value hand-over between one writer thread and one reader thread, without locks.
+// The writer fills its slot and commits it; the reader takes the last committed slot, if any is
+// newer than its own. Neither side ever waits for the other: the third slot always stands between
+// them, and a value the reader did not take in time is overwritten by the next one.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : writeIndex(0), readIndex(1), middle(2) {}
+
+    // Writer side
+    T& writeBuffer() {return slots[writeIndex];}
+    void commit()
+    {
+        writeIndex = middle.exchange(writeIndex | FRESH) & INDEX_MASK;
+    }
+
+    // Reader side. fetch() returns false, and keeps the current slot, if nothing new was committed.
+    bool fresh() const {return (middle.load() & FRESH) != 0;}
+    bool fetch()
+    {
+        if (!fresh())
+            return false;
+        readIndex = middle.exchange(readIndex) & INDEX_MASK;
+        return true;
+    }
+    const T& readBuffer() const {return slots[readIndex];}
+
+private:
+    enum
+    {
+        INDEX_MASK = 3,
+        FRESH = 4       // The middle slot was committed and not fetched yet
+    };
+    TripleBuffer(const TripleBuffer&);
+    TripleBuffer& operator=(const TripleBuffer&);
+    T slots[3];
+    int writeIndex;
+    int readIndex;
+    std::atomic<int> middle;
+};
+
+#endif // TRIPLE_BUFFER_H
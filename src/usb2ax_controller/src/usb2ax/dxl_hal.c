@@ -4,37 +4,56 @@ Modification of the HAL of the Dynamixel SDK to be used with USB2AX.
 Nicolas Saugnier
 */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <termios.h>
 #include <linux/serial.h>
 #include <sys/ioctl.h>
-#include <sys/time.h>
 
 #include "dxl_hal.h"
 
-int	gSocket_fd	= -1;
-long	glStartTime	= 0;
-float	gfRcvWaitTime	= 0.0f;
-float	gfByteTransTime	= 0.0f;
+DxlPort	gDefaultPort	= { -1, 0, 0.0f, 0.0f, DXL_HAL_RX_POLL, "" };
 
-char	gDeviceName[20];
+void dxl_port_init( DxlPort *port )
+{
+	memset(port, 0, sizeof(DxlPort));
+	port->fd = -1;
+	port->rxMode = DXL_HAL_RX_POLL;
+}
 
-int dxl_hal_open(int deviceIndex, float baudrate)
+int dxl_port_open( DxlPort *port, int deviceIndex, float baudrate )
 {
-	struct termios newtio;
-	//struct serial_struct serinfo;
 	char dev_name[100] = {0, };
 
 	sprintf(dev_name, "/dev/ttyACM%d", deviceIndex); // USB2AX is ttyACM
 
-	strcpy(gDeviceName, dev_name);
+	return dxl_port_open_path(port, dev_name, baudrate);
+}
+
+// Any tty given by its path, e.g. the pty of ax_bus_simulator
+int dxl_port_open_path( DxlPort *port, const char *dev_name, float baudrate )
+{
+	struct termios newtio;
+	//struct serial_struct serinfo;
+
+	if( strlen(dev_name) >= sizeof(port->deviceName) )
+	{
+		fprintf(stderr, "device name too long: %s\n", dev_name);
+		return 0;
+	}
+
+	strcpy(port->deviceName, dev_name);
 	memset(&newtio, 0, sizeof(newtio));
-	dxl_hal_close();
+	dxl_port_close(port);
 	
-	if((gSocket_fd = open(gDeviceName, O_RDWR|O_NOCTTY|O_NONBLOCK)) < 0) {
+	if((port->fd = open(port->deviceName, O_RDWR|O_NOCTTY|O_NONBLOCK)) < 0) {
 		fprintf(stderr, "device open error: %s\n", dev_name);
 		goto DXL_HAL_OPEN_ERROR;
 	}
@@ -46,15 +65,15 @@ int dxl_hal_open(int deviceIndex, float baudrate)
 	newtio.c_cc[VTIME]	= 0;	// time-out 값 (TIME * 0.1초) 0 : disable
 	newtio.c_cc[VMIN]	= 0;	// MIN 은 read 가 return 되기 위한 최소 문자 개수
 
-	tcflush(gSocket_fd, TCIFLUSH);
-	tcsetattr(gSocket_fd, TCSANOW, &newtio);
+	tcflush(port->fd, TCIFLUSH);
+	tcsetattr(port->fd, TCSANOW, &newtio);
 	
-	if(gSocket_fd == -1)
+	if(port->fd == -1)
 		return 0;
         
 	//USB2AX uses the CDC ACM driver for which these settings do not exist.
     /*
-	if(ioctl(gSocket_fd, TIOCGSERIAL, &serinfo) < 0) {
+	if(ioctl(port->fd, TIOCGSERIAL, &serinfo) < 0) {
 		fprintf(stderr, "Cannot get serial info\n");
 		return 0;
 	}
@@ -63,20 +82,20 @@ int dxl_hal_open(int deviceIndex, float baudrate)
 	serinfo.flags |= ASYNC_SPD_CUST;
 	serinfo.custom_divisor = serinfo.baud_base / baudrate;
 	
-	if(ioctl(gSocket_fd, TIOCSSERIAL, &serinfo) < 0) {
+	if(ioctl(port->fd, TIOCSSERIAL, &serinfo) < 0) {
 		fprintf(stderr, "Cannot set serial info\n");
 		return 0;
 	}*/
 	
-	dxl_hal_close();
+	dxl_port_close(port);
 	
-	gfByteTransTime = (float)((1000.0f / baudrate) * 12.0f);
+	port->byteTransTime = (float)((1000.0f / baudrate) * 12.0f);
 	
-	strcpy(gDeviceName, dev_name);
+	strcpy(port->deviceName, dev_name);
 	memset(&newtio, 0, sizeof(newtio));
-	dxl_hal_close();
+	dxl_port_close(port);
 	
-	if((gSocket_fd = open(gDeviceName, O_RDWR|O_NOCTTY|O_NONBLOCK)) < 0) {
+	if((port->fd = open(port->deviceName, O_RDWR|O_NOCTTY|O_NONBLOCK)) < 0) {
 		fprintf(stderr, "device open error: %s\n", dev_name);
 		goto DXL_HAL_OPEN_ERROR;
 	}
@@ -88,33 +107,33 @@ int dxl_hal_open(int deviceIndex, float baudrate)
 	newtio.c_cc[VTIME]	= 0;	// time-out 값 (TIME * 0.1초) 0 : disable
 	newtio.c_cc[VMIN]	= 0;	// MIN 은 read 가 return 되기 위한 최소 문자 개수
 
-	tcflush(gSocket_fd, TCIFLUSH);
-	tcsetattr(gSocket_fd, TCSANOW, &newtio);
+	tcflush(port->fd, TCIFLUSH);
+	tcsetattr(port->fd, TCSANOW, &newtio);
 	
 	return 1;
 
 DXL_HAL_OPEN_ERROR:
-	dxl_hal_close();
+	dxl_port_close(port);
 	return 0;
 }
 
-void dxl_hal_close()
+void dxl_port_close( DxlPort *port )
 {
-	if(gSocket_fd != -1)
-		close(gSocket_fd);
-	gSocket_fd = -1;
+	if(port->fd != -1)
+		close(port->fd);
+	port->fd = -1;
 }
 
-int dxl_hal_set_baud( float baudrate )
+int dxl_port_set_baud( DxlPort *port, float baudrate )
 {
 	struct serial_struct serinfo;
 	
-	if(gSocket_fd == -1)
+	if(port->fd == -1)
 		return 0;
     
 	//USB2AX uses the CDC ACM driver for which these settings do not exist.
     /*
-	if(ioctl(gSocket_fd, TIOCGSERIAL, &serinfo) < 0) {
+	if(ioctl(port->fd, TIOCGSERIAL, &serinfo) < 0) {
 		fprintf(stderr, "Cannot get serial info\n");
 		return 0;
 	}
@@ -123,60 +142,171 @@ int dxl_hal_set_baud( float baudrate )
 	serinfo.flags |= ASYNC_SPD_CUST;
 	serinfo.custom_divisor = serinfo.baud_base / baudrate;
 	
-	if(ioctl(gSocket_fd, TIOCSSERIAL, &serinfo) < 0) {
+	if(ioctl(port->fd, TIOCSSERIAL, &serinfo) < 0) {
 		fprintf(stderr, "Cannot set serial info\n");
 		return 0;
 	}
 	*/
-	//dxl_hal_close();
-	//dxl_hal_open(gDeviceName, baudrate);
+	//dxl_port_close(port);
+	//dxl_port_open(port, port->deviceName, baudrate);
 	
-	gfByteTransTime = (float)((1000.0f / baudrate) * 12.0f);
+	port->byteTransTime = (float)((1000.0f / baudrate) * 12.0f);
 	return 1;
 }
 
-void dxl_hal_clear(void)
+void dxl_port_clear( DxlPort *port )
 {
-	tcflush(gSocket_fd, TCIFLUSH);
+	tcflush(port->fd, TCIFLUSH);
 }
 
-int dxl_hal_tx( unsigned char *pPacket, int numPacket )
+int dxl_port_tx( DxlPort *port, unsigned char *pPacket, int numPacket )
 {
-	return write(gSocket_fd, pPacket, numPacket);
+	return write(port->fd, pPacket, numPacket);
 }
 
-int dxl_hal_rx( unsigned char *pPacket, int numPacket )
+int dxl_port_rx( DxlPort *port, unsigned char *pPacket, int numPacket )
 {
 	memset(pPacket, 0, numPacket);
-	return read(gSocket_fd, pPacket, numPacket);
+	return read(port->fd, pPacket, numPacket);
 }
 
-static inline long myclock()
+static inline long long myclock()
 {
-	struct timeval tv;
-	gettimeofday (&tv, NULL);
-	return (tv.tv_sec * 1000 + tv.tv_usec / 1000);
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000);
 }
 
-void dxl_hal_set_timeout( int NumRcvByte )
+void dxl_port_set_timeout( DxlPort *port, int NumRcvByte )
 {
-	glStartTime = myclock();
-	//gfRcvWaitTime = (float)(gfByteTransTime*(float)NumRcvByte + 5.0f);
+	port->startTime = myclock();
+	//port->rcvWaitTime = (float)(port->byteTransTime*(float)NumRcvByte + 5.0f);
     // Fix for frequent timeout errors
     // See: http://www.xevelabs.com/doku.php?id=product:usb2ax:faq#qdynamixel_sdkhow_do_i_use_it_with_the_usb2ax
-    gfRcvWaitTime = (float)(gfByteTransTime*(float)NumRcvByte + 34.0f);
+    port->rcvWaitTime = (float)(port->byteTransTime*(float)NumRcvByte + 34.0f);
 }
 
-int dxl_hal_timeout(void)
+// Receive window given in full, e.g. from a calibrated timing model
+void dxl_port_set_timeout_ms( DxlPort *port, float waitMs )
 {
-	long time;
+	port->startTime = myclock();
+	port->rcvWaitTime = waitMs;
+}
+
+int dxl_port_timeout( DxlPort *port )
+{
+	long long time;
 	
-	time = myclock() - glStartTime;
+	time = myclock() - port->startTime;
 	
-	if(time > gfRcvWaitTime)
+	if(time >= (long long)(port->rcvWaitTime * 1000.0f))
 		return 1;
 	else if(time < 0)
-		glStartTime = myclock();
+		port->startTime = myclock();
 		
 	return 0;
 }
+
+void dxl_port_set_rx_mode( DxlPort *port, int mode )
+{
+	port->rxMode = mode;
+}
+
+int dxl_port_get_rx_mode( DxlPort *port )
+{
+	return port->rxMode;
+}
+
+// Block until the port has data to read or the deadline set by dxl_port_set_timeout() expires.
+// Returns 1 if data is ready, 0 on timeout or error.
+int dxl_port_wait_rx( DxlPort *port )
+{
+	struct pollfd pfd;
+	struct timespec ts;
+	long long remaining;
+	int ret;
+
+	if(port->fd == -1)
+		return 0;
+
+	pfd.fd = port->fd;
+	pfd.events = POLLIN;
+
+	do {
+		remaining = port->startTime + (long long)(port->rcvWaitTime * 1000.0f) - myclock();
+		if(remaining <= 0)
+			return 0;
+
+		ts.tv_sec = remaining / 1000000LL;
+		ts.tv_nsec = (remaining % 1000000LL) * 1000L;
+		ret = ppoll(&pfd, 1, &ts, NULL);
+	} while(ret < 0 && errno == EINTR);
+
+	return (ret > 0 && (pfd.revents & POLLIN)) ? 1 : 0;
+}
+
+
+DxlPort *dxl_hal_default_port(void)
+{
+	return &gDefaultPort;
+}
+
+int dxl_hal_open(int deviceIndex, float baudrate)
+{
+	return dxl_port_open(&gDefaultPort, deviceIndex, baudrate);
+}
+
+int dxl_hal_open_path(const char *deviceName, float baudrate)
+{
+	return dxl_port_open_path(&gDefaultPort, deviceName, baudrate);
+}
+
+void dxl_hal_close()
+{
+	dxl_port_close(&gDefaultPort);
+}
+
+int dxl_hal_set_baud( float baudrate )
+{
+	return dxl_port_set_baud(&gDefaultPort, baudrate);
+}
+
+void dxl_hal_clear(void)
+{
+	dxl_port_clear(&gDefaultPort);
+}
+
+int dxl_hal_tx( unsigned char *pPacket, int numPacket )
+{
+	return dxl_port_tx(&gDefaultPort, pPacket, numPacket);
+}
+
+int dxl_hal_rx( unsigned char *pPacket, int numPacket )
+{
+	return dxl_port_rx(&gDefaultPort, pPacket, numPacket);
+}
+
+void dxl_hal_set_timeout( int NumRcvByte )
+{
+	dxl_port_set_timeout(&gDefaultPort, NumRcvByte);
+}
+
+int dxl_hal_timeout(void)
+{
+	return dxl_port_timeout(&gDefaultPort);
+}
+
+void dxl_hal_set_rx_mode( int mode )
+{
+	dxl_port_set_rx_mode(&gDefaultPort, mode);
+}
+
+int dxl_hal_get_rx_mode(void)
+{
+	return dxl_port_get_rx_mode(&gDefaultPort);
+}
+
+int dxl_hal_wait_rx(void)
+{
+	return dxl_port_wait_rx(&gDefaultPort);
+}
@@ -1,25 +1,64 @@
-#ifndef _DYNAMIXEL_HAL_HEADER
-#define _DYNAMIXEL_HAL_HEADER
-
-
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-
-int dxl_hal_open(int deviceIndex, float baudrate);
-void dxl_hal_close();
-int dxl_hal_set_baud( float baudrate );
-void dxl_hal_clear();
-int dxl_hal_tx( unsigned char *pPacket, int numPacket );
-int dxl_hal_rx( unsigned char *pPacket, int numPacket );
-void dxl_hal_set_timeout( int NumRcvByte );
-int dxl_hal_timeout();
-
-
-
-#ifdef __cplusplus
-}
-#endif
-
-#endif
+#ifndef _DYNAMIXEL_HAL_HEADER
+#define _DYNAMIXEL_HAL_HEADER
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Receive modes: SPIN polls the non-blocking fd until the timeout expires,
+// POLL blocks in ppoll() until data arrives or the receive deadline passes.
+#define DXL_HAL_RX_SPIN		(0)
+#define DXL_HAL_RX_POLL		(1)
+
+// State of one serial port: file descriptor and receive timing.
+typedef struct
+{
+	int		fd;
+	long long	startTime;	// us, CLOCK_MONOTONIC
+	float	rcvWaitTime;	// ms
+	float	byteTransTime;	// ms
+	int		rxMode;
+	char	deviceName[100];
+} DxlPort;
+
+void dxl_port_init( DxlPort *port );
+int dxl_port_open( DxlPort *port, int deviceIndex, float baudrate );
+int dxl_port_open_path( DxlPort *port, const char *deviceName, float baudrate );
+void dxl_port_close( DxlPort *port );
+int dxl_port_set_baud( DxlPort *port, float baudrate );
+void dxl_port_clear( DxlPort *port );
+int dxl_port_tx( DxlPort *port, unsigned char *pPacket, int numPacket );
+int dxl_port_rx( DxlPort *port, unsigned char *pPacket, int numPacket );
+void dxl_port_set_timeout( DxlPort *port, int NumRcvByte );
+void dxl_port_set_timeout_ms( DxlPort *port, float waitMs );
+int dxl_port_timeout( DxlPort *port );
+void dxl_port_set_rx_mode( DxlPort *port, int mode );
+int dxl_port_get_rx_mode( DxlPort *port );
+int dxl_port_wait_rx( DxlPort *port );
+
+// Port used by the dxl_hal_* functions below and by the default bus
+DxlPort *dxl_hal_default_port();
+
+int dxl_hal_open(int deviceIndex, float baudrate);
+int dxl_hal_open_path(const char *deviceName, float baudrate);
+void dxl_hal_close();
+int dxl_hal_set_baud( float baudrate );
+void dxl_hal_clear();
+int dxl_hal_tx( unsigned char *pPacket, int numPacket );
+int dxl_hal_rx( unsigned char *pPacket, int numPacket );
+void dxl_hal_set_timeout( int NumRcvByte );
+int dxl_hal_timeout();
+
+void dxl_hal_set_rx_mode( int mode );
+int dxl_hal_get_rx_mode();
+int dxl_hal_wait_rx();
+
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
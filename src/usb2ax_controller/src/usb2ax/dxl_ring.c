@@ -0,0 +1,208 @@
+#include <string.h>
+#include "dxl_ring.h"
+
+// Parser states
+#define RING_HEADER1	(0)
+#define RING_HEADER2	(1)
+#define RING_ID			(2)
+#define RING_LENGTH		(3)
+#define RING_BODY		(4)
+
+
+void dxl_ring_init( DxlRing *ring )
+{
+	memset(ring, 0, sizeof(DxlRing));
+	dxl_ring_reset(ring);
+}
+
+void dxl_ring_reset( DxlRing *ring )
+{
+	ring->head = 0;
+	ring->tail = 0;
+	ring->scan = 0;
+	ring->state = RING_HEADER1;
+	ring->pktStart = 0;
+	ring->pktLength = 0;
+	ring->checksum = 0;
+}
+
+int dxl_ring_count( const DxlRing *ring )
+{
+	return (int)(ring->head - ring->tail);
+}
+
+int dxl_ring_space( const DxlRing *ring )
+{
+	return DXL_RING_SIZE - (int)(ring->head - ring->tail);
+}
+
+unsigned char *dxl_ring_write_ptr( DxlRing *ring, int *contiguous )
+{
+	int space = dxl_ring_space(ring);
+	int toEnd = DXL_RING_SIZE - (int)(ring->head & DXL_RING_MASK);
+
+	*contiguous = (space < toEnd) ? space : toEnd;
+	return &ring->buf[ring->head & DXL_RING_MASK];
+}
+
+void dxl_ring_commit( DxlRing *ring, int numByte )
+{
+	if( numByte > 0 )
+		ring->head += numByte;
+}
+
+int dxl_ring_write( DxlRing *ring, const unsigned char *pData, int numByte )
+{
+	int written = 0;
+	int contiguous, n;
+	unsigned char *pDest;
+
+	while( written < numByte )
+	{
+		pDest = dxl_ring_write_ptr(ring, &contiguous);
+		if( contiguous == 0 )
+			break;
+		n = numByte - written;
+		if( n > contiguous )
+			n = contiguous;
+		memcpy(pDest, &pData[written], n);
+		dxl_ring_commit(ring, n);
+		written += n;
+	}
+
+	return written;
+}
+
+// Drop the current candidate header and rescan from the byte after it
+static void dxl_ring_resync( DxlRing *ring )
+{
+	ring->scan = ring->pktStart + 1;
+	ring->tail = ring->scan;
+	ring->state = RING_HEADER1;
+	ring->nSkipped++;
+}
+
+int dxl_ring_parse( DxlRing *ring, DxlRingPacket *pPacket )
+{
+	unsigned char c;
+	unsigned char *pFound, *pBody;
+	int n, toEnd;
+
+	// The packet returned by the previous call is released here
+	if( ring->state == RING_HEADER1 )
+		ring->tail = ring->scan;
+
+	while( ring->scan != ring->head )
+	{
+		if( ring->state == RING_HEADER1 )
+		{
+			// Jump to the next 0xFF in the contiguous part of the ring
+			n = (int)(ring->head - ring->scan);
+			toEnd = DXL_RING_SIZE - (int)(ring->scan & DXL_RING_MASK);
+			if( n > toEnd )
+				n = toEnd;
+			pFound = (unsigned char*)memchr(&ring->buf[ring->scan & DXL_RING_MASK], 0xff, n);
+			if( pFound == 0 )
+			{
+				ring->nSkipped += n;
+				ring->scan += n;
+				ring->tail = ring->scan;
+				continue;
+			}
+			n = (int)(pFound - &ring->buf[ring->scan & DXL_RING_MASK]);
+			ring->nSkipped += n;
+			ring->scan += n;
+			ring->tail = ring->scan;
+			ring->pktStart = ring->scan++;
+			ring->state = RING_HEADER2;
+			continue;
+		}
+
+		if( ring->state == RING_BODY )
+		{
+			// Sum the contiguous part of the body up to the checksum byte in one go
+			n = ring->pktLength - 1 - (int)(ring->scan - ring->pktStart);
+			if( n > (int)(ring->head - ring->scan) )
+				n = (int)(ring->head - ring->scan);
+			toEnd = DXL_RING_SIZE - (int)(ring->scan & DXL_RING_MASK);
+			if( n > toEnd )
+				n = toEnd;
+			if( n > 0 )
+			{
+				pBody = &ring->buf[ring->scan & DXL_RING_MASK];
+				ring->scan += n;
+				while( n-- > 0 )
+					ring->checksum += *pBody++;
+				continue;
+			}
+		}
+
+		c = ring->buf[ring->scan & DXL_RING_MASK];
+		ring->scan++;
+
+		switch( ring->state )
+		{
+		case RING_HEADER2:
+			if( c == 0xff )
+				ring->state = RING_ID;
+			else
+				dxl_ring_resync(ring);
+			break;
+
+		case RING_ID:
+			if( c == 0xff )
+			{
+				// 0xFF 0xFF 0xFF: the header is the last two bytes
+				ring->pktStart++;
+				ring->tail = ring->pktStart;
+				ring->nSkipped++;
+				break;
+			}
+			ring->checksum = c;
+			ring->state = RING_LENGTH;
+			break;
+
+		case RING_LENGTH:
+			if( c < 2 )
+			{
+				dxl_ring_resync(ring);
+				break;
+			}
+			ring->checksum += c;
+			ring->pktLength = c + 4;
+			ring->state = RING_BODY;
+			break;
+
+		case RING_BODY:
+			if( (unsigned char)~ring->checksum != c )
+			{
+				ring->nChecksumErrors++;
+				dxl_ring_resync(ring);
+				break;
+			}
+			pPacket->start = ring->pktStart;
+			pPacket->length = ring->pktLength;
+			ring->state = RING_HEADER1;
+			return DXL_RING_PACKET;
+		}
+	}
+
+	return DXL_RING_NEED_MORE;
+}
+
+int dxl_ring_packet_byte( const DxlRing *ring, const DxlRingPacket *pPacket, int index )
+{
+	return ring->buf[(pPacket->start + index) & DXL_RING_MASK];
+}
+
+void dxl_ring_packet_copy( const DxlRing *ring, const DxlRingPacket *pPacket, unsigned char *pDest )
+{
+	int first = pPacket->length;
+	int toEnd = DXL_RING_SIZE - (int)(pPacket->start & DXL_RING_MASK);
+
+	if( first > toEnd )
+		first = toEnd;
+	memcpy(pDest, &ring->buf[pPacket->start & DXL_RING_MASK], first);
+	if( first < pPacket->length )
+		memcpy(&pDest[first], ring->buf, pPacket->length - first);
+}
@@ -0,0 +1,65 @@
+#ifndef _DXL_RING_HEADER
+#define _DXL_RING_HEADER
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Streaming parser for Protocol 1.0 status packets.
+// Received bytes are written straight into a power-of-two ring and parsed in place:
+// a false header or a bad checksum only moves the scan index back to the byte after
+// the rejected header, so nothing is shifted and no received byte is lost.
+// Several back-to-back status packets (sync_read, bulk_read) can be held at once.
+
+#define DXL_RING_SIZE			(1024)	// Must be a power of two
+#define DXL_RING_MASK			(DXL_RING_SIZE - 1)
+#define DXL_RING_MAX_PACKET		(259)	// 0xFF 0xFF ID LENGTH + 255 bytes
+
+// dxl_ring_parse() results
+#define DXL_RING_NEED_MORE		(0)
+#define DXL_RING_PACKET			(1)
+
+typedef struct
+{
+	unsigned char	buf[DXL_RING_SIZE];
+	unsigned int	head;		// Next byte to write, free-running
+	unsigned int	tail;		// First byte still in use, free-running
+	unsigned int	scan;		// Next byte to parse, free-running
+	int				state;
+	unsigned int	pktStart;	// First 0xFF of the packet being parsed
+	int				pktLength;	// LENGTH + 4, once LENGTH is known
+	unsigned char	checksum;
+	unsigned int	nSkipped;	// Bytes dropped while looking for a header
+	unsigned int	nChecksumErrors;
+} DxlRing;
+
+// Location of a complete, checksum-validated packet inside the ring.
+// It stays valid until the next dxl_ring_parse() or dxl_ring_reset() call.
+typedef struct
+{
+	unsigned int	start;
+	int				length;
+} DxlRingPacket;
+
+void dxl_ring_init( DxlRing *ring );
+void dxl_ring_reset( DxlRing *ring );
+int dxl_ring_count( const DxlRing *ring );
+int dxl_ring_space( const DxlRing *ring );
+
+// Zero-copy write: read() directly into the returned pointer, then commit what was read
+unsigned char *dxl_ring_write_ptr( DxlRing *ring, int *contiguous );
+void dxl_ring_commit( DxlRing *ring, int numByte );
+int dxl_ring_write( DxlRing *ring, const unsigned char *pData, int numByte );
+
+int dxl_ring_parse( DxlRing *ring, DxlRingPacket *pPacket );
+int dxl_ring_packet_byte( const DxlRing *ring, const DxlRingPacket *pPacket, int index );
+void dxl_ring_packet_copy( const DxlRing *ring, const DxlRingPacket *pPacket, unsigned char *pDest );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
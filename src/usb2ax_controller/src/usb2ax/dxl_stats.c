@@ -0,0 +1,200 @@
+#include <string.h>
+#include <time.h>
+#include "dxl_stats.h"
+#include "dynamixel_syncread.h"
+
+static DxlStats gStats;
+
+
+long long dxl_stats_now_us( void )
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+int dxl_stats_bucket( long long us )
+{
+	int exponent = 0;
+	long long v;
+
+	if( us < 0 )
+		us = 0;
+	if( us < DXL_STATS_LINEAR_BUCKETS )
+		return (int)us;
+
+	for( v=us; v>1; v>>=1 )
+		exponent++;
+	if( exponent > DXL_STATS_MAX_EXPONENT )
+		return DXL_STATS_NUM_BUCKETS - 1;
+
+	// Top 3 bits below the leading one select the sub-bucket
+	return DXL_STATS_LINEAR_BUCKETS + (exponent - 4)*DXL_STATS_SUB_BUCKETS
+		+ (int)((us >> (exponent - 3)) & (DXL_STATS_SUB_BUCKETS - 1));
+}
+
+unsigned int dxl_stats_bucket_upper( int bucket )
+{
+	int exponent, sub;
+
+	if( bucket < DXL_STATS_LINEAR_BUCKETS )
+		return bucket;
+
+	exponent = 4 + (bucket - DXL_STATS_LINEAR_BUCKETS)/DXL_STATS_SUB_BUCKETS;
+	sub = (bucket - DXL_STATS_LINEAR_BUCKETS) % DXL_STATS_SUB_BUCKETS;
+	return ((unsigned int)(DXL_STATS_SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+}
+
+static int dxl_stats_instruction_key( int instruction )
+{
+	switch( instruction )
+	{
+	case INST_PING:			return DXL_STATS_INST_PING;
+	case INST_READ:			return DXL_STATS_INST_READ;
+	case INST_WRITE:		return DXL_STATS_INST_WRITE;
+	case INST_REG_WRITE:	return DXL_STATS_INST_REG_WRITE;
+	case INST_ACTION:		return DXL_STATS_INST_ACTION;
+	case INST_SYNC_WRITE:	return DXL_STATS_INST_SYNC_WRITE;
+	case INST_SYNC_READ:	return DXL_STATS_INST_SYNC_READ;
+	case INST_BULK_READ:	return DXL_STATS_INST_BULK_READ;
+	default:				return DXL_STATS_INST_OTHER;
+	}
+}
+
+static int dxl_stats_outcome_key( int commStatus )
+{
+	switch( commStatus )
+	{
+	case COMM_RXSUCCESS:	return DXL_STATS_RXSUCCESS;
+	case COMM_RXTIMEOUT:	return DXL_STATS_RXTIMEOUT;
+	case COMM_RXCORRUPT:	return DXL_STATS_RXCORRUPT;
+	default:				return DXL_STATS_TXFAIL;
+	}
+}
+
+static void dxl_stats_add( DxlHistogram *pHist, int bucket, long long elapsedUs )
+{
+	__atomic_fetch_add(&pHist->count[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&pHist->totalUs, (unsigned long long)elapsedUs, __ATOMIC_RELAXED);
+}
+
+void dxl_stats_record( int instruction, int id, int commStatus, long long elapsedUs )
+{
+	int bucket = dxl_stats_bucket(elapsedUs);
+	int outcome = dxl_stats_outcome_key(commStatus);
+
+	if( elapsedUs < 0 )
+		elapsedUs = 0;
+	id &= (DXL_STATS_NUM_ID - 1);
+
+	dxl_stats_add(&gStats.byInstruction[dxl_stats_instruction_key(instruction)][outcome], bucket, elapsedUs);
+	dxl_stats_add(&gStats.byId[id], bucket, elapsedUs);
+	__atomic_fetch_add(&gStats.idOutcome[id][outcome], 1, __ATOMIC_RELAXED);
+}
+
+// Relaxed loads of every counter. The copy is not one atomic view of all the counters, but
+// each counter only grows, so a transaction is at worst counted in the next snapshot.
+static void dxl_stats_load( DxlHistogram *pDest, const DxlHistogram *pSrc )
+{
+	int b;
+
+	for( b=0; b<DXL_STATS_NUM_BUCKETS; b++ )
+		pDest->count[b] = __atomic_load_n(&pSrc->count[b], __ATOMIC_RELAXED);
+	pDest->totalUs = __atomic_load_n(&pSrc->totalUs, __ATOMIC_RELAXED);
+}
+
+void dxl_stats_snapshot( DxlStats *pSnapshot )
+{
+	int i, j;
+
+	for( i=0; i<DXL_STATS_NUM_INST; i++ )
+		for( j=0; j<DXL_STATS_NUM_OUTCOME; j++ )
+			dxl_stats_load(&pSnapshot->byInstruction[i][j], &gStats.byInstruction[i][j]);
+
+	for( i=0; i<DXL_STATS_NUM_ID; i++ )
+	{
+		dxl_stats_load(&pSnapshot->byId[i], &gStats.byId[i]);
+		for( j=0; j<DXL_STATS_NUM_OUTCOME; j++ )
+			pSnapshot->idOutcome[i][j] = __atomic_load_n(&gStats.idOutcome[i][j], __ATOMIC_RELAXED);
+	}
+}
+
+static void dxl_stats_histogram_diff( const DxlHistogram *pNow, const DxlHistogram *pPrevious, DxlHistogram *pDelta )
+{
+	int b;
+
+	for( b=0; b<DXL_STATS_NUM_BUCKETS; b++ )
+		pDelta->count[b] = pNow->count[b] - pPrevious->count[b];
+	pDelta->totalUs = pNow->totalUs - pPrevious->totalUs;
+}
+
+void dxl_stats_diff( const DxlStats *pNow, const DxlStats *pPrevious, DxlStats *pDelta )
+{
+	int i, j;
+
+	for( i=0; i<DXL_STATS_NUM_INST; i++ )
+		for( j=0; j<DXL_STATS_NUM_OUTCOME; j++ )
+			dxl_stats_histogram_diff(&pNow->byInstruction[i][j], &pPrevious->byInstruction[i][j], &pDelta->byInstruction[i][j]);
+
+	for( i=0; i<DXL_STATS_NUM_ID; i++ )
+	{
+		dxl_stats_histogram_diff(&pNow->byId[i], &pPrevious->byId[i], &pDelta->byId[i]);
+		for( j=0; j<DXL_STATS_NUM_OUTCOME; j++ )
+			pDelta->idOutcome[i][j] = pNow->idOutcome[i][j] - pPrevious->idOutcome[i][j];
+	}
+}
+
+unsigned int dxl_stats_histogram_count( const DxlHistogram *pHist )
+{
+	unsigned int count = 0;
+	int b;
+
+	for( b=0; b<DXL_STATS_NUM_BUCKETS; b++ )
+		count += pHist->count[b];
+	return count;
+}
+
+// Upper bound of the bucket holding the given percentile, 0 for an empty histogram
+unsigned int dxl_stats_histogram_percentile( const DxlHistogram *pHist, double percent )
+{
+	unsigned int count = dxl_stats_histogram_count(pHist);
+	unsigned int rank, seen = 0;
+	int b;
+
+	if( count == 0 )
+		return 0;
+
+	rank = (unsigned int)(percent*0.01*count + 0.5);
+	if( rank < 1 )
+		rank = 1;
+	if( rank > count )
+		rank = count;
+
+	for( b=0; b<DXL_STATS_NUM_BUCKETS; b++ )
+	{
+		seen += pHist->count[b];
+		if( seen >= rank )
+			return dxl_stats_bucket_upper(b);
+	}
+	return dxl_stats_bucket_upper(DXL_STATS_NUM_BUCKETS - 1);
+}
+
+const char *dxl_stats_instruction_name( int key )
+{
+	static const char *names[DXL_STATS_NUM_INST] =
+		{ "PING", "READ", "WRITE", "REG_WRITE", "ACTION", "SYNC_WRITE", "SYNC_READ", "BULK_READ", "OTHER" };
+
+	if( key < 0 || key >= DXL_STATS_NUM_INST )
+		return "";
+	return names[key];
+}
+
+const char *dxl_stats_outcome_name( int key )
+{
+	static const char *names[DXL_STATS_NUM_OUTCOME] =
+		{ "RXSUCCESS", "RXTIMEOUT", "RXCORRUPT", "TXFAIL" };
+
+	if( key < 0 || key >= DXL_STATS_NUM_OUTCOME )
+		return "";
+	return names[key];
+}
@@ -0,0 +1,76 @@
+#ifndef _DXL_STATS_HEADER
+#define _DXL_STATS_HEADER
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Round-trip time of every transaction of every bus, from the start of the instruction packet
+// to the end of the status packet (or the timeout), in log-linear buckets: exact up to 16 us,
+// then 8 buckets per power of two (12.5% resolution) up to about 4 s.
+// Counters are only ever incremented, with atomic operations, so that the bus threads never
+// wait on each other or on a reader. Readers take a snapshot and diff it with the previous one.
+
+#define DXL_STATS_LINEAR_BUCKETS	(16)
+#define DXL_STATS_SUB_BUCKETS		(8)
+#define DXL_STATS_MAX_EXPONENT		(21)
+#define DXL_STATS_NUM_BUCKETS		(DXL_STATS_LINEAR_BUCKETS + (DXL_STATS_MAX_EXPONENT - 3)*DXL_STATS_SUB_BUCKETS)
+
+// Instruction keys
+#define DXL_STATS_INST_PING			(0)
+#define DXL_STATS_INST_READ			(1)
+#define DXL_STATS_INST_WRITE		(2)
+#define DXL_STATS_INST_REG_WRITE	(3)
+#define DXL_STATS_INST_ACTION		(4)
+#define DXL_STATS_INST_SYNC_WRITE	(5)
+#define DXL_STATS_INST_SYNC_READ	(6)
+#define DXL_STATS_INST_BULK_READ	(7)
+#define DXL_STATS_INST_OTHER		(8)
+#define DXL_STATS_NUM_INST			(9)
+
+// Outcome keys
+#define DXL_STATS_RXSUCCESS			(0)
+#define DXL_STATS_RXTIMEOUT			(1)
+#define DXL_STATS_RXCORRUPT			(2)
+#define DXL_STATS_TXFAIL			(3)
+#define DXL_STATS_NUM_OUTCOME		(4)
+
+#define DXL_STATS_NUM_ID			(256)
+
+typedef struct
+{
+	unsigned int count[DXL_STATS_NUM_BUCKETS];
+	unsigned long long totalUs;
+} DxlHistogram;
+
+typedef struct
+{
+	DxlHistogram byInstruction[DXL_STATS_NUM_INST][DXL_STATS_NUM_OUTCOME];
+	DxlHistogram byId[DXL_STATS_NUM_ID];						// All outcomes
+	unsigned int idOutcome[DXL_STATS_NUM_ID][DXL_STATS_NUM_OUTCOME];
+} DxlStats;
+
+long long dxl_stats_now_us( void );
+
+// instruction is the INST_* code of the packet, id its ID, commStatus the COMM_* result
+void dxl_stats_record( int instruction, int id, int commStatus, long long elapsedUs );
+
+void dxl_stats_snapshot( DxlStats *pSnapshot );
+// pDelta = pNow - pPrevious, counter by counter; pDelta may be either input
+void dxl_stats_diff( const DxlStats *pNow, const DxlStats *pPrevious, DxlStats *pDelta );
+
+int dxl_stats_bucket( long long us );
+unsigned int dxl_stats_bucket_upper( int bucket );
+unsigned int dxl_stats_histogram_count( const DxlHistogram *pHist );
+unsigned int dxl_stats_histogram_percentile( const DxlHistogram *pHist, double percent );
+const char *dxl_stats_instruction_name( int key );
+const char *dxl_stats_outcome_name( int key );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
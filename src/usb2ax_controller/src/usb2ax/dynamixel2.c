@@ -0,0 +1,448 @@
+#include <string.h>
+#include "dxl_hal.h"
+#include "dynamixel_syncread.h"
+#include "dynamixel2.h"
+
+// Packet layout
+#define PKT2_ID				(4)
+#define PKT2_LENGTH_L		(5)
+#define PKT2_LENGTH_H		(6)
+#define PKT2_INSTRUCTION	(7)
+#define PKT2_PARAMETER		(8)
+#define PKT2_HEADER_SIZE	(7)		// Bytes before the instruction
+#define PKT2_MIN_STATUS		(11)	// Header, instruction, error and CRC
+
+// CRC-16 with polynomial 0x8005, as used by Protocol 2.0
+static const unsigned short crcTable[256] = {
+	0x0000, 0x8005, 0x800F, 0x000A, 0x801B, 0x001E, 0x0014, 0x8011,
+	0x8033, 0x0036, 0x003C, 0x8039, 0x0028, 0x802D, 0x8027, 0x0022,
+	0x8063, 0x0066, 0x006C, 0x8069, 0x0078, 0x807D, 0x8077, 0x0072,
+	0x0050, 0x8055, 0x805F, 0x005A, 0x804B, 0x004E, 0x0044, 0x8041,
+	0x80C3, 0x00C6, 0x00CC, 0x80C9, 0x00D8, 0x80DD, 0x80D7, 0x00D2,
+	0x00F0, 0x80F5, 0x80FF, 0x00FA, 0x80EB, 0x00EE, 0x00E4, 0x80E1,
+	0x00A0, 0x80A5, 0x80AF, 0x00AA, 0x80BB, 0x00BE, 0x00B4, 0x80B1,
+	0x8093, 0x0096, 0x009C, 0x8099, 0x0088, 0x808D, 0x8087, 0x0082,
+	0x8183, 0x0186, 0x018C, 0x8189, 0x0198, 0x819D, 0x8197, 0x0192,
+	0x01B0, 0x81B5, 0x81BF, 0x01BA, 0x81AB, 0x01AE, 0x01A4, 0x81A1,
+	0x01E0, 0x81E5, 0x81EF, 0x01EA, 0x81FB, 0x01FE, 0x01F4, 0x81F1,
+	0x81D3, 0x01D6, 0x01DC, 0x81D9, 0x01C8, 0x81CD, 0x81C7, 0x01C2,
+	0x0140, 0x8145, 0x814F, 0x014A, 0x815B, 0x015E, 0x0154, 0x8151,
+	0x8173, 0x0176, 0x017C, 0x8179, 0x0168, 0x816D, 0x8167, 0x0162,
+	0x8123, 0x0126, 0x012C, 0x8129, 0x0138, 0x813D, 0x8137, 0x0132,
+	0x0110, 0x8115, 0x811F, 0x011A, 0x810B, 0x010E, 0x0104, 0x8101,
+	0x8303, 0x0306, 0x030C, 0x8309, 0x0318, 0x831D, 0x8317, 0x0312,
+	0x0330, 0x8335, 0x833F, 0x033A, 0x832B, 0x032E, 0x0324, 0x8321,
+	0x0360, 0x8365, 0x836F, 0x036A, 0x837B, 0x037E, 0x0374, 0x8371,
+	0x8353, 0x0356, 0x035C, 0x8359, 0x0348, 0x834D, 0x8347, 0x0342,
+	0x03C0, 0x83C5, 0x83CF, 0x03CA, 0x83DB, 0x03DE, 0x03D4, 0x83D1,
+	0x83F3, 0x03F6, 0x03FC, 0x83F9, 0x03E8, 0x83ED, 0x83E7, 0x03E2,
+	0x83A3, 0x03A6, 0x03AC, 0x83A9, 0x03B8, 0x83BD, 0x83B7, 0x03B2,
+	0x0390, 0x8395, 0x839F, 0x039A, 0x838B, 0x038E, 0x0384, 0x8381,
+	0x0280, 0x8285, 0x828F, 0x028A, 0x829B, 0x029E, 0x0294, 0x8291,
+	0x82B3, 0x02B6, 0x02BC, 0x82B9, 0x02A8, 0x82AD, 0x82A7, 0x02A2,
+	0x82E3, 0x02E6, 0x02EC, 0x82E9, 0x02F8, 0x82FD, 0x82F7, 0x02F2,
+	0x02D0, 0x82D5, 0x82DF, 0x02DA, 0x82CB, 0x02CE, 0x02C4, 0x82C1,
+	0x8243, 0x0246, 0x024C, 0x8249, 0x0258, 0x825D, 0x8257, 0x0252,
+	0x0270, 0x8275, 0x827F, 0x027A, 0x826B, 0x026E, 0x0264, 0x8261,
+	0x0220, 0x8225, 0x822F, 0x022A, 0x823B, 0x023E, 0x0234, 0x8231,
+	0x8213, 0x0216, 0x021C, 0x8219, 0x0208, 0x820D, 0x8207, 0x0202,
+};
+
+
+void dxl2_bus_init( Dxl2Bus *bus, DxlPort *port )
+{
+	memset(bus, 0, sizeof(Dxl2Bus));
+	bus->port = port;
+	bus->commStatus = COMM_RXSUCCESS;
+}
+
+unsigned short dxl2_update_crc( unsigned short crc, const unsigned char *pData, int numByte )
+{
+	int i;
+
+	for( i=0; i<numByte; i++ )
+		crc = (unsigned short)((crc << 8) ^ crcTable[((crc >> 8) ^ pData[i]) & 0xff]);
+
+	return crc;
+}
+
+int dxl2_bus_tx( Dxl2Bus *bus, int id, int instruction, const unsigned char *pParam, int numParam, int numRxByte )
+{
+	int i, n, length;
+	unsigned short crc;
+	unsigned char *p = bus->txPacket;
+
+	p[0] = 0xff;
+	p[1] = 0xff;
+	p[2] = 0xfd;
+	p[3] = 0x00;
+	p[PKT2_ID] = (unsigned char)id;
+	p[PKT2_INSTRUCTION] = (unsigned char)instruction;
+
+	n = PKT2_PARAMETER;
+	for( i=0; i<numParam; i++ )
+	{
+		// Room for a stuffing byte and the CRC
+		if( n + 4 > DXL2_MAXNUM_TXPACKET )
+		{
+			bus->commStatus = COMM_TXERROR;
+			return bus->commStatus;
+		}
+		p[n++] = pParam[i];
+
+		// Byte stuffing: a header pattern inside the packet gets an extra 0xFD
+		if( n - 3 >= PKT2_INSTRUCTION && p[n-1] == 0xfd && p[n-2] == 0xff && p[n-3] == 0xff )
+			p[n++] = 0xfd;
+	}
+
+	length = n - PKT2_HEADER_SIZE + 2;
+	p[PKT2_LENGTH_L] = (unsigned char)(length & 0xff);
+	p[PKT2_LENGTH_H] = (unsigned char)(length >> 8);
+	crc = dxl2_update_crc(0, p, n);
+	p[n++] = (unsigned char)(crc & 0xff);
+	p[n++] = (unsigned char)(crc >> 8);
+
+	if( bus->commStatus == COMM_RXTIMEOUT || bus->commStatus == COMM_RXCORRUPT )
+		dxl_port_clear(bus->port);
+	bus->rxLength = 0;
+	bus->rxConsumed = 0;
+
+	if( dxl_port_tx(bus->port, p, n) != n )
+	{
+		bus->commStatus = COMM_TXFAIL;
+		return bus->commStatus;
+	}
+
+	dxl_port_set_timeout(bus->port, numRxByte);
+	bus->commStatus = COMM_TXSUCCESS;
+	return bus->commStatus;
+}
+
+static void dxl2_bus_drop( Dxl2Bus *bus, int numByte )
+{
+	memmove(bus->rxPacket, &bus->rxPacket[numByte], bus->rxLength - numByte);
+	bus->rxLength -= numByte;
+}
+
+// Remove the stuffing bytes of the instruction, error and parameter fields
+static void dxl2_bus_unstuff( Dxl2Bus *bus, int packetLength )
+{
+	int i, n = 0;
+	const unsigned char *p = bus->rxPacket;
+
+	for( i=PKT2_INSTRUCTION; i<packetLength-2; i++ )
+	{
+		if( p[i] == 0xfd && i - 3 >= PKT2_INSTRUCTION && p[i-1] == 0xfd && p[i-2] == 0xff && p[i-3] == 0xff )
+			continue;
+		bus->rxData[n++] = p[i];
+	}
+	bus->rxDataLength = n;
+}
+
+int dxl2_bus_rx( Dxl2Bus *bus, int id )
+{
+	int i, nRead, packetLength;
+	unsigned short crc;
+	unsigned char *p = bus->rxPacket;
+
+	// A sync or bulk read receives several status packets after one instruction
+	if( bus->commStatus != COMM_TXSUCCESS && bus->commStatus != COMM_RXSUCCESS )
+		return bus->commStatus;
+
+	// Release the packet returned by the previous call
+	if( bus->rxConsumed > 0 )
+	{
+		dxl2_bus_drop(bus, bus->rxConsumed);
+		bus->rxConsumed = 0;
+	}
+
+	while( 1 )
+	{
+		// Find packet header
+		for( i=0; i+3<bus->rxLength; i++ )
+		{
+			if( p[i] == 0xff && p[i+1] == 0xff && p[i+2] == 0xfd && p[i+3] == 0x00 )
+				break;
+		}
+		if( i > 0 )
+			dxl2_bus_drop(bus, i);
+
+		if( bus->rxLength >= PKT2_HEADER_SIZE )
+		{
+			packetLength = PKT2_HEADER_SIZE + (p[PKT2_LENGTH_L] | (p[PKT2_LENGTH_H] << 8));
+			if( packetLength < PKT2_MIN_STATUS || packetLength > DXL2_MAXNUM_RXPACKET )
+			{
+				dxl2_bus_drop(bus, 1);
+				continue;
+			}
+			if( bus->rxLength >= packetLength )
+			{
+				crc = dxl2_update_crc(0, p, packetLength - 2);
+				if( p[packetLength-2] != (crc & 0xff) || p[packetLength-1] != (crc >> 8)
+					|| p[PKT2_INSTRUCTION] != DXL2_INST_STATUS )
+				{
+					// Not a packet after all: look for the next header
+					dxl2_bus_drop(bus, 1);
+					continue;
+				}
+
+				dxl2_bus_unstuff(bus, packetLength);
+				bus->rxId = p[PKT2_ID];
+				bus->error = bus->rxData[1];
+				bus->rxConsumed = packetLength;
+
+				// Check id pairing
+				if( id != DXL2_BROADCAST_ID && bus->rxId != id )
+					bus->commStatus = COMM_RXCORRUPT;
+				else
+					bus->commStatus = COMM_RXSUCCESS;
+				return bus->commStatus;
+			}
+		}
+
+		if( dxl_port_timeout(bus->port) == 1 )
+		{
+			if( bus->rxLength == 0 )
+				bus->commStatus = COMM_RXTIMEOUT;
+			else
+				bus->commStatus = COMM_RXCORRUPT;
+			return bus->commStatus;
+		}
+
+		// In POLL mode sleep on the fd until bytes arrive instead of spinning on read()
+		if( dxl_port_get_rx_mode(bus->port) == DXL_HAL_RX_POLL )
+			dxl_port_wait_rx(bus->port);
+		nRead = dxl_port_rx(bus->port, &p[bus->rxLength], DXL2_MAXNUM_RXPACKET - bus->rxLength);
+		if( nRead > 0 )
+			bus->rxLength += nRead;
+	}
+}
+
+const unsigned char *dxl2_bus_rx_param( Dxl2Bus *bus )
+{
+	return &bus->rxData[2];
+}
+
+int dxl2_bus_rx_param_length( Dxl2Bus *bus )
+{
+	return bus->rxDataLength - 2;
+}
+
+int dxl2_bus_ping( Dxl2Bus *bus, int id )
+{
+	if( dxl2_bus_tx(bus, id, DXL2_INST_PING, 0, 0, PKT2_MIN_STATUS + 3) != COMM_TXSUCCESS )
+		return bus->commStatus;
+
+	return dxl2_bus_rx(bus, id);
+}
+
+int dxl2_bus_ping_broadcast( Dxl2Bus *bus, int maxDevice, unsigned char *pIds, int *pModel, int *pFirmware )
+{
+	const unsigned char *pParam;
+	int numDevice = 0;
+
+	// Room for a reply from every ID, with 50% for the gaps between the replies
+	if( dxl2_bus_tx(bus, DXL2_BROADCAST_ID, DXL2_INST_PING, 0, 0, (PKT2_MIN_STATUS + 3)*DXL2_BROADCAST_ID*3/2) != COMM_TXSUCCESS )
+		return 0;
+
+	while( numDevice < maxDevice && dxl2_bus_rx(bus, DXL2_BROADCAST_ID) == COMM_RXSUCCESS )
+	{
+		if( dxl2_bus_rx_param_length(bus) < 3 )
+			continue;
+		pParam = dxl2_bus_rx_param(bus);
+		pIds[numDevice] = (unsigned char)bus->rxId;
+		pModel[numDevice] = pParam[0] | (pParam[1] << 8);
+		pFirmware[numDevice] = pParam[2];
+		numDevice++;
+	}
+
+	// The window always ends with a timeout
+	if( bus->commStatus == COMM_RXTIMEOUT )
+		bus->commStatus = COMM_RXSUCCESS;
+	return numDevice;
+}
+
+int dxl2_bus_read( Dxl2Bus *bus, int id, int address, int length, unsigned char *pData )
+{
+	unsigned char param[4];
+
+	param[0] = (unsigned char)(address & 0xff);
+	param[1] = (unsigned char)(address >> 8);
+	param[2] = (unsigned char)(length & 0xff);
+	param[3] = (unsigned char)(length >> 8);
+	if( dxl2_bus_tx(bus, id, DXL2_INST_READ, param, 4, PKT2_MIN_STATUS + length) != COMM_TXSUCCESS )
+		return bus->commStatus;
+
+	if( dxl2_bus_rx(bus, id) != COMM_RXSUCCESS )
+		return bus->commStatus;
+	if( dxl2_bus_rx_param_length(bus) < length )
+	{
+		bus->commStatus = COMM_RXCORRUPT;
+		return bus->commStatus;
+	}
+	memcpy(pData, dxl2_bus_rx_param(bus), length);
+	return bus->commStatus;
+}
+
+int dxl2_bus_write( Dxl2Bus *bus, int id, int address, int length, const unsigned char *pData )
+{
+	unsigned char param[DXL2_MAXNUM_TXPACKET];
+
+	if( length + 2 > DXL2_MAXNUM_TXPACKET )
+	{
+		bus->commStatus = COMM_TXERROR;
+		return bus->commStatus;
+	}
+	param[0] = (unsigned char)(address & 0xff);
+	param[1] = (unsigned char)(address >> 8);
+	memcpy(&param[2], pData, length);
+	if( dxl2_bus_tx(bus, id, DXL2_INST_WRITE, param, length + 2, PKT2_MIN_STATUS) != COMM_TXSUCCESS )
+		return bus->commStatus;
+
+	if( id == DXL2_BROADCAST_ID )
+	{
+		bus->commStatus = COMM_RXSUCCESS;
+		return bus->commStatus;
+	}
+	return dxl2_bus_rx(bus, id);
+}
+
+int dxl2_bus_sync_write( Dxl2Bus *bus, int address, int length, int numId, const unsigned char *pIds, const unsigned char *pData )
+{
+	unsigned char param[DXL2_MAXNUM_TXPACKET];
+	int i, n = 0;
+
+	if( 4 + numId*(length + 1) > DXL2_MAXNUM_TXPACKET )
+	{
+		bus->commStatus = COMM_TXERROR;
+		return bus->commStatus;
+	}
+	param[n++] = (unsigned char)(address & 0xff);
+	param[n++] = (unsigned char)(address >> 8);
+	param[n++] = (unsigned char)(length & 0xff);
+	param[n++] = (unsigned char)(length >> 8);
+	for( i=0; i<numId; i++ )
+	{
+		param[n++] = pIds[i];
+		memcpy(&param[n], &pData[i*length], length);
+		n += length;
+	}
+
+	// Broadcast, no status packet
+	if( dxl2_bus_tx(bus, DXL2_BROADCAST_ID, DXL2_INST_SYNC_WRITE, param, n, 0) == COMM_TXSUCCESS )
+		bus->commStatus = COMM_RXSUCCESS;
+	return bus->commStatus;
+}
+
+int dxl2_bus_sync_read_tx( Dxl2Bus *bus, int fast, int address, int length, int numId, const unsigned char *pIds )
+{
+	unsigned char param[DXL2_MAXNUM_TXPACKET];
+	int numRxByte;
+
+	if( 4 + numId > DXL2_MAXNUM_TXPACKET )
+	{
+		bus->commStatus = COMM_TXERROR;
+		return bus->commStatus;
+	}
+	param[0] = (unsigned char)(address & 0xff);
+	param[1] = (unsigned char)(address >> 8);
+	param[2] = (unsigned char)(length & 0xff);
+	param[3] = (unsigned char)(length >> 8);
+	memcpy(&param[4], pIds, numId);
+
+	if( fast )
+		numRxByte = PKT2_MIN_STATUS + numId*(length + 4);
+	else
+		numRxByte = numId*(PKT2_MIN_STATUS + length);
+
+	return dxl2_bus_tx(bus, DXL2_BROADCAST_ID, fast ? DXL2_INST_FAST_SYNC_READ : DXL2_INST_SYNC_READ,
+					param, 4 + numId, numRxByte);
+}
+
+int dxl2_bus_sync_read_rx( Dxl2Bus *bus, int fast, int length, int numId, const unsigned char *pIds, unsigned char *pData )
+{
+	int i, offset, error = 0;
+
+	if( !fast )
+	{
+		// One status packet per motor, in the order of the request
+		for( i=0; i<numId; i++ )
+		{
+			if( dxl2_bus_rx(bus, pIds[i]) != COMM_RXSUCCESS )
+				return bus->commStatus;
+			if( dxl2_bus_rx_param_length(bus) < length )
+			{
+				bus->commStatus = COMM_RXCORRUPT;
+				return bus->commStatus;
+			}
+			memcpy(&pData[i*length], dxl2_bus_rx_param(bus), length);
+			error |= bus->error;
+		}
+		bus->error = error;
+		return bus->commStatus;
+	}
+
+	// Fast Sync Read: one status packet from the broadcast ID holding, for each motor,
+	// its error, ID, data and CRC. The CRC of the last motor is the packet CRC.
+	if( dxl2_bus_rx(bus, DXL2_BROADCAST_ID) != COMM_RXSUCCESS )
+		return bus->commStatus;
+	if( bus->rxDataLength < 1 + numId*(length + 4) - 2 )
+	{
+		bus->commStatus = COMM_RXCORRUPT;
+		return bus->commStatus;
+	}
+	for( i=0; i<numId; i++ )
+	{
+		offset = 1 + i*(length + 4);
+		if( bus->rxData[offset + 1] != pIds[i] )
+		{
+			bus->commStatus = COMM_RXCORRUPT;
+			return bus->commStatus;
+		}
+		error |= bus->rxData[offset];
+		memcpy(&pData[i*length], &bus->rxData[offset + 2], length);
+	}
+	bus->error = error;
+	return bus->commStatus;
+}
+
+int dxl2_bus_bulk_read( Dxl2Bus *bus, int numEntry, const unsigned char *pIds, const int *pAddress, const int *pLength, unsigned char *pData )
+{
+	unsigned char param[DXL2_MAXNUM_TXPACKET];
+	int i, n = 0, numRxByte = 0, error = 0;
+
+	if( numEntry <= 0 || numEntry*5 > DXL2_MAXNUM_TXPACKET )
+	{
+		bus->commStatus = COMM_TXERROR;
+		return bus->commStatus;
+	}
+	for( i=0; i<numEntry; i++ )
+	{
+		param[n++] = pIds[i];
+		param[n++] = (unsigned char)(pAddress[i] & 0xff);
+		param[n++] = (unsigned char)(pAddress[i] >> 8);
+		param[n++] = (unsigned char)(pLength[i] & 0xff);
+		param[n++] = (unsigned char)(pLength[i] >> 8);
+		numRxByte += PKT2_MIN_STATUS + pLength[i];
+	}
+
+	if( dxl2_bus_tx(bus, DXL2_BROADCAST_ID, DXL2_INST_BULK_READ, param, n, numRxByte) != COMM_TXSUCCESS )
+		return bus->commStatus;
+
+	// Each motor answers in the order of the request
+	for( i=0; i<numEntry; i++ )
+	{
+		if( dxl2_bus_rx(bus, pIds[i]) != COMM_RXSUCCESS )
+			return bus->commStatus;
+		if( dxl2_bus_rx_param_length(bus) < pLength[i] )
+		{
+			bus->commStatus = COMM_RXCORRUPT;
+			return bus->commStatus;
+		}
+		memcpy(pData, dxl2_bus_rx_param(bus), pLength[i]);
+		pData += pLength[i];
+		error |= bus->error;
+	}
+	bus->error = error;
+	return bus->commStatus;
+}
@@ -0,0 +1,91 @@
+#ifndef _DYNAMIXEL2_HEADER
+#define _DYNAMIXEL2_HEADER
+
+#include "dxl_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Dynamixel Protocol 2.0 (X series servos): 0xFF 0xFF 0xFD 0x00 header, 16-bit length,
+// table-driven CRC16 and byte stuffing. Runs on the same DxlPort as the Protocol 1.0 code
+// and reports results with the same COMM_* codes (see dynamixel_syncread.h).
+
+#define DXL2_MAXNUM_TXPACKET	(1024)
+#define DXL2_MAXNUM_RXPACKET	(1024)
+
+#define DXL2_BROADCAST_ID		(254)
+
+#define DXL2_INST_PING				(0x01)
+#define DXL2_INST_READ				(0x02)
+#define DXL2_INST_WRITE				(0x03)
+#define DXL2_INST_REG_WRITE			(0x04)
+#define DXL2_INST_ACTION			(0x05)
+#define DXL2_INST_SYNC_READ			(0x82)
+#define DXL2_INST_SYNC_WRITE		(0x83)
+#define DXL2_INST_FAST_SYNC_READ	(0x8A)
+#define DXL2_INST_BULK_READ			(0x92)
+#define DXL2_INST_BULK_WRITE		(0x93)
+#define DXL2_INST_STATUS			(0x55)
+
+// Error field of the status packet: an error number, plus the alert bit when the
+// Hardware Error Status register is not zero
+#define DXL2_ERR_ALERT			(0x80)
+#define DXL2_ERR_NUMBER_MASK	(0x7F)
+#define DXL2_ERR_RESULT_FAIL	(1)
+#define DXL2_ERR_INSTRUCTION	(2)
+#define DXL2_ERR_CRC			(3)
+#define DXL2_ERR_DATA_RANGE		(4)
+#define DXL2_ERR_DATA_LENGTH	(5)
+#define DXL2_ERR_DATA_LIMIT		(6)
+#define DXL2_ERR_ACCESS			(7)
+
+typedef struct
+{
+	DxlPort *port;
+	unsigned char txPacket[DXL2_MAXNUM_TXPACKET];
+	unsigned char rxPacket[DXL2_MAXNUM_RXPACKET];	// Raw bytes as received
+	int rxLength;									// Bytes in rxPacket
+	int rxConsumed;									// Bytes of rxPacket already returned
+	unsigned char rxData[DXL2_MAXNUM_RXPACKET];		// Unstuffed instruction, error and parameters
+	int rxDataLength;
+	int rxId;
+	int error;
+	int commStatus;
+} Dxl2Bus;
+
+void dxl2_bus_init( Dxl2Bus *bus, DxlPort *port );
+unsigned short dxl2_update_crc( unsigned short crc, const unsigned char *pData, int numByte );
+
+// Low level: send one instruction packet, and receive status packets one by one.
+// numRxByte is the number of reply bytes expected, which sets the receive timeout.
+int dxl2_bus_tx( Dxl2Bus *bus, int id, int instruction, const unsigned char *pParam, int numParam, int numRxByte );
+int dxl2_bus_rx( Dxl2Bus *bus, int id );
+const unsigned char *dxl2_bus_rx_param( Dxl2Bus *bus );
+int dxl2_bus_rx_param_length( Dxl2Bus *bus );
+
+int dxl2_bus_ping( Dxl2Bus *bus, int id );
+// Every device answers a broadcast PING in turn, in the order of the IDs; the replies are
+// collected in one receive window. Returns the number of devices, up to maxDevice.
+int dxl2_bus_ping_broadcast( Dxl2Bus *bus, int maxDevice, unsigned char *pIds, int *pModel, int *pFirmware );
+int dxl2_bus_read( Dxl2Bus *bus, int id, int address, int length, unsigned char *pData );
+int dxl2_bus_write( Dxl2Bus *bus, int id, int address, int length, const unsigned char *pData );
+
+// pData holds length bytes for each ID, in the order of pIds
+int dxl2_bus_sync_write( Dxl2Bus *bus, int address, int length, int numId, const unsigned char *pIds, const unsigned char *pData );
+
+// Split-phase sync read. With fast set, Fast Sync Read is used and all motors answer
+// in one status packet; otherwise each motor sends its own status packet in turn.
+int dxl2_bus_sync_read_tx( Dxl2Bus *bus, int fast, int address, int length, int numId, const unsigned char *pIds );
+int dxl2_bus_sync_read_rx( Dxl2Bus *bus, int fast, int length, int numId, const unsigned char *pIds, unsigned char *pData );
+
+// pData receives pLength[i] bytes for each entry, in the order of the entries
+int dxl2_bus_bulk_read( Dxl2Bus *bus, int numEntry, const unsigned char *pIds, const int *pAddress, const int *pLength, unsigned char *pData );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
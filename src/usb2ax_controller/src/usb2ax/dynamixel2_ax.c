@@ -0,0 +1,567 @@
+#include <string.h>
+#include "dynamixel_syncread.h"
+#include "dynamixel2.h"
+#include "dynamixel2_ax.h"
+
+#define ID					(2)
+#define LENGTH				(3)
+#define INSTRUCTION			(4)
+#define ERRBIT				(4)
+#define PARAMETER			(5)
+
+// Unit conversions between AX and X registers
+#define UNIT_RAW			(0)
+#define UNIT_POSITION		(1)	// 0.29 deg, centre 512 <-> 0.088 deg, centre 2048
+#define UNIT_SPEED			(2)	// 0.111 rpm <-> 0.229 rpm
+#define UNIT_VELOCITY		(3)	// Bit 10 for CW <-> signed 0.229 rpm
+#define UNIT_LOAD			(4)	// Bit 10 for CW <-> signed 0.1 %
+#define UNIT_TORQUE			(5)	// 0..1023 <-> PWM 0..885
+
+#define X_PWM_MAX			(885)
+#define MAXNUM_WINDOW_REG	(24)
+
+typedef struct
+{
+	unsigned char	axAddress;
+	unsigned char	axSize;
+	unsigned short	xAddress;
+	unsigned char	xSize;
+	unsigned char	unit;
+} AxToXRegister;
+
+// AX-12 registers that have an equivalent on the X series
+static const AxToXRegister axToX[] = {
+	{  0, 2,   0, 2, UNIT_RAW },		// Model number
+	{  2, 1,   6, 1, UNIT_RAW },		// Firmware version
+	{  3, 1,   7, 1, UNIT_RAW },		// ID
+	{  5, 1,   9, 1, UNIT_RAW },		// Return delay time
+	{  6, 2,  52, 4, UNIT_POSITION },	// CW angle limit / min position limit
+	{  8, 2,  48, 4, UNIT_POSITION },	// CCW angle limit / max position limit
+	{ 11, 1,  31, 1, UNIT_RAW },		// Temperature limit
+	{ 12, 1,  34, 2, UNIT_RAW },		// Min voltage limit
+	{ 13, 1,  32, 2, UNIT_RAW },		// Max voltage limit
+	{ 14, 2,  36, 2, UNIT_TORQUE },		// Max torque / PWM limit
+	{ 16, 1,  68, 1, UNIT_RAW },		// Status return level
+	{ 18, 1,  63, 1, UNIT_RAW },		// Alarm shutdown / shutdown
+	{ 24, 1,  64, 1, UNIT_RAW },		// Torque enable
+	{ 25, 1,  65, 1, UNIT_RAW },		// LED
+	{ 30, 2, 116, 4, UNIT_POSITION },	// Goal position
+	{ 32, 2, 112, 4, UNIT_SPEED },		// Moving speed / profile velocity
+	{ 34, 2, 100, 2, UNIT_TORQUE },		// Torque limit / goal PWM
+	{ 36, 2, 132, 4, UNIT_POSITION },	// Present position
+	{ 38, 2, 128, 4, UNIT_VELOCITY },	// Present speed / present velocity
+	{ 40, 2, 126, 2, UNIT_LOAD },		// Present load
+	{ 42, 1, 144, 2, UNIT_RAW },		// Present voltage
+	{ 43, 1, 146, 1, UNIT_RAW },		// Present temperature
+	{ 44, 1,  69, 1, UNIT_RAW },		// Registered instruction
+	{ 46, 1, 122, 1, UNIT_RAW },		// Moving
+};
+
+// X registers of an AX address window, sorted by X address
+typedef struct
+{
+	const AxToXRegister *reg[MAXNUM_WINDOW_REG];
+	int numReg;
+	int axAddress;
+	int axLength;
+	int xAddress;		// Smallest block of X registers holding the whole window
+	int xLength;
+} AxWindow;
+
+
+static const AxToXRegister *dxl2_ax_find( int axAddress )
+{
+	int i;
+
+	for( i=0; i<(int)(sizeof(axToX)/sizeof(axToX[0])); i++ )
+	{
+		if( axToX[i].axAddress == axAddress )
+			return &axToX[i];
+	}
+	return 0;
+}
+
+static int dxl2_ax_window( AxWindow *w, int axAddress, int axLength )
+{
+	const AxToXRegister *reg;
+	int i, j, address = axAddress, end = 0;
+
+	w->numReg = 0;
+	w->axAddress = axAddress;
+	w->axLength = axLength;
+	while( address < axAddress + axLength )
+	{
+		reg = dxl2_ax_find(address);
+		if( reg == 0 || w->numReg >= MAXNUM_WINDOW_REG )
+			return 0;
+
+		// Insertion sort on the X address
+		for( i=w->numReg; i>0 && w->reg[i-1]->xAddress > reg->xAddress; i-- )
+			w->reg[i] = w->reg[i-1];
+		w->reg[i] = reg;
+		w->numReg++;
+		address += reg->axSize;
+	}
+	// The window must not end in the middle of a word
+	if( address != axAddress + axLength || w->numReg == 0 )
+		return 0;
+
+	w->xAddress = w->reg[0]->xAddress;
+	for( j=0; j<w->numReg; j++ )
+	{
+		if( w->reg[j]->xAddress + w->reg[j]->xSize > end )
+			end = w->reg[j]->xAddress + w->reg[j]->xSize;
+	}
+	w->xLength = end - w->xAddress;
+	return 1;
+}
+
+static int dxl2_round_div( long num, long den )
+{
+	return (int)((num >= 0) ? (num + den/2)/den : -((-num + den/2)/den));
+}
+
+static int dxl2_clamp( int value, int min, int max )
+{
+	return (value < min) ? min : ((value > max) ? max : value);
+}
+
+static long dxl2_ax_to_x( const AxToXRegister *reg, int value )
+{
+	int magnitude = value & 0x3ff;
+
+	switch( reg->unit )
+	{
+	case UNIT_POSITION:
+		return 2048 + dxl2_round_div((long)(value - 512)*10, 3);
+	case UNIT_SPEED:
+		return dxl2_round_div((long)value*111, 229);
+	case UNIT_VELOCITY:
+		magnitude = dxl2_round_div((long)magnitude*111, 229);
+		return (value & 0x400) ? -magnitude : magnitude;
+	case UNIT_LOAD:
+		return (value & 0x400) ? -magnitude : magnitude;
+	case UNIT_TORQUE:
+		return dxl2_round_div((long)value*X_PWM_MAX, 1023);
+	default:
+		return value;
+	}
+}
+
+static int dxl2_x_to_ax( const AxToXRegister *reg, long value )
+{
+	int magnitude;
+
+	switch( reg->unit )
+	{
+	case UNIT_POSITION:
+		return dxl2_clamp(512 + dxl2_round_div((value - 2048)*3, 10), 0, 1023);
+	case UNIT_SPEED:
+		return dxl2_clamp(dxl2_round_div(value*229, 111), 0, 1023);
+	case UNIT_VELOCITY:
+		magnitude = dxl2_clamp(dxl2_round_div(((value < 0) ? -value : value)*229, 111), 0, 1023);
+		return (value < 0) ? (magnitude | 0x400) : magnitude;
+	case UNIT_LOAD:
+		magnitude = dxl2_clamp((value < 0) ? -value : value, 0, 1023);
+		return (value < 0) ? (magnitude | 0x400) : magnitude;
+	case UNIT_TORQUE:
+		return dxl2_clamp(dxl2_round_div(value*1023, X_PWM_MAX), 0, 1023);
+	default:
+		return (int)(value & ((reg->axSize == 2) ? 0xffff : 0xff));
+	}
+}
+
+static long dxl2_get_value( const unsigned char *p, int size, int isSigned )
+{
+	unsigned long value = 0;
+	int i;
+
+	for( i=size-1; i>=0; i-- )
+		value = (value << 8) | p[i];
+	if( isSigned && size < 4 && (value & (1ul << (8*size - 1))) )
+		value |= ~((1ul << (8*size)) - 1);
+	if( isSigned && size == 4 )
+		return (long)(int)value;
+	return (long)value;
+}
+
+static void dxl2_put_value( unsigned char *p, int size, long value )
+{
+	int i;
+
+	for( i=0; i<size; i++ )
+		p[i] = (unsigned char)((value >> (8*i)) & 0xff);
+}
+
+static int dxl2_ax_signed( const AxToXRegister *reg )
+{
+	return reg->unit == UNIT_VELOCITY || reg->unit == UNIT_LOAD;
+}
+
+// X block bytes of one motor -> AX window bytes
+static void dxl2_ax_decode( const AxWindow *w, const unsigned char *pBlock, unsigned char *pAx )
+{
+	const AxToXRegister *reg;
+	long value;
+	int i;
+
+	for( i=0; i<w->numReg; i++ )
+	{
+		reg = w->reg[i];
+		value = dxl2_get_value(&pBlock[reg->xAddress - w->xAddress], reg->xSize, dxl2_ax_signed(reg));
+		dxl2_put_value(&pAx[reg->axAddress - w->axAddress], reg->axSize, dxl2_x_to_ax(reg, value));
+	}
+}
+
+// AX window bytes of one motor -> bytes of the X registers first..first+count-1
+static void dxl2_ax_encode( const AxWindow *w, int first, int count, const unsigned char *pAx, unsigned char *pX )
+{
+	const AxToXRegister *reg;
+	int i, value;
+
+	for( i=first; i<first+count; i++ )
+	{
+		reg = w->reg[i];
+		value = (int)dxl2_get_value(&pAx[reg->axAddress - w->axAddress], reg->axSize, 0);
+		dxl2_put_value(pX, reg->xSize, dxl2_ax_to_x(reg, value));
+		pX += reg->xSize;
+	}
+}
+
+// Number of registers, from first, that are contiguous in the X control table
+static int dxl2_ax_run( const AxWindow *w, int first, int *pLength )
+{
+	int count = 1;
+
+	*pLength = w->reg[first]->xSize;
+	while( first + count < w->numReg
+		&& w->reg[first + count]->xAddress == w->reg[first]->xAddress + *pLength )
+	{
+		*pLength += w->reg[first + count]->xSize;
+		count++;
+	}
+	return count;
+}
+
+static int dxl2_ax_error( int error )
+{
+	int errbit = 0;
+
+	switch( error & DXL2_ERR_NUMBER_MASK )
+	{
+	case DXL2_ERR_RESULT_FAIL:
+	case DXL2_ERR_INSTRUCTION:
+	case DXL2_ERR_ACCESS:
+		errbit |= ERRBIT_INSTRUCTION;
+		break;
+	case DXL2_ERR_CRC:
+		errbit |= ERRBIT_CHECKSUM;
+		break;
+	case DXL2_ERR_DATA_RANGE:
+	case DXL2_ERR_DATA_LENGTH:
+	case DXL2_ERR_DATA_LIMIT:
+		errbit |= ERRBIT_RANGE;
+		break;
+	}
+	// The cause (overheating, overload, voltage...) is in the Hardware Error Status register
+	if( error & DXL2_ERR_ALERT )
+		errbit |= ERRBIT_OVERLOAD;
+	return errbit;
+}
+
+static void dxl2_ax_set_status( DxlBus *bus, int id, int error, const unsigned char *pParam, int numParam )
+{
+	unsigned char checksum = 0;
+	int i;
+
+	bus->statusPacket[0] = 0xff;
+	bus->statusPacket[1] = 0xff;
+	bus->statusPacket[ID] = (unsigned char)id;
+	bus->statusPacket[LENGTH] = (unsigned char)(numParam + 2);
+	bus->statusPacket[ERRBIT] = (unsigned char)dxl2_ax_error(error);
+	if( numParam > 0 )
+		memcpy(&bus->statusPacket[PARAMETER], pParam, numParam);
+	for( i=0; i<numParam+3; i++ )
+		checksum += bus->statusPacket[i+2];
+	bus->statusPacket[PARAMETER+numParam] = ~checksum;
+}
+
+static void dxl2_ax_fail( DxlBus *bus, int commStatus )
+{
+	bus->commStatus = commStatus;
+	bus->busUsing = 0;
+}
+
+// WRITE and REG_WRITE: one X write per run of contiguous registers. All but the last
+// are completed here, the status packet of the last one is collected by the rx side.
+static void dxl2_ax_tx_write( DxlBus *bus, int instruction )
+{
+	unsigned char *pInst = bus->instructionPacket;
+	unsigned char param[2 + 4*MAXNUM_WINDOW_REG];
+	AxWindow w;
+	int first, count, length, id = pInst[ID];
+	Dxl2Bus *p2 = &bus->p2;
+
+	if( !dxl2_ax_window(&w, pInst[PARAMETER], pInst[LENGTH] - 3) )
+	{
+		dxl2_ax_fail(bus, COMM_TXERROR);
+		return;
+	}
+
+	for( first=0; first<w.numReg; first+=count )
+	{
+		count = dxl2_ax_run(&w, first, &length);
+
+		// Only one registered instruction can be pending in a motor
+		if( instruction == DXL2_INST_REG_WRITE && count < w.numReg )
+		{
+			dxl2_ax_fail(bus, COMM_TXERROR);
+			return;
+		}
+
+		param[0] = (unsigned char)(w.reg[first]->xAddress & 0xff);
+		param[1] = (unsigned char)(w.reg[first]->xAddress >> 8);
+		dxl2_ax_encode(&w, first, count, &pInst[PARAMETER+1], &param[2]);
+
+		if( first + count < w.numReg )
+		{
+			if( dxl2_bus_write(p2, id, w.reg[first]->xAddress, length, &param[2]) != COMM_RXSUCCESS )
+			{
+				dxl2_ax_fail(bus, p2->commStatus);
+				return;
+			}
+		}
+		else
+			dxl2_bus_tx(p2, id, instruction, param, length + 2, 11);
+	}
+}
+
+static void dxl2_ax_tx_sync_write( DxlBus *bus )
+{
+	unsigned char *pInst = bus->instructionPacket;
+	unsigned char ids[MAXNUM_TXPARAM];
+	unsigned char data[DXL2_MAXNUM_TXPACKET];
+	AxWindow w;
+	int i, first, count, length, numId;
+	int axLength = pInst[PARAMETER+1];
+	Dxl2Bus *p2 = &bus->p2;
+
+	if( !dxl2_ax_window(&w, pInst[PARAMETER], axLength) )
+	{
+		dxl2_ax_fail(bus, COMM_TXERROR);
+		return;
+	}
+	numId = (pInst[LENGTH] - 4)/(axLength + 1);
+
+	for( first=0; first<w.numReg; first+=count )
+	{
+		count = dxl2_ax_run(&w, first, &length);
+		if( numId*length > DXL2_MAXNUM_TXPACKET )
+		{
+			dxl2_ax_fail(bus, COMM_TXERROR);
+			return;
+		}
+		for( i=0; i<numId; i++ )
+		{
+			ids[i] = pInst[PARAMETER + 2 + i*(axLength + 1)];
+			dxl2_ax_encode(&w, first, count, &pInst[PARAMETER + 3 + i*(axLength + 1)], &data[i*length]);
+		}
+		if( dxl2_bus_sync_write(p2, w.reg[first]->xAddress, length, numId, ids, data) != COMM_RXSUCCESS )
+		{
+			dxl2_ax_fail(bus, p2->commStatus);
+			return;
+		}
+	}
+}
+
+void dxl2_ax_tx_packet( DxlBus *bus )
+{
+	unsigned char *pInst = bus->instructionPacket;
+	unsigned char param[4];
+	AxWindow w;
+	int id = pInst[ID];
+	Dxl2Bus *p2 = &bus->p2;
+
+	if( bus->busUsing == 1 )
+		return;
+
+	bus->busUsing = 1;
+	// p2->commStatus keeps the outcome of the previous transaction, so that dxl2_bus_tx flushes
+	// a late reply after a timeout; it is COMM_TXSUCCESS once the packet is sent
+
+	switch( pInst[INSTRUCTION] )
+	{
+	case INST_PING:
+		dxl2_bus_tx(p2, id, DXL2_INST_PING, 0, 0, 14);
+		break;
+
+	case INST_READ:
+		if( !dxl2_ax_window(&w, pInst[PARAMETER], pInst[PARAMETER+1]) )
+		{
+			dxl2_ax_fail(bus, COMM_TXERROR);
+			return;
+		}
+		param[0] = (unsigned char)(w.xAddress & 0xff);
+		param[1] = (unsigned char)(w.xAddress >> 8);
+		param[2] = (unsigned char)(w.xLength & 0xff);
+		param[3] = (unsigned char)(w.xLength >> 8);
+		dxl2_bus_tx(p2, id, DXL2_INST_READ, param, 4, 11 + w.xLength);
+		break;
+
+	case INST_WRITE:
+		dxl2_ax_tx_write(bus, DXL2_INST_WRITE);
+		break;
+
+	case INST_REG_WRITE:
+		dxl2_ax_tx_write(bus, DXL2_INST_REG_WRITE);
+		break;
+
+	case INST_ACTION:
+		dxl2_bus_tx(p2, id, DXL2_INST_ACTION, 0, 0, 11);
+		break;
+
+	case INST_SYNC_WRITE:
+		dxl2_ax_tx_sync_write(bus);
+		break;
+
+	case INST_SYNC_READ:
+		if( !dxl2_ax_window(&w, pInst[PARAMETER], pInst[PARAMETER+1]) )
+		{
+			dxl2_ax_fail(bus, COMM_TXERROR);
+			return;
+		}
+		dxl2_bus_sync_read_tx(p2, bus->fastSyncRead, w.xAddress, w.xLength,
+							pInst[LENGTH] - 4, &pInst[PARAMETER+2]);
+		break;
+
+	default:
+		dxl2_ax_fail(bus, COMM_TXERROR);
+		return;
+	}
+
+	if( bus->busUsing == 0 )
+		return;
+	if( p2->commStatus != COMM_TXSUCCESS && p2->commStatus != COMM_RXSUCCESS )
+	{
+		dxl2_ax_fail(bus, p2->commStatus);
+		return;
+	}
+	bus->commStatus = COMM_TXSUCCESS;
+}
+
+void dxl2_ax_rx_packet( DxlBus *bus )
+{
+	unsigned char *pInst = bus->instructionPacket;
+	unsigned char block[DXL2_MAXNUM_RXPACKET];
+	unsigned char values[DXL_RING_MAX_PACKET];
+	AxWindow w;
+	int i, numId, id = pInst[ID];
+	Dxl2Bus *p2 = &bus->p2;
+
+	if( bus->busUsing == 0 || bus->commStatus != COMM_TXSUCCESS )
+		return;
+
+	// Nothing to receive after a broadcast, including sync_write
+	if( id == BROADCAST_ID )
+	{
+		dxl2_ax_fail(bus, COMM_RXSUCCESS);
+		return;
+	}
+
+	switch( pInst[INSTRUCTION] )
+	{
+	case INST_READ:
+		dxl2_ax_window(&w, pInst[PARAMETER], pInst[PARAMETER+1]);
+		if( dxl2_bus_rx(p2, id) != COMM_RXSUCCESS )
+			break;
+		if( dxl2_bus_rx_param_length(p2) < w.xLength )
+		{
+			p2->commStatus = COMM_RXCORRUPT;
+			break;
+		}
+		dxl2_ax_decode(&w, dxl2_bus_rx_param(p2), values);
+		dxl2_ax_set_status(bus, id, p2->error, values, w.axLength);
+		break;
+
+	case INST_SYNC_READ:
+		dxl2_ax_window(&w, pInst[PARAMETER], pInst[PARAMETER+1]);
+		numId = pInst[LENGTH] - 4;
+		if( numId*w.xLength > DXL2_MAXNUM_RXPACKET || numId*w.axLength > DXL_RING_MAX_PACKET - 6 )
+		{
+			p2->commStatus = COMM_RXCORRUPT;
+			break;
+		}
+		if( dxl2_bus_sync_read_rx(p2, bus->fastSyncRead, w.xLength, numId, &pInst[PARAMETER+2], block) != COMM_RXSUCCESS )
+			break;
+		// Same layout as the USB2AX sync_read reply: the AX window of each motor in turn
+		for( i=0; i<numId; i++ )
+			dxl2_ax_decode(&w, &block[i*w.xLength], &values[i*w.axLength]);
+		dxl2_ax_set_status(bus, id, p2->error, values, numId*w.axLength);
+		break;
+
+	default:
+		// PING, WRITE, REG_WRITE, ACTION: status packet without data
+		if( dxl2_bus_rx(p2, id) == COMM_RXSUCCESS )
+			dxl2_ax_set_status(bus, id, p2->error, 0, 0);
+		break;
+	}
+
+	dxl2_ax_fail(bus, p2->commStatus);
+}
+
+void dxl2_ax_bulk_read_send( DxlBus *bus )
+{
+	unsigned char *pInst = bus->instructionPacket;
+	unsigned char ids[MAXNUM_TXPARAM/3] = { 0 };
+	int xAddress[MAXNUM_TXPARAM/3] = { 0 }, xLength[MAXNUM_TXPARAM/3] = { 0 };
+	unsigned char block[DXL2_MAXNUM_RXPACKET];
+	AxWindow w;
+	int i, nbEntries, total = 0, offset = 0;
+	Dxl2Bus *p2 = &bus->p2;
+
+	nbEntries = (bus->syncNbParam - 1) / 3;
+	bus->syncNbParam = 0;
+	bus->bulkNbData = 0;
+	bus->bulkPopIndex = 0;
+
+	if( nbEntries <= 0 || nbEntries > MAXNUM_TXPARAM/3 )
+	{
+		bus->commStatus = COMM_TXERROR;
+		return;
+	}
+	for( i=0; i<nbEntries; i++ )
+	{
+		ids[i] = pInst[PARAMETER+2+3*i];
+		if( !dxl2_ax_window(&w, pInst[PARAMETER+3+3*i], pInst[PARAMETER+1+3*i]) )
+		{
+			bus->commStatus = COMM_TXERROR;
+			return;
+		}
+		xAddress[i] = w.xAddress;
+		xLength[i] = w.xLength;
+		total += w.xLength;
+	}
+	if( total > DXL2_MAXNUM_RXPACKET )
+	{
+		bus->commStatus = COMM_TXERROR;
+		return;
+	}
+
+	bus->commStatus = dxl2_bus_bulk_read(p2, nbEntries, ids, xAddress, xLength, block);
+	if( bus->commStatus != COMM_RXSUCCESS )
+		return;
+
+	for( i=0; i<nbEntries; i++ )
+	{
+		dxl2_ax_window(&w, pInst[PARAMETER+3+3*i], pInst[PARAMETER+1+3*i]);
+		if( bus->bulkNbData + w.axLength > MAXNUM_RXPARAM )
+		{
+			bus->commStatus = COMM_RXCORRUPT;
+			return;
+		}
+		dxl2_ax_decode(&w, &block[offset], &bus->bulkData[bus->bulkNbData]);
+		bus->bulkNbData += w.axLength;
+		offset += w.xLength;
+	}
+	dxl2_ax_set_status(bus, BROADCAST_ID, p2->error, 0, 0);
+}
@@ -0,0 +1,26 @@
+#ifndef _DYNAMIXEL2_AX_HEADER
+#define _DYNAMIXEL2_AX_HEADER
+
+#include "dynamixel_syncread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// AX-12 control table emulation for Protocol 2.0 buses (XL430 / XM430 control table).
+// The instruction packet built by the dxl_bus_* functions (AX addresses and units) is
+// translated to Protocol 2.0 packets on the X registers, and the replies are converted
+// back into an AX status packet, so callers do not need to know the bus protocol.
+// Called by dynamixel_syncread.c when bus->protocol is DXL_PROTOCOL_2.
+
+void dxl2_ax_tx_packet( DxlBus *bus );
+void dxl2_ax_rx_packet( DxlBus *bus );
+void dxl2_ax_bulk_read_send( DxlBus *bus );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,8 @@
+#include <string.h>
 #include "dxl_hal.h"
 #include "dynamixel_syncread.h"
+#include "dynamixel2_ax.h"
+#include "dxl_stats.h"
 
 #define ID					(2)
 #define LENGTH				(3)
@@ -8,244 +11,422 @@
 #define PARAMETER			(5)
 #define DEFAULT_BAUDNUMBER	(1)
 
-unsigned char gbInstructionPacket[MAXNUM_TXPARAM+10] = {0};
-unsigned char gbStatusPacket[MAXNUM_RXPARAM+10] = {0};
-unsigned char gbRxPacketLength = 0;
-unsigned char gbRxGetLength = 0;
-int gbCommStatus = COMM_RXSUCCESS;
-int giBusUsing = 0;
+DxlBus gDefaultBus = { 0 };
+int giDefaultBusReady = 0;
 
 
-int dxl_initialize( int devIndex, int baudnum )
+void dxl_bus_init( DxlBus *bus )
+{
+	memset(bus, 0, sizeof(DxlBus));
+	dxl_port_init(&bus->ownPort);
+	dxl_ring_init(&bus->rxRing);
+	bus->port = &bus->ownPort;
+	dxl2_bus_init(&bus->p2, bus->port);
+	bus->protocol = DXL_PROTOCOL_1;
+	bus->fastSyncRead = 1;
+	bus->commStatus = COMM_RXSUCCESS;
+	bus->busUsing = 0;
+	memset(bus->statusReturnLevel, DXL_STATUS_RETURN_ALL, sizeof(bus->statusReturnLevel));
+}
+
+DxlBus *dxl_default_bus()
+{
+	if( giDefaultBusReady == 0 )
+	{
+		// The default bus shares its port with the dxl_hal_* functions
+		dxl_bus_init(&gDefaultBus);
+		gDefaultBus.port = dxl_hal_default_port();
+		gDefaultBus.p2.port = gDefaultBus.port;
+		giDefaultBusReady = 1;
+	}
+	return &gDefaultBus;
+}
+
+int dxl_bus_initialize( DxlBus *bus, int devIndex, int baudnum )
 {
 	float baudrate;	
 	baudrate = 2000000.0f / (float)(baudnum + 1);
 	
-	if( dxl_hal_open(devIndex, baudrate) == 0 )
+	if( dxl_port_open(bus->port, devIndex, baudrate) == 0 )
 		return 0;
 
-	gbCommStatus = COMM_RXSUCCESS;
-	giBusUsing = 0;
+	bus->commStatus = COMM_RXSUCCESS;
+	bus->busUsing = 0;
 	return 1;
 }
 
-void dxl_terminate()
+int dxl_bus_initialize_path( DxlBus *bus, const char *deviceName, int baudnum )
+{
+	float baudrate;	
+	baudrate = 2000000.0f / (float)(baudnum + 1);
+	
+	if( dxl_port_open_path(bus->port, deviceName, baudrate) == 0 )
+		return 0;
+
+	bus->commStatus = COMM_RXSUCCESS;
+	bus->busUsing = 0;
+	return 1;
+}
+
+void dxl_bus_terminate( DxlBus *bus )
 {
-	dxl_hal_close();
+	dxl_port_close(bus->port);
 }
 
-void dxl_tx_packet()
+void dxl_bus_set_protocol( DxlBus *bus, int protocol )
 {
-	unsigned char i;
-	unsigned char TxNumByte, RealTxNumByte;
-	unsigned char checksum = 0;
+	bus->protocol = protocol;
+}
+
+int dxl_bus_get_protocol( DxlBus *bus )
+{
+	return bus->protocol;
+}
+
+// Protocol 2.0 only: all motors answer a sync_read in a single status packet
+void dxl_bus_set_fast_sync_read( DxlBus *bus, int enable )
+{
+	bus->fastSyncRead = enable;
+}
 
-	if( giBusUsing == 1 )
+void dxl_bus_set_timing( DxlBus *bus, int timingClass, float baseMs, float perByteMs, float perMotorMs )
+{
+	if( timingClass < 0 || timingClass >= DXL_NUM_TIMING )
 		return;
-	
-	giBusUsing = 1;
 
-	if( gbInstructionPacket[LENGTH] > (MAXNUM_TXPARAM+2) )
+	bus->timing[timingClass].baseMs = baseMs;
+	bus->timing[timingClass].perByteMs = perByteMs;
+	bus->timing[timingClass].perMotorMs = perMotorMs;
+	bus->timing[timingClass].calibrated = 1;
+}
+
+void dxl_bus_clear_timing( DxlBus *bus )
+{
+	memset(bus->timing, 0, sizeof(bus->timing));
+}
+
+void dxl_bus_set_status_return_level( DxlBus *bus, int id, int level )
+{
+	if( id == BROADCAST_ID )
+		memset(bus->statusReturnLevel, level, sizeof(bus->statusReturnLevel));
+	else if( id >= 0 && id < DXL_NUM_DEVICE_ID )
+		bus->statusReturnLevel[id] = (unsigned char)level;
+}
+
+int dxl_bus_get_status_return_level( DxlBus *bus, int id )
+{
+	if( id < 0 || id >= DXL_NUM_DEVICE_ID )
+		return DXL_STATUS_RETURN_ALL;
+	return bus->statusReturnLevel[id];
+}
+
+// Follow the writes to the status return level of the instruction about to be sent
+static void dxl_bus_track_status_return_level( DxlBus *bus )
+{
+	int address, numByte, dataLength, i;
+	unsigned char *pParam = &bus->instructionPacket[PARAMETER];
+
+	if( bus->instructionPacket[INSTRUCTION] == INST_WRITE )
 	{
-		gbCommStatus = COMM_TXERROR;
-		giBusUsing = 0;
-		return;
+		address = pParam[0];
+		numByte = bus->instructionPacket[LENGTH] - 3;
+		if( address <= DXL_STATUS_RETURN_ADDRESS && DXL_STATUS_RETURN_ADDRESS < address + numByte )
+			dxl_bus_set_status_return_level( bus, bus->instructionPacket[ID],
+				pParam[1 + DXL_STATUS_RETURN_ADDRESS - address] );
 	}
-	
-	if( gbInstructionPacket[INSTRUCTION] != INST_PING
-		&& gbInstructionPacket[INSTRUCTION] != INST_READ
-		&& gbInstructionPacket[INSTRUCTION] != INST_WRITE
-		&& gbInstructionPacket[INSTRUCTION] != INST_REG_WRITE
-		&& gbInstructionPacket[INSTRUCTION] != INST_ACTION
-		&& gbInstructionPacket[INSTRUCTION] != INST_RESET
-		&& gbInstructionPacket[INSTRUCTION] != INST_SYNC_WRITE
-		&& gbInstructionPacket[INSTRUCTION] != INST_SYNC_READ)
+	else if( bus->instructionPacket[INSTRUCTION] == INST_SYNC_WRITE )
 	{
-		gbCommStatus = COMM_TXERROR;
-		giBusUsing = 0;
-		return;
+		address = pParam[0];
+		dataLength = pParam[1];
+		if( address > DXL_STATUS_RETURN_ADDRESS || DXL_STATUS_RETURN_ADDRESS >= address + dataLength )
+			return;
+		for( i=2; i+dataLength < bus->instructionPacket[LENGTH] - 2; i+=dataLength+1 )
+			dxl_bus_set_status_return_level( bus, pParam[i], pParam[i + 1 + DXL_STATUS_RETURN_ADDRESS - address] );
 	}
-	
-	gbInstructionPacket[0] = 0xff;
-	gbInstructionPacket[1] = 0xff;
-	for( i=0; i<(gbInstructionPacket[LENGTH]+1); i++ )
-		checksum += gbInstructionPacket[i+2];
-	gbInstructionPacket[gbInstructionPacket[LENGTH]+3] = ~checksum;
-	
-	if( gbCommStatus == COMM_RXTIMEOUT || gbCommStatus == COMM_RXCORRUPT )
-		dxl_hal_clear();
+}
 
-	TxNumByte = gbInstructionPacket[LENGTH] + 4;
-	RealTxNumByte = dxl_hal_tx( (unsigned char*)gbInstructionPacket, TxNumByte );
+// Whether the instruction being sent gets a status packet back
+static int dxl_bus_status_expected( DxlBus *bus )
+{
+	int id = bus->instructionPacket[ID];
 
-	if( TxNumByte != RealTxNumByte )
+	if( id == BROADCAST_ID )
+		return 0;
+
+	switch( bus->instructionPacket[INSTRUCTION] )
 	{
-		gbCommStatus = COMM_TXFAIL;
-		giBusUsing = 0;
-		return;
+	case INST_PING:
+	case INST_SYNC_READ:	// Answered by the USB2AX
+	case INST_BULK_READ:
+		return 1;
+	case INST_READ:
+		return dxl_bus_get_status_return_level(bus, id) >= DXL_STATUS_RETURN_READ;
+	default:
+		return dxl_bus_get_status_return_level(bus, id) >= DXL_STATUS_RETURN_ALL;
 	}
+}
 
-	if( gbInstructionPacket[INSTRUCTION] == INST_READ )
-		dxl_hal_set_timeout( gbInstructionPacket[PARAMETER+1] + 6 );
-	else if ( gbInstructionPacket[INSTRUCTION] == INST_SYNC_READ )
-        dxl_hal_set_timeout( gbInstructionPacket[PARAMETER+1] + 6 );
-    else
-		dxl_hal_set_timeout( 6 );
+static void dxl_bus_set_rx_timeout( DxlBus *bus, int timingClass, int numRcvByte, int numMotor )
+{
+	DxlTiming *pTiming = &bus->timing[timingClass];
 
-	gbCommStatus = COMM_TXSUCCESS;
+	if( pTiming->calibrated )
+		dxl_port_set_timeout_ms( bus->port, pTiming->baseMs + pTiming->perByteMs*numRcvByte
+			+ pTiming->perMotorMs*numMotor );
+	else
+		dxl_port_set_timeout( bus->port, numRcvByte );
 }
 
-void dxl_rx_packet()
+void dxl_bus_tx_packet( DxlBus *bus )
 {
-	unsigned char i, j, nRead;
+	unsigned char i;
+	unsigned char TxNumByte, RealTxNumByte;
+	int numMotor;
 	unsigned char checksum = 0;
 
-	if( giBusUsing == 0 )
-		return;
+	bus->txTime = dxl_stats_now_us();
 
-	if( gbInstructionPacket[ID] == BROADCAST_ID )
+	if( bus->protocol == DXL_PROTOCOL_2 )
 	{
-		gbCommStatus = COMM_RXSUCCESS;
-		giBusUsing = 0;
+		dxl2_ax_tx_packet(bus);
 		return;
 	}
+
+	if( bus->busUsing == 1 )
+		return;
 	
-	if( gbCommStatus == COMM_TXSUCCESS )
+	bus->busUsing = 1;
+
+	if( bus->instructionPacket[LENGTH] > (MAXNUM_TXPARAM+2) )
 	{
-		gbRxGetLength = 0;
-		gbRxPacketLength = 6;
+		bus->commStatus = COMM_TXERROR;
+		bus->busUsing = 0;
+		return;
 	}
 	
-	nRead = dxl_hal_rx( (unsigned char*)&gbStatusPacket[gbRxGetLength], gbRxPacketLength - gbRxGetLength );
-	gbRxGetLength += nRead;
-	if( gbRxGetLength < gbRxPacketLength )
+	if( bus->instructionPacket[INSTRUCTION] != INST_PING
+		&& bus->instructionPacket[INSTRUCTION] != INST_READ
+		&& bus->instructionPacket[INSTRUCTION] != INST_WRITE
+		&& bus->instructionPacket[INSTRUCTION] != INST_REG_WRITE
+		&& bus->instructionPacket[INSTRUCTION] != INST_ACTION
+		&& bus->instructionPacket[INSTRUCTION] != INST_RESET
+		&& bus->instructionPacket[INSTRUCTION] != INST_SYNC_WRITE
+		&& bus->instructionPacket[INSTRUCTION] != INST_SYNC_READ
+		&& bus->instructionPacket[INSTRUCTION] != INST_BULK_READ)
 	{
-		if( dxl_hal_timeout() == 1 )
-		{
-			if(gbRxGetLength == 0)
-				gbCommStatus = COMM_RXTIMEOUT;
-			else
-				gbCommStatus = COMM_RXCORRUPT;
-			giBusUsing = 0;
-			return;
-		}
+		bus->commStatus = COMM_TXERROR;
+		bus->busUsing = 0;
+		return;
 	}
 	
-	// Find packet header
-	for( i=0; i<(gbRxGetLength-1); i++ )
+	bus->instructionPacket[0] = 0xff;
+	bus->instructionPacket[1] = 0xff;
+	for( i=0; i<(bus->instructionPacket[LENGTH]+1); i++ )
+		checksum += bus->instructionPacket[i+2];
+	bus->instructionPacket[bus->instructionPacket[LENGTH]+3] = ~checksum;
+	
+	if( bus->commStatus == COMM_RXTIMEOUT || bus->commStatus == COMM_RXCORRUPT )
+		dxl_port_clear(bus->port);
+	dxl_ring_reset(&bus->rxRing);
+
+	TxNumByte = bus->instructionPacket[LENGTH] + 4;
+	RealTxNumByte = dxl_port_tx( bus->port, (unsigned char*)bus->instructionPacket, TxNumByte );
+
+	if( TxNumByte != RealTxNumByte )
 	{
-		if( gbStatusPacket[i] == 0xff && gbStatusPacket[i+1] == 0xff )
-		{
-			break;
-		}
-		else if( i == gbRxGetLength-2 && gbStatusPacket[gbRxGetLength-1] == 0xff )
-		{
-			break;
-		}
-	}	
-	if( i > 0 )
+		bus->commStatus = COMM_TXFAIL;
+		bus->busUsing = 0;
+		return;
+	}
+
+	dxl_bus_track_status_return_level(bus);
+
+	if( bus->instructionPacket[INSTRUCTION] == INST_READ )
+		dxl_bus_set_rx_timeout( bus, DXL_TIMING_READ, bus->instructionPacket[PARAMETER+1] + 6, 1 );
+	else if ( bus->instructionPacket[INSTRUCTION] == INST_SYNC_READ )
 	{
-		for( j=0; j<(gbRxGetLength-i); j++ )
-			gbStatusPacket[j] = gbStatusPacket[j + i];
-			
-		gbRxGetLength -= i;		
+		// The IDs follow the address and data length
+		numMotor = bus->instructionPacket[LENGTH] - 4;
+		if( bus->timing[DXL_TIMING_SYNC_READ].calibrated )
+			dxl_bus_set_rx_timeout( bus, DXL_TIMING_SYNC_READ, numMotor*bus->instructionPacket[PARAMETER+1] + 6, numMotor );
+		else
+			dxl_port_set_timeout( bus->port, bus->instructionPacket[PARAMETER+1] + 6 );
 	}
+    else
+		dxl_bus_set_rx_timeout( bus, DXL_TIMING_STATUS, 6, 1 );
 
-	if( gbRxGetLength < gbRxPacketLength )
+	bus->commStatus = COMM_TXSUCCESS;
+}
+
+// Take the next status packet out of the receive ring, if a complete one is there
+static int dxl_bus_parse_status( DxlBus *bus )
+{
+	DxlRingPacket packet;
+
+	if( dxl_ring_parse(&bus->rxRing, &packet) != DXL_RING_PACKET )
+		return 0;
+
+	dxl_ring_packet_copy(&bus->rxRing, &packet, bus->statusPacket);
+
+	// Check id pairing
+	if( bus->instructionPacket[ID] != bus->statusPacket[ID] )
+		bus->commStatus = COMM_RXCORRUPT;
+	else
+		bus->commStatus = COMM_RXSUCCESS;
+	bus->busUsing = 0;
+	return 1;
+}
+
+void dxl_bus_rx_packet( DxlBus *bus )
+{
+	int nRead, contiguous;
+	unsigned char *pDest;
+
+	if( bus->protocol == DXL_PROTOCOL_2 )
 	{
-		gbCommStatus = COMM_RXWAITING;
+		dxl2_ax_rx_packet(bus);
 		return;
 	}
 
-	// Check id pairing
-	if( gbInstructionPacket[ID] != gbStatusPacket[ID])
+	if( bus->busUsing == 0 )
+		return;
+
+	// Broadcasts, and writes to a motor whose status return level is below 2, cost only their TX bytes.
+	// A read of a motor at level 0 is never answered: it fails, rather than leave the last status
+	// packet to be taken for its reply.
+	if( !dxl_bus_status_expected(bus) )
 	{
-		gbCommStatus = COMM_RXCORRUPT;
-		giBusUsing = 0;
+		if( bus->instructionPacket[INSTRUCTION] == INST_READ && bus->instructionPacket[ID] != BROADCAST_ID )
+			bus->commStatus = COMM_RXFAIL;
+		else
+			bus->commStatus = COMM_RXSUCCESS;
+		bus->busUsing = 0;
 		return;
 	}
 	
-	gbRxPacketLength = gbStatusPacket[LENGTH] + 4;
-	if( gbRxGetLength < gbRxPacketLength )
+	if( bus->commStatus == COMM_TXSUCCESS )
+		bus->rxGetLength = 0;
+
+	// Bytes left over from a previous packet of a sync_read or bulk_read reply come first
+	if( dxl_bus_parse_status(bus) )
+		return;
+
+	pDest = dxl_ring_write_ptr(&bus->rxRing, &contiguous);
+	nRead = dxl_port_rx( bus->port, pDest, contiguous );
+	if( nRead > 0 )
 	{
-		nRead = dxl_hal_rx( (unsigned char*)&gbStatusPacket[gbRxGetLength], gbRxPacketLength - gbRxGetLength );
-		gbRxGetLength += nRead;
-		if( gbRxGetLength < gbRxPacketLength )
-		{
-			gbCommStatus = COMM_RXWAITING;
-			return;
-		}
+		dxl_ring_commit(&bus->rxRing, nRead);
+		bus->rxGetLength += nRead;
 	}
 
-	// Check checksum
-	for( i=0; i<(gbStatusPacket[LENGTH]+1); i++ )
-		checksum += gbStatusPacket[i+2];
-	checksum = ~checksum;
+	if( dxl_bus_parse_status(bus) )
+		return;
 
-	if( gbStatusPacket[gbStatusPacket[LENGTH]+3] != checksum )
+	if( dxl_port_timeout(bus->port) == 1 )
 	{
-		gbCommStatus = COMM_RXCORRUPT;
-		giBusUsing = 0;
+		if( bus->rxGetLength == 0 && dxl_ring_count(&bus->rxRing) == 0 )
+			bus->commStatus = COMM_RXTIMEOUT;
+		else
+			bus->commStatus = COMM_RXCORRUPT;
+		bus->busUsing = 0;
 		return;
 	}
-	
-	gbCommStatus = COMM_RXSUCCESS;
-	giBusUsing = 0;
+
+	bus->commStatus = COMM_RXWAITING;
 }
 
-void dxl_txrx_packet()
+// Time since the instruction was sent (or since the previous status packet of a bulk_read)
+static void dxl_bus_record_stats( DxlBus *bus )
 {
-	dxl_tx_packet();
+	long long now = dxl_stats_now_us();
+
+	dxl_stats_record(bus->instructionPacket[INSTRUCTION], bus->instructionPacket[ID],
+		bus->commStatus, now - bus->txTime);
+	bus->txTime = now;
+}
 
-	if( gbCommStatus != COMM_TXSUCCESS )
+static void dxl_bus_rx_complete( DxlBus *bus )
+{
+	if( bus->commStatus != COMM_TXSUCCESS )
+	{
+		dxl_bus_record_stats(bus);
 		return;	
+	}
 	
-	do{
-		dxl_rx_packet();		
-	}while( gbCommStatus == COMM_RXWAITING );	
+	dxl_bus_rx_packet(bus);
+	while( bus->commStatus == COMM_RXWAITING && bus->protocol == DXL_PROTOCOL_1 )
+	{
+		// In POLL mode sleep on the fd until bytes arrive instead of spinning on read()
+		if( dxl_port_get_rx_mode(bus->port) == DXL_HAL_RX_POLL )
+			dxl_port_wait_rx(bus->port);
+		dxl_bus_rx_packet(bus);		
+	}
+	dxl_bus_record_stats(bus);
 }
 
-int dxl_get_result()
+// Called before touching the TX buffer, as it is used until the end of RX. Threads are kept off
+// a bus in use by the caller (see BusScheduler), so a bus still busy here has a split-phase reply
+// outstanding: collect it, or let it time out, instead of spinning forever.
+static void dxl_bus_settle( DxlBus *bus )
 {
-	return gbCommStatus;
+	if( bus->busUsing == 0 )
+		return;
+	if( bus->commStatus == COMM_TXSUCCESS )
+		dxl_bus_rx_complete(bus);
+	bus->busUsing = 0;
 }
 
-void dxl_set_txpacket_id( int id )
+void dxl_bus_txrx_packet( DxlBus *bus )
 {
-	gbInstructionPacket[ID] = (unsigned char)id;
+	dxl_bus_tx_packet(bus);
+
+	dxl_bus_rx_complete(bus);
 }
 
-void dxl_set_txpacket_instruction( int instruction )
+int dxl_bus_get_result( DxlBus *bus )
 {
-	gbInstructionPacket[INSTRUCTION] = (unsigned char)instruction;
+	return bus->commStatus;
 }
 
-void dxl_set_txpacket_parameter( int index, int value )
+void dxl_bus_set_txpacket_id( DxlBus *bus, int id )
 {
-	gbInstructionPacket[PARAMETER+index] = (unsigned char)value;
+	bus->instructionPacket[ID] = (unsigned char)id;
 }
 
-void dxl_set_txpacket_length( int length )
+void dxl_bus_set_txpacket_instruction( DxlBus *bus, int instruction )
 {
-	gbInstructionPacket[LENGTH] = (unsigned char)length;
+	bus->instructionPacket[INSTRUCTION] = (unsigned char)instruction;
 }
 
-int dxl_get_rxpacket_error( int errbit )
+void dxl_bus_set_txpacket_parameter( DxlBus *bus, int index, int value )
 {
-	if( gbStatusPacket[ERRBIT] & (unsigned char)errbit )
+	// Out of range parameters are dropped; the packet length check in tx_packet then fails
+	if( index < 0 || index >= MAXNUM_TXPARAM )
+		return;
+	bus->instructionPacket[PARAMETER+index] = (unsigned char)value;
+}
+
+void dxl_bus_set_txpacket_length( DxlBus *bus, int length )
+{
+	bus->instructionPacket[LENGTH] = (unsigned char)length;
+}
+
+int dxl_bus_get_rxpacket_error( DxlBus *bus, int errbit )
+{
+	if( bus->statusPacket[ERRBIT] & (unsigned char)errbit )
 		return 1;
 
 	return 0;
 }
 
-int dxl_get_rxpacket_length()
+int dxl_bus_get_rxpacket_length( DxlBus *bus )
 {
-	return (int)gbStatusPacket[LENGTH];
+	return (int)bus->statusPacket[LENGTH];
 }
 
-int dxl_get_rxpacket_parameter( int index )
+int dxl_bus_get_rxpacket_parameter( DxlBus *bus, int index )
 {
-	return (int)gbStatusPacket[PARAMETER+index];
+	return (int)bus->statusPacket[PARAMETER+index];
 }
 
 int dxl_makeword( int lowbyte, int highbyte )
@@ -275,217 +456,339 @@ int dxl_get_highbyte( int word )
 	return (int)temp;
 }
 
-void dxl_ping( int id )
+void dxl_bus_ping( DxlBus *bus, int id )
 {
-	while(giBusUsing);
+	dxl_bus_settle(bus);
 
-	gbInstructionPacket[ID] = (unsigned char)id;
-	gbInstructionPacket[INSTRUCTION] = INST_PING;
-	gbInstructionPacket[LENGTH] = 2;
+	bus->instructionPacket[ID] = (unsigned char)id;
+	bus->instructionPacket[INSTRUCTION] = INST_PING;
+	bus->instructionPacket[LENGTH] = 2;
 	
-	dxl_txrx_packet();
+	dxl_bus_txrx_packet(bus);
 }
 
-int dxl_read_byte( int id, int address )
+int dxl_bus_scan( DxlBus *bus, int firstId, int lastId, float timeoutMs, DxlDeviceInfo *pDevices, int maxDevice )
 {
-	while(giBusUsing);
+	unsigned char ids[DXL_NUM_DEVICE_ID];
+	int model[DXL_NUM_DEVICE_ID], firmware[DXL_NUM_DEVICE_ID];
+	DxlTiming saved;
+	int id, i, numFound = 0, numDevice = 0;
+
+	dxl_bus_settle(bus);
+
+	if( firstId < 0 )
+		firstId = 0;
+	if( lastId > DXL_NUM_DEVICE_ID - 1 )
+		lastId = DXL_NUM_DEVICE_ID - 1;
 
-	gbInstructionPacket[ID] = (unsigned char)id;
-	gbInstructionPacket[INSTRUCTION] = INST_READ;
-	gbInstructionPacket[PARAMETER] = (unsigned char)address;
-	gbInstructionPacket[PARAMETER+1] = 1;
-	gbInstructionPacket[LENGTH] = 4;
+	if( bus->protocol == DXL_PROTOCOL_2 )
+	{
+		numFound = dxl2_bus_ping_broadcast(&bus->p2, DXL_NUM_DEVICE_ID, ids, model, firmware);
+		bus->commStatus = bus->p2.commStatus;
+		for( i=0; i<numFound && numDevice<maxDevice; i++ )
+		{
+			if( ids[i] < firstId || ids[i] > lastId )
+				continue;
+			pDevices[numDevice].id = ids[i];
+			pDevices[numDevice].modelNumber = model[i];
+			pDevices[numDevice].firmwareVersion = firmware[i];
+			numDevice++;
+		}
+		return numDevice;
+	}
+
+	// Protocol 1 has no broadcast PING: sweep with a short window
+	saved = bus->timing[DXL_TIMING_STATUS];
+	dxl_bus_set_timing(bus, DXL_TIMING_STATUS, timeoutMs, 0.0f, 0.0f);
+	for( id=firstId; id<=lastId; id++ )
+	{
+		dxl_bus_ping(bus, id);
+		if( bus->commStatus == COMM_RXSUCCESS )
+			ids[numFound++] = (unsigned char)id;
+	}
+	bus->timing[DXL_TIMING_STATUS] = saved;
+
+	// Model number and firmware version, addresses 0 to 2 of every control table
+	for( i=0; i<numFound && numDevice<maxDevice; i++ )
+	{
+		bus->instructionPacket[ID] = ids[i];
+		bus->instructionPacket[INSTRUCTION] = INST_READ;
+		bus->instructionPacket[PARAMETER] = 0;
+		bus->instructionPacket[PARAMETER+1] = 3;
+		bus->instructionPacket[LENGTH] = 4;
+		dxl_bus_txrx_packet(bus);
+
+		pDevices[numDevice].id = ids[i];
+		if( bus->commStatus == COMM_RXSUCCESS )
+		{
+			pDevices[numDevice].modelNumber = dxl_makeword(bus->statusPacket[PARAMETER], bus->statusPacket[PARAMETER+1]);
+			pDevices[numDevice].firmwareVersion = bus->statusPacket[PARAMETER+2];
+		}
+		else
+		{
+			// At status return level 0 only PING is answered
+			pDevices[numDevice].modelNumber = 0;
+			pDevices[numDevice].firmwareVersion = 0;
+		}
+		numDevice++;
+	}
+	return numDevice;
+}
+
+int dxl_bus_read_byte( DxlBus *bus, int id, int address )
+{
+	dxl_bus_settle(bus);
+
+	bus->instructionPacket[ID] = (unsigned char)id;
+	bus->instructionPacket[INSTRUCTION] = INST_READ;
+	bus->instructionPacket[PARAMETER] = (unsigned char)address;
+	bus->instructionPacket[PARAMETER+1] = 1;
+	bus->instructionPacket[LENGTH] = 4;
 	
-	dxl_txrx_packet();
+	dxl_bus_txrx_packet(bus);
 
-	return (int)gbStatusPacket[PARAMETER];
+	return (int)bus->statusPacket[PARAMETER];
 }
 
-void dxl_write_byte( int id, int address, int value )
+void dxl_bus_write_byte( DxlBus *bus, int id, int address, int value )
 {
-	while(giBusUsing);
+	dxl_bus_settle(bus);
 
-	gbInstructionPacket[ID] = (unsigned char)id;
-	gbInstructionPacket[INSTRUCTION] = INST_WRITE;
-	gbInstructionPacket[PARAMETER] = (unsigned char)address;
-	gbInstructionPacket[PARAMETER+1] = (unsigned char)value;
-	gbInstructionPacket[LENGTH] = 4;
+	bus->instructionPacket[ID] = (unsigned char)id;
+	bus->instructionPacket[INSTRUCTION] = INST_WRITE;
+	bus->instructionPacket[PARAMETER] = (unsigned char)address;
+	bus->instructionPacket[PARAMETER+1] = (unsigned char)value;
+	bus->instructionPacket[LENGTH] = 4;
 	
-	dxl_txrx_packet();
+	dxl_bus_txrx_packet(bus);
 }
 
-int dxl_read_word( int id, int address )
+int dxl_bus_read_word( DxlBus *bus, int id, int address )
 {
-	while(giBusUsing);
+	dxl_bus_settle(bus);
 
-	gbInstructionPacket[ID] = (unsigned char)id;
-	gbInstructionPacket[INSTRUCTION] = INST_READ;
-	gbInstructionPacket[PARAMETER] = (unsigned char)address;
-	gbInstructionPacket[PARAMETER+1] = 2;
-	gbInstructionPacket[LENGTH] = 4;
+	bus->instructionPacket[ID] = (unsigned char)id;
+	bus->instructionPacket[INSTRUCTION] = INST_READ;
+	bus->instructionPacket[PARAMETER] = (unsigned char)address;
+	bus->instructionPacket[PARAMETER+1] = 2;
+	bus->instructionPacket[LENGTH] = 4;
 	
-	dxl_txrx_packet();
+	dxl_bus_txrx_packet(bus);
 
-	return dxl_makeword((int)gbStatusPacket[PARAMETER], (int)gbStatusPacket[PARAMETER+1]);
+	return dxl_makeword((int)bus->statusPacket[PARAMETER], (int)bus->statusPacket[PARAMETER+1]);
 }
 
-void dxl_write_word( int id, int address, int value )
+void dxl_bus_write_word( DxlBus *bus, int id, int address, int value )
 {
-	while(giBusUsing);
-
-	gbInstructionPacket[ID] = (unsigned char)id;
-	gbInstructionPacket[INSTRUCTION] = INST_WRITE;
-	gbInstructionPacket[PARAMETER] = (unsigned char)address;
-	gbInstructionPacket[PARAMETER+1] = (unsigned char)dxl_get_lowbyte(value);
-	gbInstructionPacket[PARAMETER+2] = (unsigned char)dxl_get_highbyte(value);
-	gbInstructionPacket[LENGTH] = 5;
+	dxl_bus_settle(bus);
+
+	bus->instructionPacket[ID] = (unsigned char)id;
+	bus->instructionPacket[INSTRUCTION] = INST_WRITE;
+	bus->instructionPacket[PARAMETER] = (unsigned char)address;
+	bus->instructionPacket[PARAMETER+1] = (unsigned char)dxl_get_lowbyte(value);
+	bus->instructionPacket[PARAMETER+2] = (unsigned char)dxl_get_highbyte(value);
+	bus->instructionPacket[LENGTH] = 5;
 	
-	dxl_txrx_packet();
+	dxl_bus_txrx_packet(bus);
 }
 
 
-unsigned char gbSyncNbParam;
+void dxl_bus_reg_write( DxlBus *bus, int id, int address, const unsigned char *pData, int numByte )
+{
+	int i;
+
+	dxl_bus_settle(bus);
 
-void dxl_sync_write_start( int address, int data_length )
+	if( numByte < 1 || numByte > MAXNUM_TXPARAM - 1 )
+	{
+		bus->commStatus = COMM_TXERROR;
+		return;
+	}
+
+	bus->instructionPacket[ID] = (unsigned char)id;
+	bus->instructionPacket[INSTRUCTION] = INST_REG_WRITE;
+	bus->instructionPacket[PARAMETER] = (unsigned char)address;
+	for( i=0; i<numByte; i++ )
+		bus->instructionPacket[PARAMETER+1+i] = pData[i];
+	bus->instructionPacket[LENGTH] = numByte + 3;
+
+	dxl_bus_txrx_packet(bus);
+}
+
+void dxl_bus_action( DxlBus *bus )
 {
-	while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.
+	dxl_bus_settle(bus);
+
+	bus->instructionPacket[ID] = (unsigned char)BROADCAST_ID;
+	bus->instructionPacket[INSTRUCTION] = INST_ACTION;
+	bus->instructionPacket[LENGTH] = 2;
+
+	dxl_bus_txrx_packet(bus);
+}
+
+
+// A push that did not fit in the packet fails the whole sync/bulk command
+static int dxl_bus_sync_overflow( DxlBus *bus )
+{
+	if( bus->syncOverflow == 0 )
+		return 0;
+
+	bus->syncOverflow = 0;
+	bus->syncNbParam = 0;
+	bus->commStatus = COMM_TXERROR;
+	return 1;
+}
+
+void dxl_bus_sync_write_start( DxlBus *bus, int address, int data_length )
+{
+	dxl_bus_settle(bus);
 	
-	gbInstructionPacket[ID] = BROADCAST_ID; // use the device ID of the USB2AX instead of the broadcast ID to avoid some modifications to the RX code. 
-	gbInstructionPacket[INSTRUCTION] = INST_SYNC_WRITE;
-	gbInstructionPacket[PARAMETER] = (unsigned char)address;
-	gbInstructionPacket[PARAMETER+1] = (unsigned char)data_length;
-	gbSyncNbParam = 2;
+	bus->instructionPacket[ID] = BROADCAST_ID; // use the device ID of the USB2AX instead of the broadcast ID to avoid some modifications to the RX code. 
+	bus->instructionPacket[INSTRUCTION] = INST_SYNC_WRITE;
+	bus->instructionPacket[PARAMETER] = (unsigned char)address;
+	bus->instructionPacket[PARAMETER+1] = (unsigned char)data_length;
+	bus->syncNbParam = 2;
+	bus->syncOverflow = 0;
 }
 
-void dxl_sync_write_push_id( int id )
+void dxl_bus_sync_write_push_id( DxlBus *bus, int id )
 {
-    while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.	
+    dxl_bus_settle(bus);
 	
-    if ( gbSyncNbParam > MAXNUM_TXPARAM )
+    if ( bus->syncNbParam > MAXNUM_TXPARAM )
     {
+        bus->syncOverflow = 1; // the send will fail rather than send a truncated packet
         return;
     }
 	
-    gbInstructionPacket[PARAMETER+gbSyncNbParam++] = (unsigned char)id;
+    bus->instructionPacket[PARAMETER+bus->syncNbParam++] = (unsigned char)id;
 }
 
-void dxl_sync_write_push_byte( int value )
+void dxl_bus_sync_write_push_byte( DxlBus *bus, int value )
 {
-    while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.	
+    dxl_bus_settle(bus);
 	
-    if ( gbSyncNbParam > MAXNUM_TXPARAM )
+    if ( bus->syncNbParam > MAXNUM_TXPARAM )
     {
-       return;
+        bus->syncOverflow = 1; // the send will fail rather than send a truncated packet
+        return;
     }
 	
-    gbInstructionPacket[PARAMETER+gbSyncNbParam++] = (unsigned char)value;
+    bus->instructionPacket[PARAMETER+bus->syncNbParam++] = (unsigned char)value;
 }
 
-void dxl_sync_write_push_word( int value )
+void dxl_bus_sync_write_push_word( DxlBus *bus, int value )
 {
-    while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.	
+    dxl_bus_settle(bus);
 	
-    if ( gbSyncNbParam > MAXNUM_TXPARAM )
+    if ( bus->syncNbParam > MAXNUM_TXPARAM )
     {
+        bus->syncOverflow = 1; // the send will fail rather than send a truncated packet
         return;
     }
 	
-    gbInstructionPacket[PARAMETER+gbSyncNbParam++] = (unsigned char)dxl_get_lowbyte(value);
-	gbInstructionPacket[PARAMETER+gbSyncNbParam++] = (unsigned char)dxl_get_highbyte(value);
+    bus->instructionPacket[PARAMETER+bus->syncNbParam++] = (unsigned char)dxl_get_lowbyte(value);
+	bus->instructionPacket[PARAMETER+bus->syncNbParam++] = (unsigned char)dxl_get_highbyte(value);
 }
 
-void dxl_sync_write_send()
+void dxl_bus_sync_write_send( DxlBus *bus )
 {
-	while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.	
+	dxl_bus_settle(bus);
 	
-    gbInstructionPacket[LENGTH] = gbSyncNbParam + 2;
+    if( dxl_bus_sync_overflow(bus) )
+        return;
+	
+    bus->instructionPacket[LENGTH] = bus->syncNbParam + 2;
     
-	dxl_txrx_packet();
+	dxl_bus_txrx_packet(bus);
 }
 
 
-void dxl_sync_read_start( int address, int data_length )
+void dxl_bus_sync_read_start( DxlBus *bus, int address, int data_length )
 {
-    while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.	
+    dxl_bus_settle(bus);
 	
-    gbInstructionPacket[ID] = 0XFD; // use the device ID of the USB2AX instead of the broadcast ID to avoid some modifications to the rx code. 
-	gbInstructionPacket[INSTRUCTION] = INST_SYNC_READ;
-	gbInstructionPacket[PARAMETER] = (unsigned char)address;
-	gbInstructionPacket[PARAMETER+1] = (unsigned char)data_length;
-	gbSyncNbParam = 2;
+    bus->instructionPacket[ID] = 0XFD; // use the device ID of the USB2AX instead of the broadcast ID to avoid some modifications to the rx code. 
+	bus->instructionPacket[INSTRUCTION] = INST_SYNC_READ;
+	bus->instructionPacket[PARAMETER] = (unsigned char)address;
+	bus->instructionPacket[PARAMETER+1] = (unsigned char)data_length;
+	bus->syncNbParam = 2;
+	bus->syncOverflow = 0;
 }
 
-void dxl_sync_read_push_id( int id )
+void dxl_bus_sync_read_push_id( DxlBus *bus, int id )
 {
-    while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.	
+    dxl_bus_settle(bus);
 	
-    if ( gbSyncNbParam > MAXNUM_TXPARAM )
+    if ( bus->syncNbParam > MAXNUM_TXPARAM )
     {
+        bus->syncOverflow = 1; // the send will fail rather than send a truncated packet
         return;
     }
 	
-    gbInstructionPacket[PARAMETER+gbSyncNbParam++] = (unsigned char)id;
+    bus->instructionPacket[PARAMETER+bus->syncNbParam++] = (unsigned char)id;
 }
 
-void dxl_sync_read_send()
+void dxl_bus_sync_read_send( DxlBus *bus )
 {
-    while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.	
-	
-    gbInstructionPacket[LENGTH] = gbSyncNbParam + 2;
-    gbSyncNbParam = 0;
-
-	dxl_txrx_packet();
-}
-
-//// you will need to make a noblock_receive before anything else, because it will not allow any other command before it is done.
-//void dxl_sync_read_noblock_send(){
-//    while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.	
-//	
-//    gbInstructionPacket[LENGTH] = gbSyncNbParam + 2;
-//    gbSyncNbParam = 0;
-//    
-//    dxl_tx_packet();
-//
-//	if( gbCommStatus != COMM_TXSUCCESS )
-//		return;	
-//	
-//	do{
-//		dxl_rx_packet();		
-//	}while( gbCommStatus == COMM_RXWAITING );	
-//
-//    
-//}
-//
-//void dxl_sync_read_noblock_receive(){
-//    TODO
-//}
+    dxl_bus_settle(bus);
+	
+    if( dxl_bus_sync_overflow(bus) )
+        return;
+	
+    bus->instructionPacket[LENGTH] = bus->syncNbParam + 2;
+    bus->syncNbParam = 0;
+
+	dxl_bus_txrx_packet(bus);
+}
 
+// Split-phase sync_read. noblock_send only transmits the request and leaves the bus busy,
+// so you will need to make a noblock_receive before anything else, because it will not allow
+// any other command before it is done. The reply is collected, or times out, in noblock_receive.
+void dxl_bus_sync_read_noblock_send( DxlBus *bus )
+{
+    dxl_bus_settle(bus);
+	
+    if( dxl_bus_sync_overflow(bus) )
+        return;
+	
+    bus->instructionPacket[LENGTH] = bus->syncNbParam + 2;
+    bus->syncNbParam = 0;
 
-int dxl_sync_read_pop_byte()
+	dxl_bus_tx_packet(bus);
+}
+
+void dxl_bus_sync_read_noblock_receive( DxlBus *bus )
 {
-    while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.	
+	dxl_bus_rx_complete(bus);
+}
+
+
+int dxl_bus_sync_read_pop_byte( DxlBus *bus )
+{
+    dxl_bus_settle(bus);
 	
-    if ( gbSyncNbParam >= gbStatusPacket[LENGTH] - 2  )
+    if ( bus->syncNbParam >= bus->statusPacket[LENGTH] - 2  )
     {
         return -1;
     }
     
-    return (int)gbStatusPacket[PARAMETER+gbSyncNbParam++];
+    return (int)bus->statusPacket[PARAMETER+bus->syncNbParam++];
 }
 
-int dxl_sync_read_pop_word()
+int dxl_bus_sync_read_pop_word( DxlBus *bus )
 {
 	int b0, b1;
 
-    while(giBusUsing); // needs to be done before touching the TX buffer as it is used until the end of RX.	
+    dxl_bus_settle(bus);
 	
-    if ( gbSyncNbParam >= gbStatusPacket[LENGTH] - 3 )
+    if ( bus->syncNbParam >= bus->statusPacket[LENGTH] - 3 )
     {
         return -1;
 	}
 
-	b0 = gbStatusPacket[PARAMETER + gbSyncNbParam++];
-	b1 = gbStatusPacket[PARAMETER + gbSyncNbParam++];
+	b0 = bus->statusPacket[PARAMETER + bus->syncNbParam++];
+	b1 = bus->statusPacket[PARAMETER + bus->syncNbParam++];
 
     return dxl_makeword( b0, b1 );
 }
@@ -493,3 +796,309 @@ int dxl_sync_read_pop_word()
 
 
 
+
+
+
+void dxl_bus_bulk_read_start( DxlBus *bus )
+{
+	dxl_bus_settle(bus);
+	
+	bus->instructionPacket[ID] = BROADCAST_ID;
+	bus->instructionPacket[INSTRUCTION] = INST_BULK_READ;
+	bus->instructionPacket[PARAMETER] = 0;
+	bus->syncNbParam = 1;
+	bus->syncOverflow = 0;
+	bus->bulkNbData = 0;
+	bus->bulkPopIndex = 0;
+}
+
+void dxl_bus_bulk_read_push( DxlBus *bus, int id, int address, int data_length )
+{
+    dxl_bus_settle(bus);
+	
+    if ( bus->syncNbParam + 3 > MAXNUM_TXPARAM )
+    {
+        bus->syncOverflow = 1; // the send will fail rather than send a truncated packet
+        return;
+    }
+	
+    bus->instructionPacket[PARAMETER+bus->syncNbParam++] = (unsigned char)data_length;
+    bus->instructionPacket[PARAMETER+bus->syncNbParam++] = (unsigned char)id;
+    bus->instructionPacket[PARAMETER+bus->syncNbParam++] = (unsigned char)address;
+}
+
+void dxl_bus_bulk_read_send( DxlBus *bus )
+{
+	int i, nbEntries, length;
+
+    dxl_bus_settle(bus);
+	
+    if( dxl_bus_sync_overflow(bus) )
+        return;
+	
+    if( bus->protocol == DXL_PROTOCOL_2 )
+    {
+        bus->instructionPacket[LENGTH] = bus->syncNbParam + 2;
+        bus->txTime = dxl_stats_now_us();
+        dxl2_ax_bulk_read_send(bus);
+        dxl_bus_record_stats(bus);
+        return;
+    }
+
+    bus->instructionPacket[LENGTH] = bus->syncNbParam + 2;
+    nbEntries = (bus->syncNbParam - 1) / 3;
+    bus->syncNbParam = 0;
+	bus->bulkNbData = 0;
+	bus->bulkPopIndex = 0;
+
+	dxl_bus_tx_packet(bus);
+	if( bus->commStatus != COMM_TXSUCCESS )
+		return;
+
+	// Each motor answers with its own status packet, in the order of the request.
+	// The rx code pairs a status packet with the instruction ID, so expect each ID in turn.
+	for( i=0; i<nbEntries; i++ )
+	{
+		length = bus->instructionPacket[PARAMETER+1+3*i];
+		bus->instructionPacket[ID] = bus->instructionPacket[PARAMETER+2+3*i];
+		bus->commStatus = COMM_TXSUCCESS;
+		bus->busUsing = 1;
+		dxl_bus_set_rx_timeout( bus, DXL_TIMING_READ, length + 6, 1 );
+
+		dxl_bus_rx_complete(bus);
+		if( bus->commStatus != COMM_RXSUCCESS )
+			break;
+
+		if( bus->bulkNbData + length > MAXNUM_RXPARAM )
+		{
+			bus->commStatus = COMM_RXCORRUPT;
+			break;
+		}
+		memcpy( &bus->bulkData[bus->bulkNbData], &bus->statusPacket[PARAMETER], length );
+		bus->bulkNbData += length;
+	}
+
+	bus->instructionPacket[ID] = BROADCAST_ID;
+	bus->busUsing = 0;
+}
+
+int dxl_bus_bulk_read_pop_byte( DxlBus *bus )
+{
+    dxl_bus_settle(bus);
+	
+    if ( bus->bulkPopIndex >= bus->bulkNbData )
+    {
+        return -1;
+    }
+    
+    return (int)bus->bulkData[bus->bulkPopIndex++];
+}
+
+int dxl_bus_bulk_read_pop_word( DxlBus *bus )
+{
+	int b0, b1;
+
+    dxl_bus_settle(bus);
+	
+    if ( bus->bulkPopIndex + 1 >= bus->bulkNbData )
+    {
+        return -1;
+	}
+
+	b0 = bus->bulkData[bus->bulkPopIndex++];
+	b1 = bus->bulkData[bus->bulkPopIndex++];
+
+    return dxl_makeword( b0, b1 );
+}
+
+
+//////////// default bus wrappers ///////////////////////
+int dxl_initialize( int devIndex, int baudnum )
+{
+	return dxl_bus_initialize( dxl_default_bus(), devIndex, baudnum );
+}
+
+int dxl_initialize_path( const char *deviceName, int baudnum )
+{
+	return dxl_bus_initialize_path( dxl_default_bus(), deviceName, baudnum );
+}
+
+void dxl_terminate()
+{
+	dxl_bus_terminate( dxl_default_bus() );
+}
+
+void dxl_tx_packet()
+{
+	dxl_bus_tx_packet( dxl_default_bus() );
+}
+
+void dxl_rx_packet()
+{
+	dxl_bus_rx_packet( dxl_default_bus() );
+}
+
+void dxl_txrx_packet()
+{
+	dxl_bus_txrx_packet( dxl_default_bus() );
+}
+
+int dxl_get_result()
+{
+	return dxl_bus_get_result( dxl_default_bus() );
+}
+
+void dxl_set_txpacket_id( int id )
+{
+	dxl_bus_set_txpacket_id( dxl_default_bus(), id );
+}
+
+void dxl_set_txpacket_instruction( int instruction )
+{
+	dxl_bus_set_txpacket_instruction( dxl_default_bus(), instruction );
+}
+
+void dxl_set_txpacket_parameter( int index, int value )
+{
+	dxl_bus_set_txpacket_parameter( dxl_default_bus(), index, value );
+}
+
+void dxl_set_txpacket_length( int length )
+{
+	dxl_bus_set_txpacket_length( dxl_default_bus(), length );
+}
+
+int dxl_get_rxpacket_error( int errbit )
+{
+	return dxl_bus_get_rxpacket_error( dxl_default_bus(), errbit );
+}
+
+int dxl_get_rxpacket_length()
+{
+	return dxl_bus_get_rxpacket_length( dxl_default_bus() );
+}
+
+int dxl_get_rxpacket_parameter( int index )
+{
+	return dxl_bus_get_rxpacket_parameter( dxl_default_bus(), index );
+}
+
+void dxl_ping( int id )
+{
+	dxl_bus_ping( dxl_default_bus(), id );
+}
+
+int dxl_read_byte( int id, int address )
+{
+	return dxl_bus_read_byte( dxl_default_bus(), id, address );
+}
+
+void dxl_write_byte( int id, int address, int value )
+{
+	dxl_bus_write_byte( dxl_default_bus(), id, address, value );
+}
+
+int dxl_read_word( int id, int address )
+{
+	return dxl_bus_read_word( dxl_default_bus(), id, address );
+}
+
+void dxl_write_word( int id, int address, int value )
+{
+	dxl_bus_write_word( dxl_default_bus(), id, address, value );
+}
+
+void dxl_reg_write( int id, int address, const unsigned char *pData, int numByte )
+{
+	dxl_bus_reg_write( dxl_default_bus(), id, address, pData, numByte );
+}
+
+void dxl_action( void )
+{
+	dxl_bus_action( dxl_default_bus() );
+}
+
+void dxl_sync_write_start( int address, int data_length )
+{
+	dxl_bus_sync_write_start( dxl_default_bus(), address, data_length );
+}
+
+void dxl_sync_write_push_id( int id )
+{
+	dxl_bus_sync_write_push_id( dxl_default_bus(), id );
+}
+
+void dxl_sync_write_push_byte( int value )
+{
+	dxl_bus_sync_write_push_byte( dxl_default_bus(), value );
+}
+
+void dxl_sync_write_push_word( int value )
+{
+	dxl_bus_sync_write_push_word( dxl_default_bus(), value );
+}
+
+void dxl_sync_write_send()
+{
+	dxl_bus_sync_write_send( dxl_default_bus() );
+}
+
+void dxl_sync_read_start( int address, int data_length )
+{
+	dxl_bus_sync_read_start( dxl_default_bus(), address, data_length );
+}
+
+void dxl_sync_read_push_id( int id )
+{
+	dxl_bus_sync_read_push_id( dxl_default_bus(), id );
+}
+
+void dxl_sync_read_send()
+{
+	dxl_bus_sync_read_send( dxl_default_bus() );
+}
+
+void dxl_sync_read_noblock_send()
+{
+	dxl_bus_sync_read_noblock_send( dxl_default_bus() );
+}
+
+void dxl_sync_read_noblock_receive()
+{
+	dxl_bus_sync_read_noblock_receive( dxl_default_bus() );
+}
+
+int dxl_sync_read_pop_byte()
+{
+	return dxl_bus_sync_read_pop_byte( dxl_default_bus() );
+}
+
+int dxl_sync_read_pop_word()
+{
+	return dxl_bus_sync_read_pop_word( dxl_default_bus() );
+}
+
+void dxl_bulk_read_start()
+{
+	dxl_bus_bulk_read_start( dxl_default_bus() );
+}
+
+void dxl_bulk_read_push( int id, int address, int data_length )
+{
+	dxl_bus_bulk_read_push( dxl_default_bus(), id, address, data_length );
+}
+
+void dxl_bulk_read_send()
+{
+	dxl_bus_bulk_read_send( dxl_default_bus() );
+}
+
+int dxl_bulk_read_pop_byte()
+{
+	return dxl_bus_bulk_read_pop_byte( dxl_default_bus() );
+}
+
+int dxl_bulk_read_pop_word()
+{
+	return dxl_bus_bulk_read_pop_word( dxl_default_bus() );
+}
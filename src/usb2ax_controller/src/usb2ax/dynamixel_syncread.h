@@ -1,20 +1,154 @@
 #ifndef _DYNAMIXEL_SYNCREAD_HEADER
 #define _DYNAMIXEL_SYNCREAD_HEADER
 
+#include "dxl_hal.h"
+#include "dxl_ring.h"
+#include "dynamixel2.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 
+#define MAXNUM_TXPARAM		(150)
+#define MAXNUM_RXPARAM		(225)
+
+// Bus protocols
+#define DXL_PROTOCOL_1		(1)
+#define DXL_PROTOCOL_2		(2)
+
+// Receive timeout classes
+#define DXL_TIMING_STATUS		(0)		// Status packet without data: PING, WRITE, REG_WRITE, ...
+#define DXL_TIMING_READ			(1)		// READ, and each reply of a bulk_read
+#define DXL_TIMING_SYNC_READ	(2)		// USB2AX sync_read
+#define DXL_NUM_TIMING			(3)
+
+// Status return level of a device (control table address 16): which instructions it answers
+#define DXL_STATUS_RETURN_ADDRESS	(16)
+#define DXL_STATUS_RETURN_NONE		(0)		// PING only
+#define DXL_STATUS_RETURN_READ		(1)		// PING and READ
+#define DXL_STATUS_RETURN_ALL		(2)		// Every instruction (factory default)
+#define DXL_NUM_DEVICE_ID			(254)
+
+// Receive timeout of a class: baseMs + perByteMs * reply bytes + perMotorMs * motors.
+// Until a class is calibrated, the HAL default (transfer time + 34 ms) is used.
+typedef struct
+{
+	int calibrated;
+	float baseMs;
+	float perByteMs;
+	float perMotorMs;
+} DxlTiming;
+
+// A device found by dxl_bus_scan
+typedef struct
+{
+	int id;
+	int modelNumber;
+	int firmwareVersion;
+} DxlDeviceInfo;
+
+///////////// bus context ////////////////////////////////////
+// All state of one Dynamixel bus: serial port, packet buffers and transaction status.
+// Each bus may be driven from its own thread; the dxl_* functions below use a default bus.
+// On a Protocol 2.0 bus the same functions, with AX-12 addresses and units, are translated
+// to the X series control table (see dynamixel2_ax.h).
+typedef struct
+{
+	DxlPort *port;
+	DxlPort ownPort;
+	int protocol;
+	int fastSyncRead;
+	Dxl2Bus p2;				// Protocol 2.0 state, p2.port is always port
+	unsigned char instructionPacket[MAXNUM_TXPARAM+10];
+	unsigned char statusPacket[DXL_RING_MAX_PACKET];
+	DxlRing rxRing;
+	int rxGetLength;
+	int commStatus;
+	long long txTime;		// us, CLOCK_MONOTONIC, for the latency statistics (see dxl_stats.h)
+	int busUsing;
+	DxlTiming timing[DXL_NUM_TIMING];
+	unsigned char statusReturnLevel[DXL_NUM_DEVICE_ID];	// As last written, so that no status is awaited in vain
+	unsigned char syncNbParam;
+	int syncOverflow;
+	unsigned char bulkData[MAXNUM_RXPARAM];
+	int bulkNbData;
+	int bulkPopIndex;
+} DxlBus;
+
+void dxl_bus_init( DxlBus *bus );
+DxlBus *dxl_default_bus();
+
+int dxl_bus_initialize( DxlBus *bus, int deviceIndex, int baudnum );
+int dxl_bus_initialize_path( DxlBus *bus, const char *deviceName, int baudnum );
+void dxl_bus_set_protocol( DxlBus *bus, int protocol );
+int dxl_bus_get_protocol( DxlBus *bus );
+void dxl_bus_set_fast_sync_read( DxlBus *bus, int enable );
+void dxl_bus_set_timing( DxlBus *bus, int timingClass, float baseMs, float perByteMs, float perMotorMs );
+void dxl_bus_clear_timing( DxlBus *bus );
+// The level is tracked from the WRITE and SYNC_WRITE instructions to address 16; these set it
+// without talking to the motors, e.g. after reading it back at startup. BROADCAST_ID sets all.
+void dxl_bus_set_status_return_level( DxlBus *bus, int id, int level );
+int dxl_bus_get_status_return_level( DxlBus *bus, int id );
+void dxl_bus_terminate( DxlBus *bus );
+
+void dxl_bus_set_txpacket_id( DxlBus *bus, int id );
+void dxl_bus_set_txpacket_instruction( DxlBus *bus, int instruction );
+void dxl_bus_set_txpacket_parameter( DxlBus *bus, int index, int value );
+void dxl_bus_set_txpacket_length( DxlBus *bus, int length );
+int dxl_bus_get_rxpacket_error( DxlBus *bus, int errbit );
+int dxl_bus_get_rxpacket_length( DxlBus *bus );
+int dxl_bus_get_rxpacket_parameter( DxlBus *bus, int index );
+
+void dxl_bus_tx_packet( DxlBus *bus );
+void dxl_bus_rx_packet( DxlBus *bus );
+void dxl_bus_txrx_packet( DxlBus *bus );
+int dxl_bus_get_result( DxlBus *bus );
+
+void dxl_bus_ping( DxlBus *bus, int id );
+// Discovery of the devices with IDs firstId to lastId, with their model number and firmware version.
+// A Protocol 1 bus pings each ID with a receive window of timeoutMs, so that a missing ID costs
+// little more than that; a Protocol 2.0 bus collects the replies to one broadcast PING.
+// Returns the number of devices written to pDevices, up to maxDevice, in the order of the IDs.
+int dxl_bus_scan( DxlBus *bus, int firstId, int lastId, float timeoutMs, DxlDeviceInfo *pDevices, int maxDevice );
+int dxl_bus_read_byte( DxlBus *bus, int id, int address );
+void dxl_bus_write_byte( DxlBus *bus, int id, int address, int value );
+int dxl_bus_read_word( DxlBus *bus, int id, int address );
+void dxl_bus_write_word( DxlBus *bus, int id, int address, int value );
+
+// Staged write: the data is held in the motor's registered buffer until ACTION, which is
+// always broadcast so that all motors of the bus start together
+void dxl_bus_reg_write( DxlBus *bus, int id, int address, const unsigned char *pData, int numByte );
+void dxl_bus_action( DxlBus *bus );
+
+void dxl_bus_sync_write_start( DxlBus *bus, int address, int data_length );
+void dxl_bus_sync_write_push_id( DxlBus *bus, int id );
+void dxl_bus_sync_write_push_byte( DxlBus *bus, int value );
+void dxl_bus_sync_write_push_word( DxlBus *bus, int value );
+void dxl_bus_sync_write_send( DxlBus *bus );
+
+void dxl_bus_sync_read_start( DxlBus *bus, int address, int data_length );
+void dxl_bus_sync_read_push_id( DxlBus *bus, int id );
+void dxl_bus_sync_read_send( DxlBus *bus );
+void dxl_bus_sync_read_noblock_send( DxlBus *bus );
+void dxl_bus_sync_read_noblock_receive( DxlBus *bus );
+int dxl_bus_sync_read_pop_byte( DxlBus *bus );
+int dxl_bus_sync_read_pop_word( DxlBus *bus );
+
+void dxl_bus_bulk_read_start( DxlBus *bus );
+void dxl_bus_bulk_read_push( DxlBus *bus, int id, int address, int data_length );
+void dxl_bus_bulk_read_send( DxlBus *bus );
+int dxl_bus_bulk_read_pop_byte( DxlBus *bus );
+int dxl_bus_bulk_read_pop_word( DxlBus *bus );
+
+
 ///////////// device control methods ////////////////////////
 int dxl_initialize( int deviceIndex, int baudnum );
+int dxl_initialize_path( const char *deviceName, int baudnum );
 void dxl_terminate();
 
 
 ///////////// set/get packet methods //////////////////////////
-#define MAXNUM_TXPARAM		(150)
-#define MAXNUM_RXPARAM		(225)
-
 void dxl_set_txpacket_id( int id );
 #define BROADCAST_ID		(254)
 
@@ -27,6 +161,7 @@ void dxl_set_txpacket_instruction( int instruction );
 #define INST_RESET			(6)
 #define INST_SYNC_WRITE		(131)
 #define INST_SYNC_READ		(132)
+#define INST_BULK_READ		(146)
 
 void dxl_set_txpacket_parameter( int index, int value );
 void dxl_set_txpacket_length( int length );
@@ -72,6 +207,8 @@ int dxl_read_byte( int id, int address );
 void dxl_write_byte( int id, int address, int value );
 int dxl_read_word( int id, int address );
 void dxl_write_word( int id, int address, int value );
+void dxl_reg_write( int id, int address, const unsigned char *pData, int numByte );
+void dxl_action( void );
 
 //////////// Synchroneous communication methods ///////////////////////
 void dxl_sync_write_start( int address, int data_length );
@@ -83,11 +220,18 @@ void dxl_sync_write_send();
 void dxl_sync_read_start( int address, int data_length );
 void dxl_sync_read_push_id( int id );
 void dxl_sync_read_send();
-//void dxl_sync_read_noblock_send();
-//void dxl_sync_read_noblock_receive();
+void dxl_sync_read_noblock_send();
+void dxl_sync_read_noblock_receive();
 int dxl_sync_read_pop_byte();
 int dxl_sync_read_pop_word();
 
+//////////// Bulk read: one start address and length per motor ///////////////////////
+void dxl_bulk_read_start();
+void dxl_bulk_read_push( int id, int address, int data_length );
+void dxl_bulk_read_send();
+int dxl_bulk_read_pop_byte();
+int dxl_bulk_read_pop_word();
+
 
 #ifdef __cplusplus
 }